@@ -14,8 +14,15 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <string.h>
 #include <math.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+#include <log/log.h>
 #include "audio_ops.h"
 
 namespace android {
@@ -25,50 +32,218 @@ namespace CPP_VERSION {
 namespace implementation {
 namespace aops {
 
-void multiplyByVolume(const float volume, int16_t *a, const size_t n) {
-    constexpr int_fast32_t kDenominator = 32768;
-    const int_fast32_t numerator =
-        static_cast<int_fast32_t>(round(volume * kDenominator));
-
-    if (numerator >= kDenominator) {
-        return;  // (numerator > kDenominator) is not expected
-    } else if (numerator <= 0) {
-        memset(a, 0, n * sizeof(*a));
-        return;  // (numerator < 0) is not expected
+namespace {
+constexpr int_fast32_t kUnityQ15 = 32768;
+
+int_fast32_t volumeToQ15(const float volume) {
+    return static_cast<int_fast32_t>(round(volume * kUnityQ15));
+}
+
+// (x * q15 + 2^14) >> 15 (rounds half up), this is what both vqrdmulh and
+// pmulhrsw compute for a non negative q15, so all paths below are bit exact.
+// Every fixed point format uses it.
+template <class T> T mulQ15(const T x, const int_fast32_t q15) {
+    return (int64_t(x) * q15 + kUnityQ15 / 2) >> 15;
+}
+
+// Ramps keep the volume constant over blocks of kRampBlockFrames, this way
+// every block goes through the SIMD multiply. A block gets the volume of its
+// middle frame. Short ramps change the volume every frame.
+constexpr size_t kRampBlockFrames = 8;
+constexpr size_t kRampMinBlockedFrames = 64;
+
+size_t getRampBlockFrames(const size_t nFrames) {
+    return (nFrames >= kRampMinBlockedFrames) ? kRampBlockFrames : 1;
+}
+
+// The per frame ramp step is in Q15 with 16 more fractional bits.
+constexpr int kRampStepShift = 16;
+
+int64_t getRampStep(const int_fast32_t fromQ15, const int_fast32_t toQ15,
+                    const size_t nFrames) {
+    return (int64_t(toQ15 - fromQ15) << kRampStepShift) / int64_t(nFrames - 1);
+}
+
+int_fast32_t getRampQ15(const int_fast32_t fromQ15, const int64_t step, const size_t i) {
+    return ((int64_t(fromQ15) << kRampStepShift) + step * int64_t(i)
+            + (int64_t(1) << (kRampStepShift - 1))) >> kRampStepShift;
+}
+}  // namespace
+
+namespace {
+void multiplyByVolumeQ15(const int_fast32_t q15, int16_t *dst, const int16_t *src,
+                         const size_t n) {
+    if (q15 >= kUnityQ15) {
+        if (dst != src) {
+            memcpy(dst, src, n * sizeof(*dst));
+        }
+        return;  // (q15 > kUnityQ15) is not expected
+    } else if (q15 <= 0) {
+        memset(dst, 0, n * sizeof(*dst));
+        return;  // (q15 < 0) is not expected
     }
 
-    int16_t *end = a + n;
+    int16_t *const end = dst + n;
 
-    // The unroll code below is to save on CPU branch instructions.
-    // 8 is arbitrary chosen.
+#if defined(__ARM_NEON)
+    for (; (end - dst) >= 8; dst += 8, src += 8) {
+        vst1q_s16(dst, vqrdmulhq_n_s16(vld1q_s16(src), q15));
+    }
+#elif defined(__SSSE3__)
+    const __m128i v = _mm_set1_epi16(q15);
+    for (; (end - dst) >= 8; dst += 8, src += 8) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst),
+                         _mm_mulhrs_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src)), v));
+    }
+#endif
 
-#define STEP \
-        *a = (*a * numerator + kDenominator / 2) / kDenominator; \
-        ++a
+    for (; dst < end; ++dst, ++src) {
+        *dst = mulQ15(*src, q15);
+    }
+}
 
-    switch (n % 8) {
-    case 7:  goto l7;
-    case 6:  goto l6;
-    case 5:  goto l5;
-    case 4:  goto l4;
-    case 3:  goto l3;
-    case 2:  goto l2;
-    case 1:  goto l1;
-    default: break;
+void multiplyByVolume(const float volume, int16_t *dst, const int16_t *src, const size_t n) {
+    multiplyByVolumeQ15(volumeToQ15(volume), dst, src, n);
+}
+
+void multiplyByVolume(const float volume, float *dst, const float *src, const size_t n) {
+    if (volume >= 1.0f) {
+        if (dst != src) {
+            memcpy(dst, src, n * sizeof(*dst));
+        }
+        return;
+    } else if (volume <= 0.0f) {
+        memset(dst, 0, n * sizeof(*dst));
+        return;
     }
 
-    while (a < end) {
-        STEP;
-l7:     STEP;
-l6:     STEP;
-l5:     STEP;
-l4:     STEP;
-l3:     STEP;
-l2:     STEP;
-l1:     STEP;
+    for (size_t i = 0; i < n; ++i) {  // vectorized by the compiler
+        dst[i] = src[i] * volume;
     }
+}
 
-#undef STEP
+void rampVolume(const float fromVolume, const float toVolume,
+                int16_t *dst, const int16_t *src,
+                const size_t nFrames, const size_t nChannels) {
+    const int_fast32_t fromQ15 = std::clamp(volumeToQ15(fromVolume), int_fast32_t(0), kUnityQ15);
+    const int_fast32_t toQ15 = std::clamp(volumeToQ15(toVolume), int_fast32_t(0), kUnityQ15);
+    if ((fromQ15 == toQ15) || (nFrames < 2)) {
+        multiplyByVolume(toVolume, dst, src, nFrames * nChannels);
+        return;
+    }
+
+    const int64_t step = getRampStep(fromQ15, toQ15, nFrames);
+    const size_t blockFrames = getRampBlockFrames(nFrames);
+    for (size_t i = 0; i < nFrames; i += blockFrames) {
+        const size_t n = std::min(blockFrames, nFrames - i) * nChannels;
+        const size_t mid = (i + std::min(i + blockFrames, nFrames) - 1) / 2;
+        multiplyByVolumeQ15(getRampQ15(fromQ15, step, mid), dst, src, n);
+        dst += n;
+        src += n;
+    }
+}
+
+void rampVolume(const float fromVolume, const float toVolume,
+                float *dst, const float *src,
+                const size_t nFrames, const size_t nChannels) {
+    if ((fromVolume == toVolume) || (nFrames < 2)) {
+        multiplyByVolume(toVolume, dst, src, nFrames * nChannels);
+        return;
+    }
+
+    const float step = (toVolume - fromVolume) / (nFrames - 1);
+    const size_t blockFrames = getRampBlockFrames(nFrames);
+    for (size_t i = 0; i < nFrames; i += blockFrames) {
+        const size_t n = std::min(blockFrames, nFrames - i) * nChannels;
+        const size_t mid = (i + std::min(i + blockFrames, nFrames) - 1) / 2;
+        multiplyByVolume(std::clamp(fromVolume + step * mid, 0.0f, 1.0f), dst, src, n);
+        dst += n;
+        src += n;
+    }
+}
+
+void rampVolumePacked24(const float fromVolume, const float toVolume,
+                        uint8_t *dst, const uint8_t *src,
+                        const size_t nFrames, const size_t nChannels) {
+    const int_fast32_t fromQ15 = std::clamp(volumeToQ15(fromVolume), int_fast32_t(0), kUnityQ15);
+    const int_fast32_t toQ15 = std::clamp(volumeToQ15(toVolume), int_fast32_t(0), kUnityQ15);
+    if ((fromQ15 == toQ15) && (toQ15 == kUnityQ15)) {
+        if (dst != src) {
+            memcpy(dst, src, nFrames * nChannels * 3);
+        }
+        return;
+    } else if ((fromQ15 == toQ15) && (toQ15 == 0)) {
+        memset(dst, 0, nFrames * nChannels * 3);
+        return;
+    }
+
+    // there is no SIMD kernel for packed 24 bit, the volume changes every
+    // frame, a single frame gets `toVolume` as with the other formats
+    const int64_t step = (nFrames < 2) ? 0 : getRampStep(fromQ15, toQ15, nFrames);
+    const int_fast32_t startQ15 = (nFrames < 2) ? toQ15 : fromQ15;
+    for (size_t i = 0; i < nFrames; ++i) {
+        const int_fast32_t q15 = getRampQ15(startQ15, step, i);
+        for (size_t c = 0; c < nChannels; ++c, dst += 3, src += 3) {
+            const int32_t x = int32_t(src[0]) | (int32_t(src[1]) << 8) |
+                              (int32_t(int8_t(src[2])) << 16);
+            const int32_t y = mulQ15(x, q15);
+            dst[0] = y;
+            dst[1] = y >> 8;
+            dst[2] = y >> 16;
+        }
+    }
+}
+}  // namespace
+
+void multiplyByVolume(const float volume, int16_t *a, const size_t n) {
+    multiplyByVolume(volume, a, a, n);
+}
+
+void multiplyByVolume(const float volume, float *a, const size_t n) {
+    multiplyByVolume(volume, a, a, n);
+}
+
+void rampVolume(const float fromVolume, const float toVolume,
+                int16_t *a, const size_t nFrames, const size_t nChannels) {
+    rampVolume(fromVolume, toVolume, a, a, nFrames, nChannels);
+}
+
+void rampVolume(const float fromVolume, const float toVolume,
+                float *a, const size_t nFrames, const size_t nChannels) {
+    rampVolume(fromVolume, toVolume, a, a, nFrames, nChannels);
+}
+
+void rampVolumePacked24(const float fromVolume, const float toVolume,
+                        uint8_t *a, const size_t nFrames, const size_t nChannels) {
+    rampVolumePacked24(fromVolume, toVolume, a, a, nFrames, nChannels);
+}
+
+void rampVolume(const float fromVolume, const float toVolume, const audio_format_t format,
+                void *a, const size_t nFrames, const size_t nChannels) {
+    rampVolume(fromVolume, toVolume, format, a, a, nFrames, nChannels);
+}
+
+void rampVolume(const float fromVolume, const float toVolume, const audio_format_t format,
+                void *dst, const void *src, const size_t nFrames, const size_t nChannels) {
+    switch (format) {
+    case AUDIO_FORMAT_PCM_16_BIT:
+        rampVolume(fromVolume, toVolume, static_cast<int16_t *>(dst),
+                   static_cast<const int16_t *>(src), nFrames, nChannels);
+        break;
+
+    case AUDIO_FORMAT_PCM_FLOAT:
+        rampVolume(fromVolume, toVolume, static_cast<float *>(dst),
+                   static_cast<const float *>(src), nFrames, nChannels);
+        break;
+
+    case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+        rampVolumePacked24(fromVolume, toVolume, static_cast<uint8_t *>(dst),
+                           static_cast<const uint8_t *>(src), nFrames, nChannels);
+        break;
+
+    default:
+        LOG_ALWAYS_FATAL("%s:%d unexpected format: %#x", __func__, __LINE__, format);
+    }
 }
 
 }  // namespace aops
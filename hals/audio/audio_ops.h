@@ -15,7 +15,9 @@
  */
 
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
+#include <system/audio.h>
 
 namespace android {
 namespace hardware {
@@ -24,7 +26,31 @@ namespace CPP_VERSION {
 namespace implementation {
 namespace aops {
 
+// Unity and mute are exact, other volumes are rounded to Q15.
 void multiplyByVolume(float volume, int16_t *a, size_t n);
+void multiplyByVolume(float volume, float *a, size_t n);
+
+// Changes the volume linearly from `fromVolume` to `toVolume` over
+// `nFrames` interleaved frames, used when the stream volume changes to
+// avoid zipper noise. Same as multiplyByVolume if the volumes are equal.
+// 16 bit and float ramps of 64 frames or more change the volume every 8
+// frames.
+void rampVolume(float fromVolume, float toVolume,
+                int16_t *a, size_t nFrames, size_t nChannels);
+void rampVolume(float fromVolume, float toVolume,
+                float *a, size_t nFrames, size_t nChannels);
+void rampVolumePacked24(float fromVolume, float toVolume,
+                        uint8_t *a, size_t nFrames, size_t nChannels);
+
+// Dispatches to the functions above, `format` is one of the formats
+// util::getPcmFormat returns.
+void rampVolume(float fromVolume, float toVolume, audio_format_t format,
+                void *a, size_t nFrames, size_t nChannels);
+
+// Same as above but reads `src` and writes `dst` in one pass, `dst` and
+// `src` either do not overlap or are equal.
+void rampVolume(float fromVolume, float toVolume, audio_format_t format,
+                void *dst, const void *src, size_t nFrames, size_t nChannels);
 
 }  // namespace aops
 }  // namespace implementation
@@ -16,16 +16,20 @@
 
 #include PATH(APM_XSD_ENUMS_H_FILENAME)
 #include <android-base/properties.h>
+#include <android-base/stringprintf.h>
 #include <chrono>
+#include <cinttypes>
+#include <string.h>
 #include <thread>
 #include <log/log.h>
 #include <utils/Mutex.h>
 #include <utils/Timers.h>
-#include <utils/ThreadDefs.h>
 #include "device_port_sink.h"
+#include "output_mixer.h"
 #include "talsa.h"
 #include "audio_ops.h"
 #include "ring_buffer.h"
+#include "telemetry.h"
 #include "util.h"
 #include "debug.h"
 
@@ -43,7 +47,8 @@ namespace implementation {
 
 namespace {
 
-constexpr int kMaxJitterUs = 3000;  // Enforced by CTS, should be <= 6ms
+constexpr int kMinJitterUs = 1000;
+constexpr int kMaxJitterUs = 6000;  // Enforced by CTS, should be <= 6ms
 
 struct TinyalsaSink : public DevicePortSink {
     TinyalsaSink(unsigned pcmCard, unsigned pcmDevice,
@@ -51,31 +56,26 @@ struct TinyalsaSink : public DevicePortSink {
                  uint64_t initialFrames)
             : mStartNs(systemTime(SYSTEM_TIME_MONOTONIC))
             , mSampleRateHz(cfg.base.sampleRateHz)
-            , mFrameSize(util::countChannels(cfg.base.channelMask) * sizeof(int16_t))
+            , mFormat(util::getPcmFormat(cfg.base.format))
+            , mNChannels(util::countChannels(cfg.base.channelMask))
+            , mFrameSize(mNChannels * audio_bytes_per_sample(mFormat))
             , mWriteSizeFrames(cfg.frameCount)
             , mInitialFrames(initialFrames)
             , mFrames(initialFrames)
             , mRingBuffer(mFrameSize * cfg.frameCount * 3)
-            , mMixer(pcmCard)
-            , mPcm(talsa::pcmOpen(pcmCard, pcmDevice,
-                                  util::countChannels(cfg.base.channelMask),
-                                  cfg.base.sampleRateHz,
-                                  cfg.frameCount,
-                                  true /* isOut */)) {
-        if (mPcm) {
-            mConsumeThread = std::thread(&TinyalsaSink::consumeThread, this);
-        } else {
-            mConsumeThread = std::thread([](){});
+            , mTargetFillFrames(cfg.frameCount * 3)
+            , mPcmLatencyMs(getLatencyMs(cfg))
+            , mTelemetryLogPeriodNs(s2ns(getTelemetryLogPeriodS()))
+            , mOutputMixer(OutputMixer::get(pcmCard, pcmDevice, mSampleRateHz,
+                                            cfg.frameCount)) {
+        if (mOutputMixer) {
+            mOutputMixer->addInput(&mRingBuffer, mSampleRateHz, mNChannels, mFormat);
         }
     }
 
     ~TinyalsaSink() {
-        mConsumeThreadRunning = false;
-        ALOGD("%s: joining consumeThread", __func__);
-        mConsumeThread.join();
-        if (mPcm) {
-            ALOGD("%s: stopping PCM stream", __func__);
-            LOG_ALWAYS_FATAL_IF(pcm_stop(mPcm.get()) != 0);
+        if (mOutputMixer) {
+            mOutputMixer->removeInput(&mRingBuffer);
         }
     }
 
@@ -119,10 +119,98 @@ struct TinyalsaSink : public DevicePortSink {
         auto presentationFrames = getPresentationFramesLocked(nowNs);
         if (mReceivedFrames + mMissedFrames < presentationFrames) {
             // There has been an underrun
-            mMissedFrames = presentationFrames - mReceivedFrames;
+            const uint64_t missedFrames = presentationFrames - mReceivedFrames;
+            mUnderruns++;
+            mUnderrunFrames += missedFrames - mMissedFrames;
+            mMissedFrames = missedFrames;
+            growTargetFillLocked();
         }
         size_t pendingFrames = mReceivedFrames + mMissedFrames - presentationFrames;
-        return mRingBuffer.capacity() / mFrameSize - pendingFrames;
+        return (mTargetFillFrames > pendingFrames) ? (mTargetFillFrames - pendingFrames) : 0;
+    }
+
+    // The jitter allowance follows the measured pcm_write jitter, it is
+    // how long `write` waits for the mixer thread past the deadline.
+    int getJitterAllowanceUs() const {
+        const int jitterUs = std::min<uint32_t>(
+            mOutputMixer->getPcmJitterUs(), kMaxJitterUs);
+        return std::min(kMinJitterUs + 2 * jitterUs, kMaxJitterUs);
+    }
+
+    size_t getMinTargetFillFramesLocked() const {
+        return mWriteSizeFrames + size_t(mSampleRateHz) * getJitterAllowanceUs() / 1000000;
+    }
+
+    // The target fill level is how many frames are queued ahead of the
+    // presentation position. It grows quickly on underruns and drops and
+    // shrinks slowly (every second without a glitch) to keep latency low.
+    void growTargetFillLocked() {
+        mTargetFillFrames = std::min(mTargetFillFrames + mWriteSizeFrames / 2,
+                                     mRingBuffer.capacity() / mFrameSize);
+        mFramesSinceGlitch = 0;
+    }
+
+    void updateTargetFillLocked(const size_t framesWritten) {
+        mFramesSinceGlitch += framesWritten;
+        if (mFramesSinceGlitch >= mSampleRateHz) {
+            const size_t minTargetFillFrames = getMinTargetFillFramesLocked();
+            const size_t step = std::max(mWriteSizeFrames / 8, 1u);
+            mTargetFillFrames = (mTargetFillFrames > (minTargetFillFrames + step))
+                ? (mTargetFillFrames - step) : minTargetFillFrames;
+            mFramesSinceGlitch = 0;
+        }
+    }
+
+    // Frames queued ahead of the presentation position plus the PCM and
+    // host latency.
+    uint32_t getEstimatedLatencyUsLocked(const nsecs_t nowNs) const {
+        const uint64_t presentationFrames = getPresentationFramesLocked(nowNs);
+        const uint64_t queuedFrames = mReceivedFrames + mMissedFrames;
+        const uint64_t pendingFrames = (queuedFrames > presentationFrames)
+            ? (queuedFrames - presentationFrames) : 0;
+        return pendingFrames * 1000000 / mSampleRateHz + mPcmLatencyMs * 1000;
+    }
+
+    void dump(std::string &out) const override {
+        const AutoMutex lock(mFrameCountersMutex);
+        android::base::StringAppendF(
+            &out, "  TinyalsaSink: targetFill=%zu frames (min=%zu max=%zu) "
+            "jitterAllowance=%dus underruns=%" PRIu64 " (%" PRIu64 " frames) "
+            "dropped=%" PRIu64 " frames writes=%" PRIu64 " estimatedLatency=%uus\n",
+            mTargetFillFrames, getMinTargetFillFramesLocked(),
+            mRingBuffer.capacity() / mFrameSize, getJitterAllowanceUs(),
+            mUnderruns, mUnderrunFrames, mDroppedFrames, mWrites,
+            getEstimatedLatencyUsLocked(systemTime(SYSTEM_TIME_MONOTONIC)));
+        mWriteIntervalHistogram.dump(out, "writeInterval");
+        mRingFillHistogram.dump(out, "ringFill");
+        mOutputMixer->dump(out);
+    }
+
+    void updateTelemetryLocked(const nsecs_t nowNs) {
+        if (mPrevWriteNs) {
+            mWriteIntervalHistogram.add(std::min<int64_t>(ns2us(nowNs - mPrevWriteNs),
+                                                          UINT32_MAX));
+        }
+        mPrevWriteNs = nowNs;
+        ++mWrites;
+
+        const size_t fillFrames = mRingBuffer.availableToConsume() / mFrameSize;
+        mRingFillHistogram.add(uint64_t(fillFrames) * 1000000 / mSampleRateHz);
+
+        if (mTelemetryLogPeriodNs && ((nowNs - mTelemetryLogNs) >= mTelemetryLogPeriodNs)) {
+            ALOGI("TinyalsaSink: writes=%" PRIu64 " writeInterval p50<%uus p99<%uus max=%uus "
+                  "ringFill p50<%uus p99<%uus underruns=%" PRIu64 " dropped=%" PRIu64
+                  " frames pcmWrite p99<%uus estimatedLatency=%uus",
+                  mWrites, mWriteIntervalHistogram.getPercentileUs(50),
+                  mWriteIntervalHistogram.getPercentileUs(99),
+                  mWriteIntervalHistogram.getMaxUs(),
+                  mRingFillHistogram.getPercentileUs(50),
+                  mRingFillHistogram.getPercentileUs(99),
+                  mUnderruns, mDroppedFrames,
+                  mOutputMixer->getPcmWriteDurationHistogram().getPercentileUs(99),
+                  getEstimatedLatencyUsLocked(nowNs));
+            mTelemetryLogNs = nowNs;
+        }
     }
 
     size_t calcWaitFramesNowLocked(const size_t requestedFrames) {
@@ -133,8 +221,10 @@ struct TinyalsaSink : public DevicePortSink {
 
     size_t write(float volume, size_t bytesToWrite, IReader &reader) override {
         const AutoMutex lock(mFrameCountersMutex);
+        updateTelemetryLocked(systemTime(SYSTEM_TIME_MONOTONIC));
 
         size_t framesLost = 0;
+        const uint64_t receivedFrames = mReceivedFrames;
         const size_t waitFrames = calcWaitFramesNowLocked(bytesToWrite / mFrameSize);
         const auto blockUntil =
             std::chrono::high_resolution_clock::now() +
@@ -142,7 +232,7 @@ struct TinyalsaSink : public DevicePortSink {
 
         while (bytesToWrite > 0) {
             if (mRingBuffer.waitForProduceAvailable(blockUntil
-                    + std::chrono::microseconds(kMaxJitterUs))) {
+                    + std::chrono::microseconds(getJitterAllowanceUs()))) {
                 auto produceChunk = mRingBuffer.getProduceChunk();
                 if (produceChunk.size >= bytesToWrite) {
                     // Since the ring buffer has more bytes free than we need,
@@ -154,11 +244,7 @@ struct TinyalsaSink : public DevicePortSink {
                 const size_t szFrames =
                     std::min(produceChunk.size, bytesToWrite) / mFrameSize;
                 const size_t szBytes = szFrames * mFrameSize;
-                LOG_ALWAYS_FATAL_IF(reader(produceChunk.data, szBytes) < szBytes);
-
-                aops::multiplyByVolume(volume,
-                                       static_cast<int16_t *>(produceChunk.data),
-                                       szBytes / sizeof(int16_t));
+                readWithVolumeLocked(reader, volume, produceChunk.data, szFrames);
 
                 LOG_ALWAYS_FATAL_IF(mRingBuffer.produce(szBytes) < szBytes);
                 mReceivedFrames += szFrames;
@@ -172,63 +258,109 @@ struct TinyalsaSink : public DevicePortSink {
                 // drop old audio to make room for new
                 const size_t bytesLost = mRingBuffer.makeRoomForProduce(bytesToWrite);
                 framesLost += bytesLost / mFrameSize;
+                mDroppedFrames += bytesLost / mFrameSize;
+                growTargetFillLocked();
 
                 while (bytesToWrite > 0) {
                     auto produceChunk = mRingBuffer.getProduceChunk();
+                    if (!produceChunk.size) {
+                        // the mixer thread still holds the oldest chunk
+                        if (mRingBuffer.waitForProduceAvailable(
+                                std::chrono::high_resolution_clock::now()
+                                + std::chrono::microseconds(getJitterAllowanceUs()))) {
+                            continue;
+                        } else {
+                            break;
+                        }
+                    }
+
                     const size_t szFrames =
                         std::min(produceChunk.size, bytesToWrite) / mFrameSize;
                     const size_t szBytes = szFrames * mFrameSize;
-                    LOG_ALWAYS_FATAL_IF(reader(produceChunk.data, szBytes) < szBytes);
-
-                    aops::multiplyByVolume(volume,
-                                           static_cast<int16_t *>(produceChunk.data),
-                                           szBytes / sizeof(int16_t));
+                    readWithVolumeLocked(reader, volume, produceChunk.data, szFrames);
 
                     LOG_ALWAYS_FATAL_IF(mRingBuffer.produce(szBytes) < szBytes);
                     mReceivedFrames += szFrames;
                     bytesToWrite -= szBytes;
                 }
+
+                // still no room, the rest is lost but the FMQ is consumed
+                if (bytesToWrite > 0) {
+                    const size_t discardedFrames = bytesToWrite / mFrameSize;
+                    discardLocked(reader, discardedFrames * mFrameSize);
+                    framesLost += discardedFrames;
+                    mDroppedFrames += discardedFrames;
+                    mReceivedFrames += discardedFrames;
+                }
                 break;
             }
         }
 
+        if (!framesLost) {
+            updateTargetFillLocked(mReceivedFrames - receivedFrames);
+        }
         return framesLost;
     }
 
-    void consumeThread() {
-        util::setThreadPriority(SP_AUDIO_SYS, PRIORITY_AUDIO);
-        std::vector<uint8_t> writeBuffer(mWriteSizeFrames * mFrameSize);
-
-        while (mConsumeThreadRunning) {
-            if (mRingBuffer.waitForConsumeAvailable(
-                    std::chrono::high_resolution_clock::now()
-                    + std::chrono::microseconds(100000))) {
-                size_t szBytes;
-                {
-                    auto chunk = mRingBuffer.getConsumeChunk();
-                    szBytes = std::min(writeBuffer.size(), chunk.size);
-                    // We have to memcpy because the consumer holds the lock
-                    // into RingBuffer and pcm_write takes too long to hold
-                    // this lock.
-                    memcpy(writeBuffer.data(), chunk.data, szBytes);
-                    LOG_ALWAYS_FATAL_IF(mRingBuffer.consume(chunk, szBytes) < szBytes);
-                }
+    void applyVolumeLocked(const float volume, void *data, const size_t nFrames) {
+        aops::rampVolume(mVolume, volume, mFormat, data, nFrames, mNChannels);
+        mVolume = volume;
+    }
 
-                const uint8_t *data8 = writeBuffer.data();
-                while (szBytes > 0) {
-                    const int n = talsa::pcmWrite(mPcm.get(), data8, szBytes, mFrameSize);
-                    if (n < 0) {
-                        break;
-                    }
-                    LOG_ALWAYS_FATAL_IF(static_cast<size_t>(n) > szBytes,
-                                        "n=%d szBytes=%zu mFrameSize=%u",
-                                        n, szBytes, mFrameSize);
-                    data8 += n;
-                    szBytes -= n;
-                }
+    // Reads `nFrames` into the ring buffer chunk at `dst`. If the reader
+    // exposes its memory (the FMQ), the volume is applied while copying,
+    // every sample is touched once on its way to pcm_write.
+    void readWithVolumeLocked(IReader &reader, const float volume,
+                              void *dst, const size_t nFrames) {
+        const size_t szBytes = nFrames * mFrameSize;
+        IReader::Regions regions;
+        if (!reader.beginRead(szBytes, regions)) {
+            LOG_ALWAYS_FATAL_IF(reader(dst, szBytes) < szBytes);
+            applyVolumeLocked(volume, dst, nFrames);
+            return;
+        }
+
+        uint8_t *const dst8 = static_cast<uint8_t *>(dst);
+        if (regions.size[0] % mFrameSize) {
+            // the reader wraps mid frame, copy first
+            memcpy(dst8, regions.data[0], regions.size[0]);
+            memcpy(dst8 + regions.size[0], regions.data[1], szBytes - regions.size[0]);
+            applyVolumeLocked(volume, dst, nFrames);
+        } else {
+            // the ramp continues across the regions
+            const size_t nFrames0 = std::min(regions.size[0] / mFrameSize, nFrames);
+            const size_t nFrames1 = nFrames - nFrames0;
+            const float step = (nFrames > 1) ? ((volume - mVolume) / (nFrames - 1)) : 0;
+            if (nFrames0) {
+                aops::rampVolume(mVolume, mVolume + step * (nFrames0 - 1), mFormat,
+                                 dst8, regions.data[0], nFrames0, mNChannels);
+            }
+            if (nFrames1) {
+                aops::rampVolume(nFrames0 ? (mVolume + step * nFrames0) : mVolume, volume,
+                                 mFormat, dst8 + nFrames0 * mFrameSize, regions.data[1],
+                                 nFrames1, mNChannels);
+            }
+            mVolume = volume;
+        }
+        reader.commitRead(szBytes);
+    }
+
+    // Consumes `szBytes` from `reader` without using them.
+    void discardLocked(IReader &reader, size_t szBytes) {
+        IReader::Regions regions;
+        if (reader.beginRead(szBytes, regions)) {
+            reader.commitRead(szBytes);
+            return;
+        }
+
+        uint8_t scratch[256];
+        while (szBytes > 0) {
+            const size_t n = reader(scratch, std::min(szBytes, sizeof(scratch)));
+            if (!n) {
+                break;  // reader failed
             }
+            szBytes -= n;
         }
-        ALOGD("%s: exiting", __func__);
     }
 
     static std::unique_ptr<TinyalsaSink> create(unsigned pcmCard,
@@ -239,7 +371,7 @@ struct TinyalsaSink : public DevicePortSink {
         (void)readerBufferSizeHint;
         auto sink = std::make_unique<TinyalsaSink>(pcmCard, pcmDevice,
                                                    cfg, initialFrames);
-        if (sink->mMixer && sink->mPcm) {
+        if (sink->mOutputMixer) {
             return sink;
         } else {
             return FAILURE(nullptr);
@@ -249,17 +381,30 @@ struct TinyalsaSink : public DevicePortSink {
 private:
     const nsecs_t mStartNs;
     const unsigned mSampleRateHz;
+    const audio_format_t mFormat;
+    const unsigned mNChannels;
     const unsigned mFrameSize;
     const unsigned mWriteSizeFrames;
     const uint64_t mInitialFrames;
     uint64_t mFrames GUARDED_BY(mFrameCountersMutex);
     uint64_t mMissedFrames GUARDED_BY(mFrameCountersMutex) = 0;
     uint64_t mReceivedFrames GUARDED_BY(mFrameCountersMutex) = 0;
+    float mVolume GUARDED_BY(mFrameCountersMutex) = 1.0f;
     RingBuffer mRingBuffer;
-    talsa::Mixer mMixer;
-    talsa::PcmPtr mPcm;
-    std::thread mConsumeThread;
-    std::atomic<bool> mConsumeThreadRunning = true;
+    size_t mTargetFillFrames GUARDED_BY(mFrameCountersMutex);
+    uint64_t mFramesSinceGlitch GUARDED_BY(mFrameCountersMutex) = 0;
+    uint64_t mUnderruns GUARDED_BY(mFrameCountersMutex) = 0;
+    uint64_t mUnderrunFrames GUARDED_BY(mFrameCountersMutex) = 0;
+    uint64_t mDroppedFrames GUARDED_BY(mFrameCountersMutex) = 0;
+    const unsigned mPcmLatencyMs;
+    const nsecs_t mTelemetryLogPeriodNs;
+    nsecs_t mTelemetryLogNs GUARDED_BY(mFrameCountersMutex) = 0;
+    nsecs_t mPrevWriteNs GUARDED_BY(mFrameCountersMutex) = 0;
+    uint64_t mWrites GUARDED_BY(mFrameCountersMutex) = 0;
+    Histogram mWriteIntervalHistogram;
+    Histogram mRingFillHistogram;  // at the start of `write`
+    // shared with the other output streams, consumes mRingBuffer
+    const std::shared_ptr<OutputMixer> mOutputMixer;
     mutable Mutex mFrameCountersMutex;
 };
 
@@ -267,7 +412,8 @@ struct NullSink : public DevicePortSink {
     NullSink(const AudioConfig &cfg, uint64_t initialFrames)
             : mStartNs(systemTime(SYSTEM_TIME_MONOTONIC))
             , mSampleRateHz(cfg.base.sampleRateHz)
-            , mFrameSize(util::countChannels(cfg.base.channelMask) * sizeof(int16_t))
+            , mFrameSize(util::countChannels(cfg.base.channelMask)
+                         * util::getBytesPerSample(cfg.base.format))
             , mInitialFrames(initialFrames)
             , mFrames(initialFrames) {}
 
@@ -370,7 +516,7 @@ DevicePortSink::create(size_t readerBufferSizeHint,
                        uint64_t initialFrames) {
     (void)flags;
 
-    if (xsd::stringToAudioFormat(cfg.base.format) != xsd::AudioFormat::AUDIO_FORMAT_PCM_16_BIT) {
+    if (util::getPcmFormat(cfg.base.format) == AUDIO_FORMAT_INVALID) {
         ALOGE("%s:%d, unexpected format: '%s'", __func__, __LINE__, cfg.base.format.c_str());
         return FAILURE(nullptr);
     }
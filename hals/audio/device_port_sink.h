@@ -16,6 +16,7 @@
 
 #pragma once
 #include <memory>
+#include <string>
 #include PATH(android/hardware/audio/common/COMMON_TYPES_FILE_VERSION/types.h)
 #include PATH(android/hardware/audio/CORE_TYPES_FILE_VERSION/types.h)
 #include "ireader.h"
@@ -33,6 +34,7 @@ struct DevicePortSink {
     virtual ~DevicePortSink() {}
     virtual Result getPresentationPosition(uint64_t &frames, TimeSpec &ts) = 0;
     virtual size_t write(float volume, size_t bytesToWrite, IReader &) = 0;
+    virtual void dump(std::string &) const {}
 
     static std::unique_ptr<DevicePortSink> create(size_t readerBufferSizeHint,
                                                   const DeviceAddress &,
@@ -28,6 +28,8 @@
 #include PATH(APM_XSD_ENUMS_H_FILENAME)
 #include "device_port_source.h"
 #include "talsa.h"
+#include "output_mixer.h"
+#include "resampler.h"
 #include "ring_buffer.h"
 #include "audio_ops.h"
 #include "util.h"
@@ -54,16 +56,23 @@ struct TinyalsaSource : public DevicePortSource {
                    const AudioConfig &cfg, uint64_t &frames)
             : mStartNs(systemTime(SYSTEM_TIME_MONOTONIC))
             , mSampleRateHz(cfg.base.sampleRateHz)
-            , mFrameSize(util::countChannels(cfg.base.channelMask) * sizeof(int16_t))
+            , mFormat(util::getPcmFormat(cfg.base.format))
+            , mNChannels(util::countChannels(cfg.base.channelMask))
+            , mFrameSize(mNChannels * audio_bytes_per_sample(mFormat))
             , mReadSizeFrames(cfg.frameCount)
             , mFrames(frames)
             , mRingBuffer(mFrameSize * cfg.frameCount * 3)
             , mMixer(pcmCard)
-            , mPcm(talsa::pcmOpen(pcmCard, pcmDevice,
-                                  util::countChannels(cfg.base.channelMask),
-                                  cfg.base.sampleRateHz,
-                                  cfg.frameCount,
-                                  false /* isOut */)) {
+            , mPcmRateHz(mSampleRateHz)
+            , mPcmReadSizeFrames(mReadSizeFrames)
+            , mPcmFormat(mFormat) {
+        mPcm = talsa::pcmOpenNearest(pcmCard, pcmDevice, mNChannels, mPcmRateHz,
+                                     mPcmReadSizeFrames, false /* isOut */, mPcmFormat);
+        if (mPcmRateHz != mSampleRateHz) {
+            mResampler = std::make_unique<Resampler>(mPcmRateHz, mSampleRateHz, mNChannels,
+                                                     Resampler::getDefaultQuality());
+        }
+
         if (mPcm) {
             mProduceThread = std::thread(&TinyalsaSource::producerThread, this);
         } else {
@@ -133,9 +142,9 @@ struct TinyalsaSource : public DevicePortSource {
                 auto chunk = mRingBuffer.getConsumeChunk();
                 const size_t writeBufSzBytes = std::min(chunk.size, bytesToRead);
 
-                aops::multiplyByVolume(volume,
-                                       static_cast<int16_t *>(chunk.data),
-                                       writeBufSzBytes / sizeof(int16_t));
+                aops::rampVolume(mVolume, volume, mFormat, chunk.data,
+                                 writeBufSzBytes / mFrameSize, mNChannels);
+                mVolume = volume;
 
                 writer(chunk.data, writeBufSzBytes);
                 LOG_ALWAYS_FATAL_IF(mRingBuffer.consume(chunk, writeBufSzBytes) < writeBufSzBytes);
@@ -168,33 +177,74 @@ struct TinyalsaSource : public DevicePortSource {
 
     void producerThread() {
         util::setThreadPriority(SP_AUDIO_SYS, PRIORITY_AUDIO);
-        std::vector<uint8_t> readBuf(mReadSizeFrames * mFrameSize);
+        const bool convert = mResampler || (mPcmFormat != mFormat);
+        const size_t maxFrames = mResampler
+            ? mResampler->getMaxOutFrames(mPcmReadSizeFrames) : mReadSizeFrames;
+        std::vector<uint8_t> readBuf(maxFrames * mFrameSize);
+        const unsigned pcmFrameSize = mNChannels * audio_bytes_per_sample(mPcmFormat);
+        std::vector<uint8_t> pcmBuf(convert ? (mPcmReadSizeFrames * pcmFrameSize) : 0);
+        std::vector<float> floatBuf(mResampler ? (mPcmReadSizeFrames * mNChannels) : 0);
+        std::vector<float> resampledBuf(mResampler ? (maxFrames * mNChannels) : 0);
 
         while (mProduceThreadRunning) {
             const size_t bytesLost = mRingBuffer.makeRoomForProduce(readBuf.size());
             mFramesLost += bytesLost / mFrameSize;
 
             auto produceChunk = mRingBuffer.getProduceChunk();
-            if (produceChunk.size < readBuf.size()) {
-                const size_t sz = doRead(readBuf.data(), readBuf.size());
+            if (convert) {
+                const size_t n = doRead(pcmBuf.data(), pcmBuf.size(), pcmFrameSize);
+                if (n > 0) {
+                    const size_t nFrames = convertFromPcm(pcmBuf.data(), n / pcmFrameSize,
+                                                          readBuf.data(), floatBuf.data(),
+                                                          resampledBuf.data());
+                    const size_t sz = nFrames * mFrameSize;
+                    const size_t produced = mRingBuffer.produce(readBuf.data(), sz);
+                    mFramesLost += (sz - produced) / mFrameSize;
+                }
+            } else if (produceChunk.size < readBuf.size()) {
+                const size_t sz = doRead(readBuf.data(), readBuf.size(), mFrameSize);
                 if (sz > 0) {
-                    LOG_ALWAYS_FATAL_IF(mRingBuffer.produce(readBuf.data(), sz) < sz);
+                    // the reader might still hold the oldest chunk
+                    const size_t produced = mRingBuffer.produce(readBuf.data(), sz);
+                    mFramesLost += (sz - produced) / mFrameSize;
                 }
             } else {
-                const size_t sz = doRead(produceChunk.data, readBuf.size());
+                const size_t sz = doRead(produceChunk.data, readBuf.size(), mFrameSize);
                 if (sz > 0) {
-                    LOG_ALWAYS_FATAL_IF(mRingBuffer.produce(readBuf.size()) < sz);
+                    LOG_ALWAYS_FATAL_IF(mRingBuffer.produce(sz) < sz);
                 }
             }
         }
         ALOGD("%s: exiting", __func__);
     }
 
-    size_t doRead(void *dst, size_t sz) {
-        const int n = talsa::pcmRead(mPcm.get(), dst, sz, mFrameSize);
+    // Converts `nPcmFrames` from the PCM rate and format to the stream rate
+    // and format into `dst`, returns the number of frames in `dst`.
+    size_t convertFromPcm(const void *src, const size_t nPcmFrames, void *dst,
+                          float *floatBuf, float *resampledBuf) {
+        if (!mResampler) {
+            memcpy_by_audio_format(dst, mFormat, src, mPcmFormat, nPcmFrames * mNChannels);
+            return nPcmFrames;
+        }
+
+        const float *in = static_cast<const float *>(src);
+        if (mPcmFormat != AUDIO_FORMAT_PCM_FLOAT) {
+            memcpy_by_audio_format(floatBuf, AUDIO_FORMAT_PCM_FLOAT,
+                                   src, mPcmFormat, nPcmFrames * mNChannels);
+            in = floatBuf;
+        }
+
+        const size_t nFrames = mResampler->process(in, nPcmFrames, resampledBuf);
+        memcpy_by_audio_format(dst, mFormat, resampledBuf, AUDIO_FORMAT_PCM_FLOAT,
+                               nFrames * mNChannels);
+        return nFrames;
+    }
+
+    size_t doRead(void *dst, size_t sz, const unsigned frameSize) {
+        const int n = talsa::pcmRead(mPcm.get(), dst, sz, frameSize);
         if (n > 0) {
             LOG_ALWAYS_FATAL_IF(static_cast<size_t>(n) > sz,
-                                "n=%d sz=%zu mFrameSize=%u", n, sz, mFrameSize);
+                                "n=%d sz=%zu frameSize=%u", n, sz, frameSize);
             return n;
         } else {
             return 0;
@@ -220,20 +270,283 @@ struct TinyalsaSource : public DevicePortSource {
 private:
     const nsecs_t mStartNs;
     const unsigned mSampleRateHz;
+    const audio_format_t mFormat;
+    const unsigned mNChannels;
     const unsigned mFrameSize;
     const unsigned mReadSizeFrames;
     uint64_t &mFrames GUARDED_BY(mFrameCountersMutex);
     uint64_t mPreviousFrames GUARDED_BY(mFrameCountersMutex) = 0;
     uint64_t mSentFrames GUARDED_BY(mFrameCountersMutex) = 0;
+    float mVolume GUARDED_BY(mFrameCountersMutex) = 1.0f;
     std::atomic<uint32_t> mFramesLost = 0;
     RingBuffer mRingBuffer;
     talsa::Mixer mMixer;
+    unsigned mPcmRateHz;        // differs from mSampleRateHz if the PCM can't produce it
+    size_t mPcmReadSizeFrames;  // at mPcmRateHz
+    audio_format_t mPcmFormat;  // differs from mFormat if the PCM can't produce it
     talsa::PcmPtr mPcm;
+    std::unique_ptr<Resampler> mResampler;
     std::thread mProduceThread;
     std::atomic<bool> mProduceThreadRunning = true;
     mutable Mutex mFrameCountersMutex;
 };
 
+// Captures what the output streams are playing, see LoopbackTap. The source
+// attaches to the OutputMixer of the PCM once it is running (it does not
+// open the PCM itself) and converts the tap frames from the mixer config.
+// Silence is captured while nothing is played.
+struct LoopbackSource : public DevicePortSource {
+    static constexpr nsecs_t kAttachPeriodNs = 100000000;  // how often to look for the mixer
+
+    LoopbackSource(unsigned pcmCard, unsigned pcmDevice,
+                   const AudioConfig &cfg, uint64_t &frames)
+            : mStartNs(systemTime(SYSTEM_TIME_MONOTONIC))
+            , mPcmCard(pcmCard)
+            , mPcmDevice(pcmDevice)
+            , mSampleRateHz(cfg.base.sampleRateHz)
+            , mFormat(util::getPcmFormat(cfg.base.format))
+            , mNChannels(util::countChannels(cfg.base.channelMask))
+            , mFrameSize(mNChannels * audio_bytes_per_sample(mFormat))
+            , mReadSizeFrames(cfg.frameCount)
+            , mInitialFrames(frames)
+            , mFrames(frames) {
+        const AutoMutex lock(mFrameCountersMutex);
+        attachLocked(mStartNs);
+    }
+
+    ~LoopbackSource() {
+        if (mOutputMixer) {
+            mOutputMixer->removeLoopback(mTap.get());
+        }
+    }
+
+    void detachLocked() {
+        mOutputMixer->removeLoopback(mTap.get());
+        mOutputMixer.reset();
+        mTap.reset();
+        mResampler.reset();
+        mPendingFrames = 0;
+        mTapReadFrames = 0;
+    }
+
+    // Frames still in the tap are captured once they are presented, the
+    // position is the frame being presented now.
+    Result getCapturePosition(uint64_t &frames, uint64_t &time) override {
+        const AutoMutex lock(mFrameCountersMutex);
+
+        const nsecs_t nowNs = systemTime(SYSTEM_TIME_MONOTONIC);
+        uint64_t capturedFrames = mSentFrames + mPendingFrames;
+        if (mTap) {
+            uint64_t tapFrames;
+            nsecs_t tapNs;
+            mTap->getPosition(tapFrames, tapNs);
+
+            if (tapFrames > mTapReadFrames) {
+                const uint64_t futureFrames = (tapNs > nowNs)
+                    ? (uint64_t(mSampleRateHz) * ns2us(tapNs - nowNs) / 1000000) : 0;
+                const uint64_t bufferedFrames =
+                    (tapFrames - mTapReadFrames) * mSampleRateHz / mTapRateHz;
+                capturedFrames += (bufferedFrames > futureFrames)
+                    ? (bufferedFrames - futureFrames) : 0;
+            }
+        }
+        mFrames = std::max(mFrames, mInitialFrames + capturedFrames);
+
+        frames = mFrames;
+        time = nowNs;
+        return Result::OK;
+    }
+
+    uint64_t getAvailableFramesNowLocked() const {
+        const nsecs_t nowNs = systemTime(SYSTEM_TIME_MONOTONIC);
+        return uint64_t(mSampleRateHz) * ns2us(nowNs - mStartNs) / 1000000 - mSentFrames;
+    }
+
+    size_t getWaitFramesNowLocked(const size_t requestedFrames) const {
+        const size_t availableFrames = getAvailableFramesNowLocked();
+        return (requestedFrames > availableFrames)
+            ? (requestedFrames - availableFrames) : 0;
+    }
+
+    // Paced by SYSTEM_TIME_MONOTONIC like TinyalsaSource, the mixer is late
+    // (or idle) if the tap does not have the frames by then.
+    size_t read(float volume, size_t bytesToRead, IWriter &writer) override {
+        const AutoMutex lock(mFrameCountersMutex);
+
+        const nsecs_t nowNs = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (!mOutputMixer) {
+            if (nowNs >= mNextAttachNs) {
+                attachLocked(nowNs);
+            }
+        } else if (mOutputMixer.use_count() == 1) {
+            detachLocked();  // the last output stream is gone, let the PCM close
+        }
+
+        size_t framesToRead = bytesToRead / mFrameSize;
+        const size_t waitFrames = getWaitFramesNowLocked(framesToRead);
+        const auto blockUntil =
+            std::chrono::high_resolution_clock::now()
+                + std::chrono::microseconds(waitFrames * 1000000 / mSampleRateHz);
+
+        while (framesToRead > 0) {
+            if (!mPendingFrames) {
+                if (!mTap) {
+                    std::this_thread::sleep_until(blockUntil);
+                    writeSilenceLocked(framesToRead, writer);
+                    break;
+                } else if (!mTap->ring.waitForConsumeAvailable(blockUntil
+                        + std::chrono::microseconds(kMaxJitterUs))) {
+                    writeSilenceLocked(framesToRead, writer);
+                    break;
+                }
+                convertTapLocked(framesToRead);
+                continue;  // the resampler could have kept all the frames
+            }
+
+            const size_t n = std::min(mPendingFrames, framesToRead);
+            if (n == framesToRead) {
+                std::this_thread::sleep_until(blockUntil);
+            }
+
+            aops::rampVolume(mVolume, volume, mPending.data(), n, mNChannels);
+            mVolume = volume;
+            memcpy_by_audio_format(mWriteBuffer.data(), mFormat,
+                                   mPending.data(), AUDIO_FORMAT_PCM_FLOAT, n * mNChannels);
+            writer(mWriteBuffer.data(), n * mFrameSize);
+
+            mPendingFrames -= n;
+            memmove(mPending.data(), &mPending[n * mNChannels],
+                    mPendingFrames * mNChannels * sizeof(float));
+            mSentFrames += n;
+            framesToRead -= n;
+        }
+
+        if (!mTap) {
+            return 0;
+        }
+        return uint64_t(mTap->takeFramesLost()) * mSampleRateHz / mTapRateHz;
+    }
+
+    void writeSilenceLocked(size_t nFrames, IWriter &writer) {
+        static const uint8_t zeroes[256] = {0};
+
+        while (nFrames > 0) {
+            const size_t nZeroFrames = std::min(nFrames * mFrameSize, sizeof(zeroes)) / mFrameSize;
+            writer(zeroes, nZeroFrames * mFrameSize);
+            nFrames -= nZeroFrames;
+            mSentFrames += nZeroFrames;
+        }
+    }
+
+    // Converts up to about `maxFrames` (at mSampleRateHz) from the tap into
+    // mPending, mPending is empty.
+    void convertTapLocked(const size_t maxFrames) {
+        const unsigned tapNChannels = mOutputMixer->getNChannels();
+        const audio_format_t tapFormat = mOutputMixer->getFormat();
+        const unsigned tapFrameSize = tapNChannels * audio_bytes_per_sample(tapFormat);
+        const size_t maxTapFrames = std::min<size_t>(
+            mTapBufferFrames, uint64_t(maxFrames) * mTapRateHz / mSampleRateHz + 1);
+
+        const auto chunk = mTap->ring.getConsumeChunk();
+        const size_t n = std::min(chunk.size / tapFrameSize, maxTapFrames);
+        memcpy_by_audio_format(mTapBuffer.data(), AUDIO_FORMAT_PCM_FLOAT,
+                               chunk.data, tapFormat, n * tapNChannels);
+        mTap->ring.consume(chunk, n * tapFrameSize);
+        mTapReadFrames += n;
+
+        float *const buf = mTapBuffer.data();
+        if ((mNChannels == 1) && (tapNChannels > 1)) {  // downmix
+            for (size_t i = 0; i < n; ++i) {
+                float sum = 0;
+                for (unsigned c = 0; c < tapNChannels; ++c) {
+                    sum += buf[i * tapNChannels + c];
+                }
+                buf[i] = sum / tapNChannels;
+            }
+        } else if (mNChannels != tapNChannels) {
+            // in place, backwards if the frames grow
+            for (size_t j = 0; j < n; ++j) {
+                const size_t i = (mNChannels > tapNChannels) ? (n - 1 - j) : j;
+                for (unsigned c = 0; c < mNChannels; ++c) {
+                    const unsigned k = mNChannels - 1 - c;
+                    buf[i * mNChannels + k] = buf[i * tapNChannels + (k % tapNChannels)];
+                }
+            }
+        }
+
+        if (mResampler) {
+            mPendingFrames = mResampler->process(buf, n, mPending.data());
+        } else {
+            memcpy(mPending.data(), buf, n * mNChannels * sizeof(float));
+            mPendingFrames = n;
+        }
+    }
+
+    // The tap frames are at the mixer config, the buffers are sized for
+    // mReadSizeFrames.
+    void attachLocked(const nsecs_t nowNs) {
+        mNextAttachNs = nowNs + kAttachPeriodNs;
+        auto mixer = OutputMixer::find(mPcmCard, mPcmDevice);
+        if (!mixer) {
+            return;
+        }
+
+        mTapRateHz = mixer->getSampleRateHz();
+        const unsigned tapNChannels = mixer->getNChannels();
+        const unsigned tapFrameSize =
+            tapNChannels * audio_bytes_per_sample(mixer->getFormat());
+        mTapBufferFrames = uint64_t(mReadSizeFrames) * mTapRateHz / mSampleRateHz + 1;
+        mTapBuffer.resize(mTapBufferFrames * std::max(tapNChannels, mNChannels));
+
+        size_t maxPendingFrames = mTapBufferFrames;
+        if (mTapRateHz != mSampleRateHz) {
+            mResampler = std::make_unique<Resampler>(mTapRateHz, mSampleRateHz, mNChannels,
+                                                     Resampler::getDefaultQuality());
+            maxPendingFrames = mResampler->getMaxOutFrames(mTapBufferFrames);
+        }
+        mPending.resize(maxPendingFrames * mNChannels);
+        mWriteBuffer.resize(maxPendingFrames * mFrameSize);
+
+        mTap = std::make_unique<LoopbackTap>(tapFrameSize * mTapBufferFrames * 4);
+        mixer->addLoopback(mTap.get());
+        mOutputMixer = std::move(mixer);
+    }
+
+    static std::unique_ptr<LoopbackSource> create(unsigned pcmCard,
+                                                  unsigned pcmDevice,
+                                                  const AudioConfig &cfg,
+                                                  uint64_t &frames) {
+        return std::make_unique<LoopbackSource>(pcmCard, pcmDevice, cfg, frames);
+    }
+
+private:
+    const nsecs_t mStartNs;
+    const unsigned mPcmCard;
+    const unsigned mPcmDevice;
+    const unsigned mSampleRateHz;
+    const audio_format_t mFormat;
+    const unsigned mNChannels;
+    const unsigned mFrameSize;
+    const size_t mReadSizeFrames;
+    const uint64_t mInitialFrames;
+    uint64_t &mFrames GUARDED_BY(mFrameCountersMutex);
+    uint64_t mSentFrames GUARDED_BY(mFrameCountersMutex) = 0;
+    uint64_t mTapReadFrames GUARDED_BY(mFrameCountersMutex) = 0;
+    float mVolume GUARDED_BY(mFrameCountersMutex) = 1.0f;
+    nsecs_t mNextAttachNs GUARDED_BY(mFrameCountersMutex) = 0;
+    // set once the mixer is found
+    unsigned mTapRateHz GUARDED_BY(mFrameCountersMutex) = 0;
+    size_t mTapBufferFrames GUARDED_BY(mFrameCountersMutex) = 0;
+    std::vector<float> mTapBuffer GUARDED_BY(mFrameCountersMutex);
+    std::unique_ptr<Resampler> mResampler GUARDED_BY(mFrameCountersMutex);
+    std::vector<float> mPending GUARDED_BY(mFrameCountersMutex);  // at the source config
+    size_t mPendingFrames GUARDED_BY(mFrameCountersMutex) = 0;
+    std::vector<uint8_t> mWriteBuffer GUARDED_BY(mFrameCountersMutex);
+    std::unique_ptr<LoopbackTap> mTap GUARDED_BY(mFrameCountersMutex);
+    std::shared_ptr<OutputMixer> mOutputMixer GUARDED_BY(mFrameCountersMutex);
+    mutable Mutex mFrameCountersMutex;
+};
+
 template <class G> struct GeneratedSource : public DevicePortSource {
     GeneratedSource(const AudioConfig &cfg,
                     size_t writerBufferSizeHint,
@@ -243,7 +556,9 @@ template <class G> struct GeneratedSource : public DevicePortSource {
             , mFrames(frames)
             , mStartNs(systemTime(SYSTEM_TIME_MONOTONIC))
             , mSampleRateHz(cfg.base.sampleRateHz)
+            , mFormat(util::getPcmFormat(cfg.base.format))
             , mNChannels(util::countChannels(cfg.base.channelMask))
+            , mFrameSize(mNChannels * audio_bytes_per_sample(mFormat))
             , mGenerator(std::move(generator)) {}
 
     Result getCapturePosition(uint64_t &frames, uint64_t &time) override {
@@ -268,11 +583,11 @@ template <class G> struct GeneratedSource : public DevicePortSource {
 
     size_t read(float volume, size_t bytesToRead, IWriter &writer) override {
         const AutoMutex lock(mFrameCountersMutex);
-        mWriteBuffer.resize(bytesToRead / sizeof(int16_t));
+        const unsigned nChannels = mNChannels;
+        const unsigned requestedFrames = bytesToRead / mFrameSize;
+        mWriteBuffer.resize(requestedFrames * nChannels);
 
         int16_t *samples = mWriteBuffer.data();
-        const unsigned nChannels = mNChannels;
-        const unsigned requestedFrames = bytesToRead / nChannels / sizeof(*samples);
 
         unsigned availableFrames;
         while (true) {
@@ -296,11 +611,18 @@ template <class G> struct GeneratedSource : public DevicePortSource {
                             sizeof(*samples), nFrames * sizeof(*samples));
         }
 
-        aops::multiplyByVolume(volume,
-                               mWriteBuffer.data(),
-                               nSamples);
+        aops::rampVolume(mVolume, volume, mWriteBuffer.data(), nFrames, nChannels);
+        mVolume = volume;
 
-        writer(mWriteBuffer.data(), nSamples * sizeof(*samples));
+        if (mFormat == AUDIO_FORMAT_PCM_16_BIT) {
+            writer(samples, nSamples * sizeof(*samples));
+        } else {
+            // generators produce 16 bit samples
+            mConvertBuffer.resize(nFrames * mFrameSize);
+            memcpy_by_audio_format(mConvertBuffer.data(), mFormat,
+                                   samples, AUDIO_FORMAT_PCM_16_BIT, nSamples);
+            writer(mConvertBuffer.data(), mConvertBuffer.size());
+        }
         mSentFrames += nFrames;
 
         return 0;
@@ -308,12 +630,16 @@ template <class G> struct GeneratedSource : public DevicePortSource {
 
 private:
     std::vector<int16_t> mWriteBuffer;
+    std::vector<uint8_t> mConvertBuffer;
     uint64_t &mFrames GUARDED_BY(mFrameCountersMutex);
     const nsecs_t mStartNs;
     const unsigned mSampleRateHz;
+    const audio_format_t mFormat;
     const unsigned mNChannels;
+    const unsigned mFrameSize;
     uint64_t mPreviousFrames GUARDED_BY(mFrameCountersMutex) = 0;
     uint64_t mSentFrames GUARDED_BY(mFrameCountersMutex) = 0;
+    float mVolume GUARDED_BY(mFrameCountersMutex) = 1.0f;
     G mGenerator;
     mutable Mutex mFrameCountersMutex;
 };
@@ -431,7 +757,7 @@ DevicePortSource::create(size_t writerBufferSizeHint,
                          uint64_t &frames) {
     (void)flags;
 
-    if (xsd::stringToAudioFormat(cfg.base.format) != xsd::AudioFormat::AUDIO_FORMAT_PCM_16_BIT) {
+    if (util::getPcmFormat(cfg.base.format) == AUDIO_FORMAT_INVALID) {
         ALOGE("%s:%d, unexpected format: '%s'", __func__, __LINE__, cfg.base.format.c_str());
         return FAILURE(nullptr);
     }
@@ -464,6 +790,9 @@ DevicePortSource::create(size_t writerBufferSizeHint,
             cfg, writerBufferSizeHint, frames,
             RepeatGenerator(generateSinePattern(cfg.base.sampleRateHz, 440.0, 1.0)));
 
+    case xsd::AudioDevice::AUDIO_DEVICE_IN_ECHO_REFERENCE:
+        return LoopbackSource::create(talsa::kPcmCard, talsa::kPcmDevice, cfg, frames);
+
     default:
         ALOGW("%s:%d unsupported device: '%s', creating a tone source",
               __func__, __LINE__, address.deviceType.c_str());
@@ -485,6 +814,7 @@ bool DevicePortSource::validateDeviceAddress(const DeviceAddress& address) {
     case xsd::AudioDevice::AUDIO_DEVICE_IN_BUILTIN_MIC:
     case xsd::AudioDevice::AUDIO_DEVICE_IN_TELEPHONY_RX:
     case xsd::AudioDevice::AUDIO_DEVICE_IN_FM_TUNER:
+    case xsd::AudioDevice::AUDIO_DEVICE_IN_ECHO_REFERENCE:
     case xsd::AudioDevice::AUDIO_DEVICE_IN_BUS:
         break;
     }
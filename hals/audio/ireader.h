@@ -26,6 +26,22 @@ namespace implementation {
 struct IReader {
     virtual ~IReader() {}
     virtual size_t operator()(void* dst, size_t szBytes) = 0;
+
+    // Direct access to the source memory, `szBytes` in up to two contiguous
+    // regions which stay valid until `commitRead(szBytes)`. Returns false if
+    // the reader can't provide it, operator() has to be used then.
+    struct Regions {
+        const void* data[2];
+        size_t size[2];
+    };
+    virtual bool beginRead(size_t szBytes, Regions& regions) {
+        (void)szBytes;
+        (void)regions;
+        return false;
+    }
+    virtual void commitRead(size_t szBytes) {
+        (void)szBytes;
+    }
 };
 
 }  // namespace implementation
@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include PATH(APM_XSD_ENUMS_H_FILENAME)
+#include <android-base/properties.h>
+#include <android-base/unique_fd.h>
+#include <cutils/ashmem.h>
+#include <cutils/native_handle.h>
+#include <log/log.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <utils/Timers.h>
+#include <utils/ThreadDefs.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "audio_ops.h"
+#include "mmap_stream.h"
+#include "output_mixer.h"
+#include "ring_buffer.h"
+#include "talsa.h"
+#include "util.h"
+#include "debug.h"
+
+using ::android::base::GetBoolProperty;
+
+namespace xsd {
+using namespace ::android::audio::policy::configuration::CPP_VERSION;
+}
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+namespace {
+
+struct MmapStreamImpl : public MmapStream {
+    MmapStreamImpl(const AudioConfig &cfg, const bool isOut, const bool usePcm,
+                   std::function<float()> getVolume)
+            : mSampleRateHz(cfg.base.sampleRateHz)
+            , mNumChannels(util::countChannels(cfg.base.channelMask))
+            , mFrameSize(mNumChannels * sizeof(int16_t))
+            , mPcmFrameCount(cfg.frameCount)
+            , mBurstSizeFrames(getBurstSizeFrames(cfg.frameCount))
+            , mIsOut(isOut)
+            , mUsePcm(usePcm)
+            , mGetVolume(std::move(getVolume)) {}
+
+    ~MmapStreamImpl() {
+        std::lock_guard l(mMutex);
+        stopLocked();
+        if (mBuffer) {
+            ::munmap(mBuffer, mBufferSizeFrames * mFrameSize);
+        }
+        if (mHandle) {
+            native_handle_delete(mHandle);  // the fd is owned by mFd
+        }
+    }
+
+    bool init(const int32_t minSizeFrames) {
+        // the buffer is a whole number of bursts, at least two of them
+        const size_t minFrames = std::max<size_t>(std::max(minSizeFrames, 0),
+                                                  2 * mBurstSizeFrames);
+        mBufferSizeFrames =
+            (minFrames + mBurstSizeFrames - 1) / mBurstSizeFrames * mBurstSizeFrames;
+        const size_t size = mBufferSizeFrames * mFrameSize;
+
+        mFd.reset(::ashmem_create_region(mIsOut ? "audio_mmap_out" : "audio_mmap_in", size));
+        if (!mFd.ok()) {
+            ALOGE("%s:%d ashmem_create_region failed for size=%zu",
+                  __func__, __LINE__, size);
+            return FAILURE(false);
+        }
+
+        void *ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFd.get(), 0);
+        if (ptr == MAP_FAILED) {
+            ALOGE("%s:%d mmap failed for size=%zu", __func__, __LINE__, size);
+            return FAILURE(false);
+        }
+        mBuffer = static_cast<uint8_t *>(ptr);
+
+        mHandle = native_handle_create(1, 0);
+        if (!mHandle) {
+            return FAILURE(false);
+        }
+        mHandle->data[0] = mFd.get();
+
+        return true;
+    }
+
+    Result start() override {
+        std::lock_guard l(mMutex);
+        if (mThread.joinable()) {
+            return FAILURE(Result::INVALID_STATE);
+        }
+
+        // Output goes through the OutputMixer shared with the other output
+        // streams, it is mixed with them and seen by loopback captures.
+        std::shared_ptr<OutputMixer> mixer;
+        talsa::PcmPtr pcm;
+        if (mUsePcm) {
+            if (mIsOut) {
+                mixer = OutputMixer::get(talsa::kPcmCard, talsa::kPcmDevice,
+                                         mSampleRateHz, mPcmFrameCount);
+            } else {
+                pcm = talsa::pcmOpen(talsa::kPcmCard, talsa::kPcmDevice,
+                                     mNumChannels, mSampleRateHz, mPcmFrameCount, mIsOut,
+                                     AUDIO_FORMAT_PCM_16_BIT);
+            }
+            if (!mixer && !pcm) {
+                ALOGW("%s:%d failed to open PCM, the stream will only advance "
+                      "its position", __func__, __LINE__);
+            }
+        }
+
+        mStartNs = systemTime(SYSTEM_TIME_MONOTONIC);
+        mTransferredFrames = mStartFrames;
+        mThreadRunning = true;
+        if (mIsOut) {
+            mThread = std::thread(&MmapStreamImpl::outThreadLoop, this,
+                                  std::move(mixer), mStartNs, mStartFrames);
+        } else {
+            mThread = std::thread(&MmapStreamImpl::inThreadLoop, this,
+                                  std::move(pcm), mStartNs, mStartFrames);
+        }
+        return Result::OK;
+    }
+
+    Result stop() override {
+        std::lock_guard l(mMutex);
+        return stopLocked() ? Result::OK : FAILURE(Result::INVALID_STATE);
+    }
+
+    Result getPosition(MmapPosition &position) const override {
+        std::lock_guard l(mMutex);
+
+        const bool running = mThread.joinable();
+        const nsecs_t nowNs = running ? systemTime(SYSTEM_TIME_MONOTONIC) : mStopNs;
+        position.timeNanoseconds = nowNs;
+        position.positionFrames = static_cast<int32_t>(getFramesLocked(nowNs, running));
+        return Result::OK;
+    }
+
+    MmapBufferInfo getBufferInfo() const override {
+        MmapBufferInfo info;
+        info.sharedMemory = hidl_memory("audio_buffer", mHandle, mBufferSizeFrames * mFrameSize);
+        info.bufferSizeFrames = mBufferSizeFrames;
+        info.burstSizeFrames = mBurstSizeFrames;
+        info.flags = MmapBufferFlag::APPLICATION_SHAREABLE;
+        return info;
+    }
+
+private:
+    bool stopLocked() {
+        if (!mThread.joinable()) {
+            return false;
+        }
+
+        // the position is frozen at the moment the thread is stopped
+        mStopNs = systemTime(SYSTEM_TIME_MONOTONIC);
+        mThreadRunning = false;
+        mThread.join();
+
+        mStartFrames = getFramesLocked(mStopNs, true);
+        return true;
+    }
+
+    uint64_t getFramesLocked(const nsecs_t nowNs, const bool running) const {
+        if (!running) {
+            return mStartFrames;
+        }
+
+        // the position is never ahead of what was actually handed to the
+        // mixer (output) or captured (input)
+        return std::min(mStartFrames + nsToFrames(nowNs - mStartNs),
+                        mTransferredFrames.load());
+    }
+
+    uint64_t nsToFrames(const nsecs_t ns) const {
+        return uint64_t(mSampleRateHz) * ns2us(ns) / 1000000;
+    }
+
+    nsecs_t framesToNs(const uint64_t frames) const {
+        return nsecs_t(frames * 1000000000 / mSampleRateHz);
+    }
+
+    // Returns the offset of `frames` in the buffer and the number of frames
+    // up to the next burst boundary or the buffer end.
+    std::pair<size_t, size_t> getBurst(const uint64_t frames) const {
+        const size_t offset = frames % mBufferSizeFrames;
+        const size_t n = std::min(mBurstSizeFrames - (offset % mBurstSizeFrames),
+                                  mBufferSizeFrames - offset);
+        return {offset, n};
+    }
+
+    static size_t getBurstSizeFrames(const size_t frameCount) {
+        const talsa::PcmPeriodSettings periodSettings =
+            talsa::pcmGetPcmPeriodSettings();
+        return std::max<size_t>(
+            periodSettings.periodSizeMultiplier * frameCount / periodSettings.periodCount, 1);
+    }
+
+    void outThreadLoop(const std::shared_ptr<OutputMixer> mixer, const nsecs_t startNs,
+                       const uint64_t startFrames) {
+        util::setThreadPriority(SP_AUDIO_SYS, PRIORITY_AUDIO);
+
+        // The mixer consumes the ring, three PCM writes of room ride out its
+        // jitter. This is not added latency: as the only input the stream is
+        // written to the PCM (from the ring, unmixed if it is at the PCM
+        // config) as soon as a burst is produced. With other inputs playing
+        // a burst could wait for one PCM write.
+        std::unique_ptr<RingBuffer> ring;
+        if (mixer) {
+            ring = std::make_unique<RingBuffer>(
+                std::max(mPcmFrameCount * 3, mBurstSizeFrames * 2) * mFrameSize);
+            mixer->addInput(ring.get(), mSampleRateHz, mNumChannels, AUDIO_FORMAT_PCM_16_BIT);
+        }
+
+        // The client writes ahead of the position, a burst is handed to the
+        // mixer when the position reaches its start. If this thread is late
+        // the position stalls at mTransferredFrames, the client does not
+        // overwrite frames which were not sent yet.
+        float volume = mGetVolume ? mGetVolume() : 1.0f;
+        uint64_t frames = startFrames;
+        while (mThreadRunning) {
+            const auto [offset, n] = getBurst(frames);
+            const nsecs_t burstStartNs = startNs + framesToNs(frames - startFrames);
+            const nsecs_t nowNs = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (burstStartNs > nowNs) {
+                std::this_thread::sleep_for(std::chrono::nanoseconds(burstStartNs - nowNs));
+            }
+
+            if (ring) {
+                const float newVolume = mGetVolume ? mGetVolume() : 1.0f;
+                produceWithVolume(*ring, &mBuffer[offset * mFrameSize], n,
+                                  volume, newVolume);
+                volume = newVolume;
+            }
+            frames += n;
+            mTransferredFrames = frames;
+        }
+
+        if (mixer) {
+            mixer->removeInput(ring.get());
+        }
+    }
+
+    // Copies `nFrames` from `src` into `ring` ramping the volume, the oldest
+    // frames are dropped if the mixer fell behind.
+    void produceWithVolume(RingBuffer &ring, const uint8_t *src, const size_t nFrames,
+                           const float fromVolume, const float toVolume) const {
+        ring.makeRoomForProduce(nFrames * mFrameSize);
+
+        const float step = (nFrames > 1) ? ((toVolume - fromVolume) / (nFrames - 1)) : 0;
+        size_t done = 0;
+        while (done < nFrames) {  // at most two chunks, the ring wraps
+            const auto chunk = ring.getProduceChunk();
+            const size_t m = std::min(chunk.size / mFrameSize, nFrames - done);
+            if (!m) {
+                break;  // the mixer still holds the oldest chunk
+            }
+            aops::rampVolume(fromVolume + step * done, fromVolume + step * (done + m - 1),
+                             AUDIO_FORMAT_PCM_16_BIT, chunk.data, src + done * mFrameSize,
+                             m, mNumChannels);
+            ring.produce(m * mFrameSize);
+            done += m;
+        }
+    }
+
+    void inThreadLoop(talsa::PcmPtr pcm, const nsecs_t startNs,
+                      const uint64_t startFrames) {
+        util::setThreadPriority(SP_AUDIO_SYS, PRIORITY_AUDIO);
+
+        // pcm_read blocks until the burst is captured, the position is
+        // limited by mTransferredFrames.
+        uint64_t frames = startFrames;
+        while (mThreadRunning) {
+            const auto [offset, n] = getBurst(frames);
+            uint8_t *const dst = &mBuffer[offset * mFrameSize];
+            const size_t sz = n * mFrameSize;
+
+            if (!pcm || (talsa::pcmRead(pcm.get(), dst, sz, mFrameSize) <= 0)) {
+                memset(dst, 0, sz);
+
+                const nsecs_t burstEndNs = startNs + framesToNs(frames + n - startFrames);
+                const nsecs_t nowNs = systemTime(SYSTEM_TIME_MONOTONIC);
+                if (burstEndNs > nowNs) {
+                    std::this_thread::sleep_for(std::chrono::nanoseconds(burstEndNs - nowNs));
+                }
+            }
+
+            frames += n;
+            mTransferredFrames = frames;
+        }
+
+        if (pcm) {
+            LOG_ALWAYS_FATAL_IF(pcm_stop(pcm.get()) != 0);
+        }
+    }
+
+    const unsigned mSampleRateHz;
+    const unsigned mNumChannels;
+    const unsigned mFrameSize;
+    const size_t mPcmFrameCount;
+    const size_t mBurstSizeFrames;
+    const bool mIsOut;
+    const bool mUsePcm;
+    const std::function<float()> mGetVolume;  // output only
+    size_t mBufferSizeFrames = 0;
+    android::base::unique_fd mFd;
+    uint8_t *mBuffer = nullptr;
+    native_handle_t *mHandle = nullptr;
+    nsecs_t mStartNs = 0;           // requires mMutex
+    nsecs_t mStopNs = 0;            // requires mMutex
+    uint64_t mStartFrames = 0;      // requires mMutex, position at the last start
+    std::atomic<uint64_t> mTransferredFrames = 0;
+    std::atomic<bool> mThreadRunning = false;
+    std::thread mThread;
+    mutable std::mutex mMutex;
+};
+
+bool checkFormat(const AudioConfig &cfg) {
+    if (xsd::stringToAudioFormat(cfg.base.format) != xsd::AudioFormat::AUDIO_FORMAT_PCM_16_BIT) {
+        ALOGE("%s:%d, unexpected format: '%s'", __func__, __LINE__, cfg.base.format.c_str());
+        return FAILURE(false);
+    }
+    return true;
+}
+
+std::unique_ptr<MmapStream> createImpl(const int32_t minSizeFrames,
+                                       const AudioConfig &cfg,
+                                       const bool isOut,
+                                       const bool usePcm,
+                                       std::function<float()> getVolume) {
+    auto stream = std::make_unique<MmapStreamImpl>(cfg, isOut, usePcm, std::move(getVolume));
+    if (stream->init(minSizeFrames)) {
+        return stream;
+    } else {
+        return FAILURE(nullptr);
+    }
+}
+
+}  // namespace
+
+std::unique_ptr<MmapStream> MmapStream::createOut(const int32_t minSizeFrames,
+                                                  const DeviceAddress &address,
+                                                  const AudioConfig &cfg,
+                                                  std::function<float()> getVolume) {
+    if (!checkFormat(cfg)) {
+        return FAILURE(nullptr);
+    }
+
+    bool usePcm;
+    switch (xsd::stringToAudioDevice(address.deviceType)) {
+    case xsd::AudioDevice::AUDIO_DEVICE_OUT_DEFAULT:
+    case xsd::AudioDevice::AUDIO_DEVICE_OUT_SPEAKER:
+        usePcm = !GetBoolProperty("ro.boot.audio.tinyalsa.ignore_output", false);
+        break;
+
+    default:
+        usePcm = false;
+        break;
+    }
+
+    return createImpl(minSizeFrames, cfg, true, usePcm, std::move(getVolume));
+}
+
+std::unique_ptr<MmapStream> MmapStream::createIn(const int32_t minSizeFrames,
+                                                 const DeviceAddress &address,
+                                                 const AudioConfig &cfg) {
+    if (!checkFormat(cfg)) {
+        return FAILURE(nullptr);
+    }
+
+    bool usePcm;
+    switch (xsd::stringToAudioDevice(address.deviceType)) {
+    case xsd::AudioDevice::AUDIO_DEVICE_IN_DEFAULT:
+    case xsd::AudioDevice::AUDIO_DEVICE_IN_BUILTIN_MIC:
+        usePcm = !GetBoolProperty("ro.boot.audio.tinyalsa.simulate_input", false);
+        break;
+
+    default:
+        usePcm = false;  // silence
+        break;
+    }
+
+    return createImpl(minSizeFrames, cfg, false, usePcm, nullptr);
+}
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <functional>
+#include <memory>
+#include PATH(android/hardware/audio/common/COMMON_TYPES_FILE_VERSION/types.h)
+#include PATH(android/hardware/audio/CORE_TYPES_FILE_VERSION/types.h)
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+using namespace ::android::hardware::audio::common::COMMON_TYPES_CPP_VERSION;
+using namespace ::android::hardware::audio::CORE_TYPES_CPP_VERSION;
+
+// A no-IRQ stream, the client reads or writes the shared memory buffer
+// directly. The position is derived from SYSTEM_TIME_MONOTONIC, a thread
+// hands each burst to the OutputMixer as the position reaches it (output) or
+// reads it from the PCM device (input). The position does not pass the
+// frames the thread has transferred.
+struct MmapStream {
+    virtual ~MmapStream() {}
+    virtual Result start() = 0;
+    virtual Result stop() = 0;
+    virtual Result getPosition(MmapPosition &) const = 0;
+
+    // `sharedMemory` in the result does not own the fd, it stays valid for
+    // the lifetime of the stream.
+    virtual MmapBufferInfo getBufferInfo() const = 0;
+
+    // `getVolume` is called from the stream thread once per burst.
+    static std::unique_ptr<MmapStream> createOut(int32_t minSizeFrames,
+                                                 const DeviceAddress &,
+                                                 const AudioConfig &,
+                                                 std::function<float()> getVolume);
+    static std::unique_ptr<MmapStream> createIn(int32_t minSizeFrames,
+                                                const DeviceAddress &,
+                                                const AudioConfig &);
+};
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
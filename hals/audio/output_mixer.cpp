@@ -0,0 +1,496 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdlib>
+#include <map>
+#include <string.h>
+#include <tuple>
+#include <android-base/stringprintf.h>
+#include <audio_utils/format.h>
+#include <audio_utils/primitives.h>
+#include <log/log.h>
+#include <utils/ThreadDefs.h>
+#include "output_mixer.h"
+#include "util.h"
+#include "debug.h"
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+using namespace std::chrono_literals;
+
+namespace {
+
+constexpr auto kIdleWait = 10ms;  // how long the mixer waits for data
+
+struct MixerKey {
+    unsigned pcmCard;
+    unsigned pcmDevice;
+
+    bool operator<(const MixerKey &rhs) const {
+        return std::tie(pcmCard, pcmDevice) < std::tie(rhs.pcmCard, rhs.pcmDevice);
+    }
+};
+
+std::mutex gMixersMutex;
+std::map<MixerKey, std::weak_ptr<OutputMixer>> gMixers;  // requires gMixersMutex
+
+// Converts `nFrames` of `nChannels` in place to stereo, mono is duplicated
+// and extra channels are dropped. `buf` has room for the result.
+void toStereo(float *buf, const size_t nFrames, const unsigned nChannels) {
+    static_assert(OutputMixer::kNChannels == 2);
+    if (nChannels == 1) {
+        for (size_t i = nFrames; i > 0; --i) {
+            const float x = buf[i - 1];
+            buf[2 * i - 2] = x;
+            buf[2 * i - 1] = x;
+        }
+    } else if (nChannels > 2) {
+        for (size_t i = 0; i < nFrames; ++i) {
+            buf[2 * i] = buf[i * nChannels];
+            buf[2 * i + 1] = buf[i * nChannels + 1];
+        }
+    }
+}
+
+}  // namespace
+
+void LoopbackTap::produce(const void *data, size_t nFrames, const unsigned frameSize,
+                          const nsecs_t presentationNs) {
+    // keep the newest frames if the ring is too small for the write
+    const size_t maxFrames = ring.capacity() / frameSize - 1;
+    uint32_t framesLost = 0;
+    if (nFrames > maxFrames) {
+        framesLost += nFrames - maxFrames;
+        data = static_cast<const uint8_t *>(data) + (nFrames - maxFrames) * frameSize;
+        nFrames = maxFrames;
+    }
+
+    const size_t droppedFrames = ring.makeRoomForProduce(nFrames * frameSize) / frameSize;
+    // the consumer might still hold the oldest chunk
+    const size_t producedFrames = ring.produce(data, nFrames * frameSize) / frameSize;
+    framesLost += droppedFrames + (nFrames - producedFrames);
+    if (framesLost) {
+        mFramesLost.fetch_add(framesLost, std::memory_order_relaxed);
+    }
+
+    const uint32_t seq = mSeq.load(std::memory_order_relaxed);
+    mSeq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    mFrames.store(mFrames.load(std::memory_order_relaxed) + producedFrames - droppedFrames,
+                  std::memory_order_relaxed);
+    mPresentationNs.store(presentationNs, std::memory_order_relaxed);
+    mSeq.store(seq + 2, std::memory_order_release);
+}
+
+void LoopbackTap::getPosition(uint64_t &frames, nsecs_t &presentationNs) const {
+    while (true) {
+        const uint32_t seq = mSeq.load(std::memory_order_acquire);
+        frames = mFrames.load(std::memory_order_relaxed);
+        presentationNs = mPresentationNs.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (!(seq & 1) && (seq == mSeq.load(std::memory_order_relaxed))) {
+            return;
+        }
+    }
+}
+
+OutputMixer::Input::Input(RingBuffer *ring, const unsigned sampleRateHz,
+                          const unsigned nChannels, const audio_format_t format,
+                          const unsigned mixRateHz, const audio_format_t mixFormat,
+                          const size_t mixFrames)
+        : ring(ring)
+        , sampleRateHz(sampleRateHz)
+        , nChannels(nChannels)
+        , format(format)
+        , frameSize(nChannels * audio_bytes_per_sample(format))
+        , mixRateHz(mixRateHz)
+        , isNative((sampleRateHz == mixRateHz) && (nChannels == kNChannels) &&
+                   (format == mixFormat))
+        , maxReadFrames(uint64_t(mixFrames) * sampleRateHz / mixRateHz + 1)
+        , readBuffer(maxReadFrames * std::max(nChannels, kNChannels)) {
+    size_t maxPendingFrames = mixFrames + maxReadFrames;
+    if (sampleRateHz != mixRateHz) {
+        resampler = std::make_unique<Resampler>(sampleRateHz, mixRateHz, kNChannels,
+                                                Resampler::getDefaultQuality());
+        maxPendingFrames = mixFrames + resampler->getMaxOutFrames(maxReadFrames);
+    }
+    pending.resize(maxPendingFrames * kNChannels);
+}
+
+size_t OutputMixer::Input::getAvailableFrames() const {
+    return pendingFrames +
+        uint64_t(ring->availableToConsume() / frameSize) * mixRateHz / sampleRateHz;
+}
+
+OutputMixer::OutputMixer(const unsigned pcmCard, const unsigned pcmDevice,
+                         const unsigned sampleRateHz, const size_t writeSizeFrames)
+        : mMixer(pcmCard)
+        , mSampleRateHz(talsa::pcmGetRateHz(talsa::kFallbackPcmRateHz))
+        , mFormat(AUDIO_FORMAT_PCM_FLOAT)
+        , mWriteSizeFrames(std::max<size_t>(
+              uint64_t(writeSizeFrames) * mSampleRateHz / sampleRateHz, 1)) {
+    // the rate, the write size and the format are updated if the PCM falls
+    // back, float streams are mixed without losing precision if the host
+    // takes float
+    mPcm = talsa::pcmOpenNearest(pcmCard, pcmDevice, kNChannels, mSampleRateHz,
+                                 mWriteSizeFrames, true /* isOut */, mFormat);
+    mFrameSize = kNChannels * audio_bytes_per_sample(mFormat);
+    mMixBuffer.resize(mWriteSizeFrames * kNChannels);
+    mPcmBuffer.resize(mWriteSizeFrames * mFrameSize);
+
+    if (mPcm) {
+        mThread = std::thread(&OutputMixer::mixerThread, this);
+    }
+}
+
+OutputMixer::~OutputMixer() {
+    if (mThread.joinable()) {
+        mThreadRunning = false;
+        mInputsCv.notify_one();
+        mDataSignal.signal();
+        ALOGD("%s: joining mixerThread", __func__);
+        mThread.join();
+    }
+    if (mPcm) {
+        ALOGD("%s: stopping PCM stream", __func__);
+        LOG_ALWAYS_FATAL_IF(pcm_stop(mPcm.get()) != 0);
+    }
+}
+
+std::shared_ptr<OutputMixer> OutputMixer::get(const unsigned pcmCard, const unsigned pcmDevice,
+                                              const unsigned sampleRateHz,
+                                              const size_t writeSizeFrames) {
+    std::lock_guard l(gMixersMutex);
+    std::weak_ptr<OutputMixer> &weakMixer = gMixers[{pcmCard, pcmDevice}];
+    if (auto mixer = weakMixer.lock()) {
+        return mixer;
+    }
+
+    auto mixer = std::make_shared<OutputMixer>(pcmCard, pcmDevice, sampleRateHz,
+                                               writeSizeFrames);
+    if (mixer->mMixer && mixer->mPcm) {
+        weakMixer = mixer;
+        return mixer;
+    } else {
+        return FAILURE(nullptr);
+    }
+}
+
+std::shared_ptr<OutputMixer> OutputMixer::find(const unsigned pcmCard,
+                                               const unsigned pcmDevice) {
+    std::lock_guard l(gMixersMutex);
+    const auto i = gMixers.find({pcmCard, pcmDevice});
+    return (i == gMixers.end()) ? nullptr : i->second.lock();
+}
+
+void OutputMixer::addInput(RingBuffer *ring, const unsigned sampleRateHz,
+                           const unsigned nChannels, const audio_format_t format) {
+    auto input = std::make_unique<Input>(ring, sampleRateHz, nChannels, format,
+                                         mSampleRateHz, mFormat, mWriteSizeFrames);
+    ring->setDataSignal(&mDataSignal);
+    {
+        std::lock_guard l(mInputsMutex);
+        mInputs.push_back(std::move(input));
+    }
+    mInputsCv.notify_one();
+    mDataSignal.signal();
+}
+
+void OutputMixer::removeInput(RingBuffer *ring) {
+    std::unique_ptr<Input> input;  // destroyed once the mixer thread is done with it
+    {
+        std::unique_lock l(mInputsMutex);
+        const auto i = std::find_if(mInputs.begin(), mInputs.end(),
+            [ring](const std::unique_ptr<Input> &input){ return input->ring == ring; });
+        if (i != mInputs.end()) {
+            input = std::move(*i);
+            mInputs.erase(i);
+        }
+        waitForSnapshotsLocked(l);
+    }
+    ring->setDataSignal(nullptr);
+}
+
+void OutputMixer::addLoopback(LoopbackTap *tap) {
+    std::lock_guard l(mInputsMutex);
+    mLoopbacks.push_back(tap);
+}
+
+void OutputMixer::removeLoopback(LoopbackTap *tap) {
+    std::unique_lock l(mInputsMutex);
+    mLoopbacks.erase(std::remove(mLoopbacks.begin(), mLoopbacks.end(), tap), mLoopbacks.end());
+    waitForSnapshotsLocked(l);
+}
+
+// The mixer thread could be using snapshots taken before mInputs or
+// mLoopbacks were changed, the next snapshots see the change.
+void OutputMixer::waitForSnapshotsLocked(std::unique_lock<std::mutex> &l) {
+    const uint64_t mixes = mMixes;
+    mMixingCv.wait(l, [this, mixes](){ return !mMixing || (mMixes != mixes); });
+}
+
+void OutputMixer::dump(std::string &out) const {
+    std::lock_guard l(mInputsMutex);
+
+    android::base::StringAppendF(
+        &out, "  OutputMixer: sampleRate=%u channels=%u format=%#x writeSize=%zu "
+        "inputs=%zu loopbacks=%zu pcmWrites=%" PRIu64 " mixedWrites=%" PRIu64
+        " pcmJitter=%uus (max=%uus)\n",
+        mSampleRateHz, kNChannels, mFormat, mWriteSizeFrames, mInputs.size(),
+        mLoopbacks.size(), mPcmWrites.load(std::memory_order_relaxed),
+        mMixedWrites.load(std::memory_order_relaxed),
+        getPcmJitterUs(), getPcmJitterMaxUs());
+    for (const auto &input : mInputs) {
+        android::base::StringAppendF(
+            &out, "    input: sampleRate=%u channels=%u format=%#x%s\n",
+            input->sampleRateHz, input->nChannels, input->format,
+            input->isNative ? "" : " (converted)");
+    }
+    mPcmWriteDurationHistogram.dump(out, "pcmWrite");
+}
+
+void OutputMixer::mixerThread() {
+    util::setThreadPriority(SP_AUDIO_SYS, PRIORITY_AUDIO);
+    nsecs_t prevWriteNs = 0;
+
+    // The lock is not held while waiting for data or writing to the PCM, the
+    // thread works on snapshots of the inputs and loopbacks.
+    std::unique_lock l(mInputsMutex);
+    while (mThreadRunning) {
+        if (mInputs.empty()) {
+            prevWriteNs = 0;
+            mInputsCv.wait_for(l, 100ms);
+            continue;
+        }
+
+        mInputsSnapshot.clear();
+        for (const auto &input : mInputs) {
+            mInputsSnapshot.push_back(input.get());
+        }
+        mLoopbacksSnapshot = mLoopbacks;
+        mMixing = true;
+        l.unlock();
+
+        mixAndWrite(prevWriteNs);
+
+        l.lock();
+        mMixing = false;
+        ++mMixes;
+        mMixingCv.notify_all();
+    }
+    ALOGD("%s: exiting", __func__);
+}
+
+void OutputMixer::mixAndWrite(nsecs_t &prevWriteNs) {
+    // A single input is written as soon as it has data, several inputs are
+    // given up to kIdleWait to have a full write (see `mix`).
+    const size_t minFrames = (mInputsSnapshot.size() == 1) ? 1 : mWriteSizeFrames;
+
+    // the cadence is meaningful only if pcm_write was not waiting for data
+    const bool hadData = hasData(minFrames);
+    if (!hadData && !waitForData(minFrames) && !hasData(1)) {
+        return;
+    }
+
+    int n;
+    Input *const input = mInputsSnapshot.front();
+    if ((mInputsSnapshot.size() == 1) && input->isNative && !input->pendingFrames) {
+        // A single stream at the PCM config does not need mixing, pcm_write
+        // reads directly from its ring buffer (the chunk is pinned until
+        // `consume`).
+        const auto chunk = input->ring->getConsumeChunk();
+        const size_t szFrames = std::min(mWriteSizeFrames * mFrameSize, chunk.size) / mFrameSize;
+        n = pcmWrite(chunk.data, szFrames);
+        if (n > 0) {
+            produceLoopbacks(chunk.data, n);
+        }
+        // drop the chunk on errors, the ring must keep moving
+        input->ring->consume(chunk, ((n < 0) ? szFrames : n) * mFrameSize);
+    } else {
+        const size_t szFrames = mix(mPcmBuffer.data(), mWriteSizeFrames);
+        n = szFrames ? pcmWrite(mPcmBuffer.data(), szFrames) : 0;
+        if (n > 0) {
+            produceLoopbacks(mPcmBuffer.data(), n);
+        }
+        mMixedWrites.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (n > 0) {
+        const nsecs_t nowNs = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (prevWriteNs && hadData) {
+            updatePcmJitter(nowNs - prevWriteNs, n);
+        }
+        prevWriteNs = nowNs;
+        mPcmWrites.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool OutputMixer::hasData(const size_t minFrames) const {
+    return std::any_of(mInputsSnapshot.begin(), mInputsSnapshot.end(),
+        [minFrames](const Input *input){ return input->getAvailableFrames() >= minFrames; });
+}
+
+// Waits up to kIdleWait for any input to have at least `minFrames`.
+bool OutputMixer::waitForData(const size_t minFrames) const {
+    return mDataSignal.wait(std::chrono::high_resolution_clock::now() + kIdleWait,
+                            [this, minFrames](){ return hasData(minFrames); });
+}
+
+// Sums up to `dstFrames` from every input into `dst` (at the PCM format),
+// returns the number of frames in `dst`. If some input has `dstFrames`, an
+// input with fewer frames is held back for one write instead of being
+// padded with silence in the middle of its stream, its producer is likely
+// about to catch up. Inputs with fewer frames are padded otherwise.
+size_t OutputMixer::mix(uint8_t *dst, const size_t dstFrames) {
+    float *const mix = mMixBuffer.data();
+    std::fill(mix, mix + dstFrames * kNChannels, 0.0f);
+
+    const bool anyFull = hasData(dstFrames);
+
+    mHeldBackNext.clear();
+    size_t mixedFrames = 0;
+    for (Input *input : mInputsSnapshot) {
+        const size_t available = input->getAvailableFrames();
+        if (!available) {
+            continue;
+        } else if (anyFull && (available < dstFrames) &&
+                   (std::find(mHeldBack.begin(), mHeldBack.end(), input) == mHeldBack.end())) {
+            mHeldBackNext.push_back(input);
+            continue;
+        }
+
+        convertInput(*input, dstFrames);
+        const size_t n = std::min(input->pendingFrames, dstFrames);
+        const float *const src = input->pending.data();
+        for (size_t i = 0; i < n * kNChannels; ++i) {  // vectorized by the compiler
+            mix[i] += src[i];
+        }
+
+        input->pendingFrames -= n;
+        memmove(input->pending.data(), src + n * kNChannels,
+                input->pendingFrames * kNChannels * sizeof(float));
+        mixedFrames = std::max(mixedFrames, n);
+    }
+    mHeldBack.swap(mHeldBackNext);
+
+    // clamps
+    if (mFormat == AUDIO_FORMAT_PCM_FLOAT) {
+        memcpy_to_float_from_float_with_clamping(reinterpret_cast<float *>(dst), mix,
+                                                 mixedFrames * kNChannels, 1.0f);
+    } else {
+        memcpy_by_audio_format(dst, mFormat, mix, AUDIO_FORMAT_PCM_FLOAT,
+                               mixedFrames * kNChannels);
+    }
+    return mixedFrames;
+}
+
+// Converts frames from the input's ring into `input.pending` until it has
+// `nFrames` or the ring is empty.
+void OutputMixer::convertInput(Input &input, const size_t nFrames) {
+    while (input.pendingFrames < nFrames) {
+        const size_t neededFrames = nFrames - input.pendingFrames;
+        // the resampler might need one more frame for the last output frame
+        const size_t wantFrames = input.resampler
+            ? std::min<size_t>(uint64_t(neededFrames) * input.sampleRateHz / input.mixRateHz + 1,
+                               input.maxReadFrames)
+            : neededFrames;
+
+        const auto chunk = input.ring->getConsumeChunk();
+        const size_t readFrames = std::min(chunk.size / input.frameSize, wantFrames);
+        if (readFrames) {
+            memcpy_by_audio_format(input.readBuffer.data(), AUDIO_FORMAT_PCM_FLOAT,
+                                   chunk.data, input.format, readFrames * input.nChannels);
+        }
+        input.ring->consume(chunk, readFrames * input.frameSize);
+        if (!readFrames) {
+            break;
+        }
+
+        toStereo(input.readBuffer.data(), readFrames, input.nChannels);
+        float *const pending = &input.pending[input.pendingFrames * kNChannels];
+        if (input.resampler) {
+            input.pendingFrames +=
+                input.resampler->process(input.readBuffer.data(), readFrames, pending);
+        } else {
+            memcpy(pending, input.readBuffer.data(), readFrames * kNChannels * sizeof(float));
+            input.pendingFrames += readFrames;
+        }
+    }
+}
+
+// Returns the number of frames written or a negative value on errors.
+int OutputMixer::pcmWrite(const void *data, const size_t nFrames) {
+    const nsecs_t startNs = systemTime(SYSTEM_TIME_MONOTONIC);
+    const int n = talsa::pcmWrite(mPcm.get(), data, nFrames * mFrameSize, mFrameSize);
+    mPcmWriteDurationHistogram.add(
+        std::min<int64_t>(ns2us(systemTime(SYSTEM_TIME_MONOTONIC) - startNs), UINT32_MAX));
+    return (n < 0) ? n : (n / int(mFrameSize));
+}
+
+// Copies the frames just written into the loopback taps. The last of them is
+// presented once the frames queued in the PCM are played, plus the host
+// latency.
+void OutputMixer::produceLoopbacks(const void *data, const size_t nFrames) {
+    if (mLoopbacksSnapshot.empty()) {
+        return;
+    }
+
+    nsecs_t presentationNs;
+    unsigned pcmAvailFrames;
+    struct timespec ts;
+    if (pcm_get_htimestamp(mPcm.get(), &pcmAvailFrames, &ts) == 0) {
+        const unsigned pcmBufferFrames = pcm_get_buffer_size(mPcm.get());
+        const uint64_t queuedFrames =
+            (pcmBufferFrames > pcmAvailFrames) ? (pcmBufferFrames - pcmAvailFrames) : 0;
+        presentationNs = seconds_to_nanoseconds(ts.tv_sec) + ts.tv_nsec
+            + queuedFrames * 1000000000 / mSampleRateHz;
+    } else {
+        presentationNs = systemTime(SYSTEM_TIME_MONOTONIC)
+            + int64_t(nFrames) * 1000000000 / mSampleRateHz;
+    }
+    presentationNs += ms2ns(talsa::pcmGetHostLatencyMs());
+
+    for (LoopbackTap *tap : mLoopbacksSnapshot) {
+        tap->produce(data, nFrames, mFrameSize, presentationNs);
+    }
+}
+
+// With a steady PCM, pcm_write returns once per the duration of the frames
+// written.
+void OutputMixer::updatePcmJitter(const nsecs_t intervalNs, const size_t frames) {
+    const int64_t expectedUs = int64_t(frames) * 1000000 / mSampleRateHz;
+    const uint32_t jitterUs = std::min<int64_t>(
+        std::abs(ns2us(intervalNs) - expectedUs), UINT32_MAX);
+
+    const uint32_t avgUs = mPcmJitterUs.load(std::memory_order_relaxed);
+    mPcmJitterUs.store(avgUs - avgUs / 8 + jitterUs / 8, std::memory_order_relaxed);
+    if (jitterUs > mPcmJitterMaxUs.load(std::memory_order_relaxed)) {
+        mPcmJitterMaxUs.store(jitterUs, std::memory_order_relaxed);
+    }
+}
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
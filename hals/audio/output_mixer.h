@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <system/audio.h>
+#include <utils/Timers.h>
+#include "resampler.h"
+#include "ring_buffer.h"
+#include "talsa.h"
+#include "telemetry.h"
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+// A copy of what an OutputMixer writes to the PCM (at the mixer's config,
+// see OutputMixer::getSampleRateHz) for capturing what is being played. The
+// mixer thread is the producer of `ring`, the oldest frames are dropped if
+// the consumer falls behind.
+struct LoopbackTap {
+    explicit LoopbackTap(size_t capacityBytes) : ring(capacityBytes) {}
+
+    // Producer only.
+    void produce(const void *data, size_t nFrames, unsigned frameSize,
+                 nsecs_t presentationNs);
+
+    // The number of frames that went through `ring` (produced and not
+    // dropped) and when the last of them is presented, 0 if nothing was
+    // produced yet. The pair is consistent.
+    void getPosition(uint64_t &frames, nsecs_t &presentationNs) const;
+    uint32_t takeFramesLost() { return mFramesLost.exchange(0); }
+
+    RingBuffer ring;
+
+private:
+    std::atomic<uint32_t> mSeq = 0;  // odd while the position is updated
+    std::atomic<uint64_t> mFrames = 0;
+    std::atomic<int64_t> mPresentationNs = 0;
+    std::atomic<uint32_t> mFramesLost = 0;
+};
+
+// Sums all output streams of a PCM into it with one writer thread. The mixer
+// runs at the PCM's native config: kNChannels at
+// ro.hardware.audio.tinyalsa.pcm_rate_hz (or kFallbackPcmRateHz), with the
+// widest samples the host takes (float, 24 bit packed or 16 bit, see
+// talsa::pcmOpenNearest). Each stream produces into its own RingBuffer at the stream config
+// (the mixer is the consumer) and the mixer converts the format, channels
+// and rate of every input while mixing. Volume is expected to be applied by
+// the stream.
+struct OutputMixer {
+    static constexpr unsigned kNChannels = 2;
+
+    // Writes the duration of `writeSizeFrames` at `sampleRateHz` at a time.
+    OutputMixer(unsigned pcmCard, unsigned pcmDevice,
+                unsigned sampleRateHz, size_t writeSizeFrames);
+    ~OutputMixer();
+
+    // Returns the running mixer of the PCM, shared by all output streams,
+    // nullptr if the PCM could not be opened. If the mixer is created, it
+    // writes the duration of `writeSizeFrames` at `sampleRateHz` at a time.
+    static std::shared_ptr<OutputMixer> get(unsigned pcmCard, unsigned pcmDevice,
+                                            unsigned sampleRateHz, size_t writeSizeFrames);
+
+    // Returns the running mixer of the PCM if there is one, it is not created.
+    static std::shared_ptr<OutputMixer> find(unsigned pcmCard, unsigned pcmDevice);
+
+    // `ring` holds interleaved frames of the config given. The mixer does not
+    // access `ring` after `removeInput` returns.
+    void addInput(RingBuffer *ring, unsigned sampleRateHz, unsigned nChannels,
+                  audio_format_t format);
+    void removeInput(RingBuffer *ring);
+
+    // Every PCM write is copied into `tap`, the mixer does not access `tap`
+    // after `removeLoopback` returns.
+    void addLoopback(LoopbackTap *tap);
+    void removeLoopback(LoopbackTap *tap);
+
+    // The config of the PCM writes (and of the loopback taps).
+    unsigned getSampleRateHz() const { return mSampleRateHz; }
+    unsigned getNChannels() const { return kNChannels; }
+    audio_format_t getFormat() const { return mFormat; }
+
+    // Average and max deviation of pcm_write returns from the duration
+    // of the frames written, the average starts at kInitialPcmJitterUs.
+    static constexpr uint32_t kInitialPcmJitterUs = 1000;
+    uint32_t getPcmJitterUs() const { return mPcmJitterUs.load(std::memory_order_relaxed); }
+    uint32_t getPcmJitterMaxUs() const { return mPcmJitterMaxUs.load(std::memory_order_relaxed); }
+    const Histogram &getPcmWriteDurationHistogram() const { return mPcmWriteDurationHistogram; }
+    void dump(std::string &out) const;
+
+    OutputMixer(const OutputMixer &) = delete;
+    OutputMixer &operator=(const OutputMixer &) = delete;
+
+private:
+    // An input and its conversion to the mixer config, the conversion state
+    // is used by the mixer thread only.
+    struct Input {
+        Input(RingBuffer *ring, unsigned sampleRateHz, unsigned nChannels,
+              audio_format_t format, unsigned mixRateHz, audio_format_t mixFormat,
+              size_t mixFrames);
+
+        // frames at the mixer rate `ring` and `pending` hold
+        size_t getAvailableFrames() const;
+
+        RingBuffer *const ring;
+        const unsigned sampleRateHz;
+        const unsigned nChannels;
+        const audio_format_t format;
+        const unsigned frameSize;
+        const unsigned mixRateHz;
+        const bool isNative;     // the config of the PCM, written without conversion
+        const size_t maxReadFrames;  // at sampleRateHz per conversion
+        std::unique_ptr<Resampler> resampler;  // if sampleRateHz != mixRateHz
+        std::vector<float> readBuffer;  // maxReadFrames of kNChannels
+        std::vector<float> pending;     // converted, not mixed yet, kNChannels
+        size_t pendingFrames = 0;
+    };
+
+    void waitForSnapshotsLocked(std::unique_lock<std::mutex> &);
+    void mixerThread();
+    void mixAndWrite(nsecs_t &prevWriteNs);
+    bool hasData(size_t minFrames) const;
+    bool waitForData(size_t minFrames) const;
+    size_t mix(uint8_t *dst, size_t dstFrames);
+    void convertInput(Input &input, size_t nFrames);
+    int pcmWrite(const void *data, size_t nFrames);
+    void updatePcmJitter(nsecs_t intervalNs, size_t frames);
+    void produceLoopbacks(const void *data, size_t nFrames);
+
+    talsa::Mixer mMixer;
+    unsigned mSampleRateHz;  // of the PCM
+    audio_format_t mFormat;  // of the PCM
+    size_t mWriteSizeFrames;
+    talsa::PcmPtr mPcm;
+    unsigned mFrameSize;
+    std::vector<float> mMixBuffer;
+    std::vector<uint8_t> mPcmBuffer;
+
+    std::vector<std::unique_ptr<Input>> mInputs;  // requires mInputsMutex
+    std::vector<LoopbackTap *> mLoopbacks;  // requires mInputsMutex
+    bool mMixing = false;  // requires mInputsMutex, the snapshots below are in use
+    uint64_t mMixes = 0;   // requires mInputsMutex, snapshots released
+    mutable std::mutex mInputsMutex;
+    std::condition_variable mInputsCv;
+    std::condition_variable mMixingCv;
+    DataSignal mDataSignal;  // signalled when any input is produced
+
+    // mixerThread only, copied from mInputs and mLoopbacks every write
+    std::vector<Input *> mInputsSnapshot;
+    std::vector<LoopbackTap *> mLoopbacksSnapshot;
+    std::vector<Input *> mHeldBack;  // short inputs skipped by the last mix
+    std::vector<Input *> mHeldBackNext;
+
+    // written by mixerThread
+    std::atomic<uint32_t> mPcmJitterUs = kInitialPcmJitterUs;
+    std::atomic<uint32_t> mPcmJitterMaxUs = 0;
+    std::atomic<uint64_t> mPcmWrites = 0;
+    std::atomic<uint64_t> mMixedWrites = 0;
+    Histogram mPcmWriteDurationHistogram;
+
+    std::thread mThread;
+    std::atomic<bool> mThreadRunning = true;
+};
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
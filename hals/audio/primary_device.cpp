@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
 #include <log/log.h>
 #include <system/audio.h>
 #include PATH(APM_XSD_ENUMS_H_FILENAME)
@@ -253,6 +255,23 @@ Return<Result> Device::removeDeviceEffect(AudioPortHandle device, uint64_t effec
     return FAILURE(Result::NOT_SUPPORTED);
 }
 
+Return<void> Device::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) {
+    if (!fd.getNativeHandle() || (fd->numFds < 1)) {
+        return Void();
+    }
+
+    std::lock_guard<std::mutex> guard(mMutex);
+    android::base::WriteStringToFd(android::base::StringPrintf(
+        "Device: masterVolume=%.3f masterMute=%d micMute=%d "
+        "outputStreams=%zu inputStreams=%zu\n",
+        mMasterVolume, mMasterMute, mMicMute,
+        mOutputStreams.size(), mInputStreams.size()), fd->data[0]);
+    for (StreamOut *stream : mOutputStreams) {
+        stream->debug(fd, options);
+    }
+    return Void();
+}
+
 void Device::unrefDevice(StreamIn *sin) {
     std::lock_guard<std::mutex> guard(mMutex);
     LOG_ALWAYS_FATAL_IF(mInputStreams.erase(sin) < 1);
@@ -479,6 +498,10 @@ Return<Result> PrimaryDevice::removeDeviceEffect(AudioPortHandle device, uint64_
     return mDevice->removeDeviceEffect(device, effectId);
 }
 
+Return<void> PrimaryDevice::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) {
+    return mDevice->debug(fd, options);
+}
+
 Return<Result> PrimaryDevice::setVoiceVolume(float volume) {
     return (volume >= 0 && volume <= 1.0) ? Result::OK : FAILURE(Result::INVALID_ARGUMENTS);
 }
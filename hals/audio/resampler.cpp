@@ -0,0 +1,206 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <math.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#include <android-base/properties.h>
+#include <log/log.h>
+#include "resampler.h"
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+namespace {
+
+constexpr unsigned kMaxPhases = 4096;
+
+struct QualityParams {
+    unsigned taps;
+    double kaiserBeta;
+    double rolloff;  // the cutoff relative to the lower Nyquist frequency
+};
+
+QualityParams getQualityParams(const Resampler::Quality quality) {
+    switch (quality) {
+    case Resampler::Quality::LOW:    return {8, 6.0, 0.80};
+    case Resampler::Quality::MEDIUM: return {16, 8.0, 0.90};
+    case Resampler::Quality::HIGH:   return {32, 10.0, 0.94};
+    }
+    LOG_ALWAYS_FATAL("%s:%d unexpected quality: %d", __func__, __LINE__, int(quality));
+}
+
+// The zeroth order modified Bessel function of the first kind.
+double besselI0(const double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; ++k) {
+        const double t = x / (2 * k);
+        term *= t * t;
+        sum += term;
+        if (term < sum * 1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+double sinc(const double x) {
+    return (fabs(x) < 1e-9) ? 1.0 : (sin(M_PI * x) / (M_PI * x));
+}
+
+// `n` is a multiple of 4
+float dot(const float *x, const float *h, const size_t n) {
+#if defined(__ARM_NEON)
+    float32x4_t acc = vdupq_n_f32(0);
+    for (size_t i = 0; i < n; i += 4) {
+        acc = vmlaq_f32(acc, vld1q_f32(x + i), vld1q_f32(h + i));
+    }
+    const float32x2_t s = vadd_f32(vget_low_f32(acc), vget_high_f32(acc));
+    return vget_lane_f32(vpadd_f32(s, s), 0);
+#elif defined(__SSE__)
+    __m128 acc = _mm_setzero_ps();
+    for (size_t i = 0; i < n; i += 4) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, acc);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+    float acc = 0;
+    for (size_t i = 0; i < n; ++i) {
+        acc += x[i] * h[i];
+    }
+    return acc;
+#endif
+}
+
+}  // namespace
+
+Resampler::Resampler(const unsigned inRateHz, const unsigned outRateHz,
+                     const unsigned nChannels, const Quality quality)
+        : mInRateHz(inRateHz)
+        , mOutRateHz(outRateHz)
+        , mNChannels(nChannels)
+        , mHistory(nChannels) {
+    const unsigned g = std::gcd(inRateHz, outRateHz);
+    mL = outRateHz / g;
+    mM = inRateHz / g;
+    LOG_ALWAYS_FATAL_IF(mL > kMaxPhases, "inRateHz=%u outRateHz=%u", inRateHz, outRateHz);
+
+    // When decimating the cutoff is M/L times lower relative to the input
+    // rate, the filter needs that many more taps for the same quality.
+    const QualityParams params = getQualityParams(quality);
+    mTaps = params.taps * ((mM + mL - 1) / mL);
+
+    // The prototype filter runs at inRateHz * L, the cutoff is below the
+    // Nyquist frequency of the lower of the two rates.
+    const size_t n = size_t(mTaps) * mL;
+    const double center = (n - 1) / 2.0;
+    const double cutoff = params.rolloff * 0.5 / std::max(mL, mM);
+    const double i0beta = besselI0(params.kaiserBeta);
+
+    std::vector<double> h(n);
+    for (size_t i = 0; i < n; ++i) {
+        const double r = (n > 1) ? (2.0 * i / (n - 1) - 1.0) : 0.0;
+        const double window = besselI0(params.kaiserBeta * sqrt(std::max(0.0, 1.0 - r * r))) / i0beta;
+        h[i] = 2 * cutoff * sinc(2 * cutoff * (i - center)) * window;
+    }
+
+    // Phase p weights the window ending at the newest input sample, each
+    // phase is normalized for unity DC gain.
+    mBank.resize(n);
+    for (unsigned p = 0; p < mL; ++p) {
+        float *phase = &mBank[size_t(p) * mTaps];
+        double sum = 0;
+        for (unsigned k = 0; k < mTaps; ++k) {
+            sum += h[p + size_t(mTaps - 1 - k) * mL];
+        }
+        for (unsigned k = 0; k < mTaps; ++k) {
+            phase[k] = h[p + size_t(mTaps - 1 - k) * mL] / sum;
+        }
+    }
+
+    for (std::vector<float> &history : mHistory) {
+        history.assign(mTaps - 1, 0.0f);
+    }
+}
+
+Resampler::Quality Resampler::getDefaultQuality() {
+    const std::string value =
+        ::android::base::GetProperty("ro.hardware.audio.resampler_quality", "");
+    if (value == "low") {
+        return Quality::LOW;
+    } else if (value == "high") {
+        return Quality::HIGH;
+    } else {
+        return Quality::MEDIUM;
+    }
+}
+
+size_t Resampler::getMaxOutFrames(const size_t inFrames) const {
+    return (inFrames * mL + mM - 1) / mM + 1;
+}
+
+size_t Resampler::process(const float *in, const size_t inFrames, float *out) {
+    const size_t skipFrames = std::min(mSkipFrames, inFrames);
+    unsigned phase = mPhase;
+    size_t nOut = 0;
+    size_t pos = 0;
+    size_t size = 0;
+
+    // every channel goes through the same phases
+    for (unsigned c = 0; c < mNChannels; ++c) {
+        std::vector<float> &buf = mHistory[c];
+        const size_t historySize = buf.size();
+        buf.resize(historySize + inFrames - skipFrames);
+        for (size_t i = skipFrames; i < inFrames; ++i) {
+            buf[historySize + i - skipFrames] = in[i * mNChannels + c];
+        }
+
+        phase = mPhase;
+        pos = 0;
+        nOut = 0;
+        size = buf.size();
+        for (; (pos + mTaps) <= size; ++nOut) {
+            out[nOut * mNChannels + c] = dot(&buf[pos], &mBank[size_t(phase) * mTaps], mTaps);
+            phase += mM;
+            pos += phase / mL;
+            phase %= mL;
+        }
+
+        buf.erase(buf.begin(), buf.begin() + std::min(pos, size));
+    }
+
+    mPhase = phase;
+    mSkipFrames = mSkipFrames - skipFrames + ((pos > size) ? (pos - size) : 0);
+    return nOut;
+}
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+// A polyphase sample rate converter for interleaved float frames. The
+// rational ratio outRateHz/inRateHz = L/M is exact, the filter bank (L
+// phases of a Kaiser windowed sinc) is computed once in the constructor.
+struct Resampler {
+    // taps per phase, times ceil(M/L) when decimating
+    enum class Quality {
+        LOW,     // 8 taps
+        MEDIUM,  // 16 taps
+        HIGH,    // 32 taps
+    };
+
+    Resampler(unsigned inRateHz, unsigned outRateHz, unsigned nChannels, Quality);
+
+    // ro.hardware.audio.resampler_quality: "low", "medium" (default) or "high"
+    static Quality getDefaultQuality();
+
+    // Converts all `inFrames`, `out` must have room for
+    // getMaxOutFrames(inFrames) frames. Returns the number of frames in `out`.
+    size_t process(const float *in, size_t inFrames, float *out);
+    size_t getMaxOutFrames(size_t inFrames) const;
+
+    unsigned getInRateHz() const { return mInRateHz; }
+    unsigned getOutRateHz() const { return mOutRateHz; }
+
+    Resampler(const Resampler &) = delete;
+    Resampler &operator=(const Resampler &) = delete;
+
+private:
+    const unsigned mInRateHz;
+    const unsigned mOutRateHz;
+    const unsigned mNChannels;
+    unsigned mL;    // interpolation factor
+    unsigned mM;    // decimation factor
+    unsigned mTaps; // per phase, a multiple of 4
+    std::vector<float> mBank;  // mL phases of mTaps, reversed for `dot`
+    std::vector<std::vector<float>> mHistory;  // per channel
+    unsigned mPhase = 0;
+    size_t mSkipFrames = 0;  // input frames the next window starts past
+};
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
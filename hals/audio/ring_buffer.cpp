@@ -14,6 +14,12 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <string.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 #include <log/log.h>
 #include "ring_buffer.h"
 
@@ -23,128 +29,194 @@ namespace audio {
 namespace CPP_VERSION {
 namespace implementation {
 
+namespace {
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t));
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+void futexWait(std::atomic<uint32_t> &word, const uint32_t expected,
+               const std::chrono::nanoseconds timeout) {
+    struct timespec ts;
+    ts.tv_sec = timeout.count() / 1000000000;
+    ts.tv_nsec = timeout.count() % 1000000000;
+
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word),
+              FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0);
+}
+
+void futexWake(std::atomic<uint32_t> &word) {
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word),
+              FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+}
+
+void signal(std::atomic<uint32_t> &seq, std::atomic<bool> &waiting) {
+    seq.fetch_add(1);
+    if (waiting.exchange(false)) {
+        futexWake(seq);
+    }
+}
+
+template <class F> bool waitUntil(std::atomic<uint32_t> &seq,
+                                  std::atomic<bool> &waiting,
+                                  const RingBuffer::Timepoint blockUntil,
+                                  const F &isReady) {
+    while (true) {
+        const uint32_t s = seq.load();
+        if (isReady()) {
+            return true;
+        }
+
+        waiting.store(true);
+        if (isReady()) {  // the other side might not have seen `waiting`
+            return true;
+        }
+
+        const auto timeout = blockUntil - std::chrono::high_resolution_clock::now();
+        if (timeout <= timeout.zero()) {
+            return false;
+        }
+
+        futexWait(seq, s, timeout);
+    }
+}
+}  // namespace
+
+bool DataSignal::wait(const Timepoint blockUntil, const std::function<bool()> &isReady) const {
+    return waitUntil(mSeq, mWaiting, blockUntil, isReady);
+}
+
+void DataSignal::signal() {
+    implementation::signal(mSeq, mWaiting);
+}
+
 RingBuffer::RingBuffer(size_t capacity)
         : mBuffer(new uint8_t[capacity])
         , mCapacity(capacity) {}
 
+size_t RingBuffer::availableToProduceImpl(const uint64_t producePos) const {
+    // The chunk pinned by the consumer is not available to the producer
+    // even if it was dropped by `makeRoomForProduce`. The pin could briefly
+    // be older than the data already produced, see `getConsumeChunk`.
+    const uint64_t consumePos = std::min(mConsumePos.load(), mConsumerPin.load());
+    const uint64_t used = producePos - consumePos;
+    return (used < mCapacity) ? (mCapacity - used) : 0;
+}
+
 size_t RingBuffer::availableToProduce() const {
-    std::lock_guard<std::mutex> guard(mMutex);
-    return mCapacity - mAvailableToConsume;
+    return availableToProduceImpl(mProducePos.load(std::memory_order_relaxed));
 }
 
 size_t RingBuffer::availableToConsume() const {
-    std::unique_lock<std::mutex> lock(mMutex);
-    return mAvailableToConsume;
+    const uint64_t consumePos = mConsumePos.load();
+    return mProducePos.load(std::memory_order_acquire) - consumePos;
 }
 
 size_t RingBuffer::makeRoomForProduce(size_t atLeast) {
-    std::unique_lock<std::mutex> lock(mMutex);
     LOG_ALWAYS_FATAL_IF(atLeast >= mCapacity);
 
-    const size_t toProduce = mCapacity - mAvailableToConsume;
-    const size_t toDrop = (atLeast <= toProduce)
-        ? 0 : atLeast - toProduce;
-
-    mConsumePos = (mConsumePos + toDrop) % mCapacity;
-    mAvailableToConsume -= toDrop;
+    const uint64_t producePos = mProducePos.load(std::memory_order_relaxed);
+    uint64_t consumePos = mConsumePos.load();
+    while (true) {
+        const size_t toProduce = mCapacity - (producePos - consumePos);
+        if (atLeast <= toProduce) {
+            return 0;
+        }
 
-    return toDrop;
+        const size_t toDrop = atLeast - toProduce;
+        if (mConsumePos.compare_exchange_weak(consumePos, consumePos + toDrop)) {
+            return toDrop;
+        }
+    }
 }
 
 bool RingBuffer::waitForProduceAvailable(Timepoint blockUntil) const {
-    std::unique_lock<std::mutex> lock(mMutex);
-    while (true) {
-        if (mAvailableToConsume < mCapacity) {
-            return true;
-        } else if (mProduceAvailable.wait_until(lock, blockUntil) == std::cv_status::timeout) {
-            return false;
-        }
-    }
+    return waitUntil(mConsumeSeq, mProducerWaiting, blockUntil,
+                     [this](){ return availableToProduce() > 0; });
 }
 
 RingBuffer::ContiniousChunk RingBuffer::getProduceChunk() const {
-    std::unique_lock<std::mutex> lock(mMutex);
-    const int availableToProduce = mCapacity - mAvailableToConsume;
+    const uint64_t producePos = mProducePos.load(std::memory_order_relaxed);
+    const size_t offset = producePos % mCapacity;
 
     ContiniousChunk chunk;
-
-    chunk.data = &mBuffer[mProducePos];
-    chunk.size = (mProducePos >= mConsumePos)
-        ? std::min(mCapacity - mProducePos, availableToProduce)
-        : std::min(mConsumePos - mProducePos, availableToProduce);
-
+    chunk.data = &mBuffer[offset];
+    chunk.size = std::min(mCapacity - offset, availableToProduceImpl(producePos));
     return chunk;
 }
 
 size_t RingBuffer::produce(size_t size) {
-    std::unique_lock<std::mutex> lock(mMutex);
-    const int availableToProduce = mCapacity - mAvailableToConsume;
-    size = std::min(size, size_t(availableToProduce));
-
-    mProducePos = (mProducePos + size) % mCapacity;
-    mAvailableToConsume += size;
+    const uint64_t producePos = mProducePos.load(std::memory_order_relaxed);
+    size = std::min(size, availableToProduceImpl(producePos));
 
-    mConsumeAvailable.notify_one();
+    mProducePos.store(producePos + size, std::memory_order_release);
+    signal(mProduceSeq, mConsumerWaiting);
+    if (DataSignal *dataSignal = mDataSignal.load()) {
+        dataSignal->signal();
+    }
     return size;
 }
 
 size_t RingBuffer::produce(const void *srcRaw, size_t size) {
-    std::unique_lock<std::mutex> lock(mMutex);
-    int produceSize = std::min(mCapacity - mAvailableToConsume, int(size));
-    size = produceSize;
+    uint64_t producePos = mProducePos.load(std::memory_order_relaxed);
+    size = std::min(size, availableToProduceImpl(producePos));
     const uint8_t *src = static_cast<const uint8_t *>(srcRaw);
 
-    while (produceSize > 0) {
-        const int availableToProduce = mCapacity - mAvailableToConsume;
-        const int chunkSz = (mProducePos >= mConsumePos)
-            ? std::min(mCapacity - mProducePos, availableToProduce)
-            : std::min(mConsumePos - mProducePos, availableToProduce);
-        void *dst = &mBuffer[mProducePos];
+    for (size_t produceSize = size; produceSize > 0; ) {
+        const size_t offset = producePos % mCapacity;
+        const size_t chunkSz = std::min(mCapacity - offset, produceSize);
 
-        memcpy(dst, src, chunkSz);
+        memcpy(&mBuffer[offset], src, chunkSz);
         src += chunkSz;
-        mProducePos = (mProducePos + chunkSz) % mCapacity;
-        mAvailableToConsume += chunkSz;
+        producePos += chunkSz;
         produceSize -= chunkSz;
     }
 
-    mConsumeAvailable.notify_one();
+    mProducePos.store(producePos, std::memory_order_release);
+    signal(mProduceSeq, mConsumerWaiting);
+    if (DataSignal *dataSignal = mDataSignal.load()) {
+        dataSignal->signal();
+    }
     return size;
 }
 
 bool RingBuffer::waitForConsumeAvailable(Timepoint blockUntil) const {
-    std::unique_lock<std::mutex> lock(mMutex);
+    return waitUntil(mProduceSeq, mConsumerWaiting, blockUntil,
+                     [this](){ return availableToConsume() > 0; });
+}
+
+RingBuffer::ContiniousChunk RingBuffer::getConsumeChunk() const {
+    // Pin the consume position first, `makeRoomForProduce` could move it
+    // concurrently. The pin is valid once the position is unchanged after
+    // the pin is published.
+    uint64_t consumePos = mConsumePos.load();
     while (true) {
-        if (mAvailableToConsume > 0) {
-            return true;
-        } else if (mConsumeAvailable.wait_until(lock, blockUntil) == std::cv_status::timeout) {
-            return false;
+        mConsumerPin.store(consumePos);
+        const uint64_t actual = mConsumePos.load();
+        if (actual == consumePos) {
+            break;
         }
+        consumePos = actual;
     }
-}
 
-RingBuffer::ContiniousLockedChunk RingBuffer::getConsumeChunk() const {
-    std::unique_lock<std::mutex> lock(mMutex);
-
-    ContiniousLockedChunk chunk;
-
-    chunk.data = &mBuffer[mConsumePos];
-    chunk.size = (mConsumePos >= mProducePos)
-        ? std::min(mCapacity - mConsumePos, mAvailableToConsume)
-        : std::min(mProducePos - mConsumePos, mAvailableToConsume);
-    chunk.lock = std::move(lock);
+    const uint64_t producePos = mProducePos.load(std::memory_order_acquire);
+    const size_t offset = consumePos % mCapacity;
 
+    ContiniousChunk chunk;
+    chunk.data = &mBuffer[offset];
+    chunk.size = std::min(mCapacity - offset, size_t(producePos - consumePos));
     return chunk;
 }
 
-size_t RingBuffer::consume(const ContiniousLockedChunk &lock, size_t size) {
-    (void)lock; // the lock is provided by getConsumeChunk
-    size = std::min(size, size_t(mAvailableToConsume));
+size_t RingBuffer::consume(const ContiniousChunk &chunk, size_t size) {
+    size = std::min(size, chunk.size);
 
-    mConsumePos = (mConsumePos + size) % mCapacity;
-    mAvailableToConsume -= size;
+    const uint64_t newConsumePos = mConsumerPin.load() + size;
+    uint64_t consumePos = mConsumePos.load();
+    while ((consumePos < newConsumePos) &&
+           !mConsumePos.compare_exchange_weak(consumePos, newConsumePos)) {}
 
-    mProduceAvailable.notify_one();
+    mConsumerPin.store(kNotPinned);
+    signal(mConsumeSeq, mProducerWaiting);
     return size;
 }
 
@@ -15,11 +15,10 @@
  */
 
 #pragma once
+#include <atomic>
 #include <memory>
 #include <chrono>
-#include <utility>
-#include <condition_variable>
-#include <mutex>
+#include <functional>
 #include <stdint.h>
 
 namespace android {
@@ -28,7 +27,23 @@ namespace audio {
 namespace CPP_VERSION {
 namespace implementation {
 
-// A one-producer-one-consumer ring buffer.
+// Lets one consumer wait for data in any of several RingBuffers, see
+// RingBuffer::setDataSignal.
+struct DataSignal {
+    typedef std::chrono::time_point<std::chrono::high_resolution_clock> Timepoint;
+
+    // Returns false if `isReady` is still false at `blockUntil`.
+    bool wait(Timepoint blockUntil, const std::function<bool()> &isReady) const;
+    void signal();
+
+private:
+    mutable std::atomic<uint32_t> mSeq = 0;      // futex word
+    mutable std::atomic<bool> mWaiting = false;
+};
+
+// A wait-free one-producer-one-consumer ring buffer. The producer and
+// consumer cursors are free running byte counters, the waiting side sleeps on
+// a futex and is woken only if it is actually waiting.
 struct RingBuffer {
     typedef std::chrono::time_point<std::chrono::high_resolution_clock> Timepoint;
 
@@ -41,13 +56,12 @@ struct RingBuffer {
     struct ContiniousChunk {
         void *data;
         size_t size;
-        std::unique_lock<std::mutex> lock;
-    };
-
-    struct ContiniousLockedChunk : public ContiniousChunk{
-        std::unique_lock<std::mutex> lock;
     };
 
+    // Producer only. Drops the oldest data to have at least `atLeast` bytes
+    // available to produce, returns the number of bytes dropped. The chunk
+    // the consumer is currently holding (see `getConsumeChunk`) is never
+    // overwritten, so fewer bytes could be available to produce right after.
     size_t makeRoomForProduce(size_t atLeast);
 
     bool waitForProduceAvailable(Timepoint blockUntil) const;
@@ -67,32 +81,42 @@ struct RingBuffer {
 
     bool waitForConsumeAvailable(Timepoint blockUntil) const;
 
+    // `signal` is signalled after every `produce` as well, until it is reset
+    // to nullptr.
+    void setDataSignal(DataSignal *signal) { mDataSignal = signal; }
+
     // `getConsumeChunk` is a non-blocking function which a pointer
     // (`result.data`) inside RingBuffer's buffer, `result.size` is the
     //  size of the continious chunk (can be smaller than availableToConsume()).
-    // IMPORTANT: do not call long running functions while have an instance of
-    //            ContiniousLockedChunk, it might block the producer because
-    //            it need to drop the stale audio data to replace it with
-    //            more recent one.
-    // NOTE: ContiniousLockedChunk holds a lock inside, it might deadlock
-    //       if you calling other RingBuffer's functions that assume it is
-    //       unlocked, in this case you want to introduce a function like
-    //       `consume` below.
-    ContiniousLockedChunk getConsumeChunk() const;
-
-    // Tries to move the `consume` cursor by `size`, returns the actual size
-    // moved.
-    size_t consume(const ContiniousLockedChunk&, size_t size);
+    // The chunk stays valid (the producer won't overwrite it) until `consume`
+    // is called, it is fine to pass it to pcm_write directly. Every
+    // `getConsumeChunk` must be followed by `consume` (possibly with 0).
+    ContiniousChunk getConsumeChunk() const;
+
+    // Tries to move the `consume` cursor by `size` from the chunk returned by
+    // `getConsumeChunk`, returns the size consumed. The producer might have
+    // dropped some of these bytes already, they are counted as consumed.
+    size_t consume(const ContiniousChunk &, size_t size);
 
 private:
+    size_t availableToProduceImpl(uint64_t producePos) const;
+
+    static constexpr uint64_t kNotPinned = UINT64_MAX;
+
     std::unique_ptr<uint8_t[]> mBuffer;
-    mutable std::condition_variable mProduceAvailable;
-    mutable std::condition_variable mConsumeAvailable;
-    mutable std::mutex mMutex;
-    const int mCapacity;
-    int mAvailableToConsume = 0;
-    int mProducePos = 0;
-    int mConsumePos = 0;
+    const size_t mCapacity;
+
+    // written by the producer
+    alignas(64) std::atomic<uint64_t> mProducePos = 0;
+    mutable std::atomic<uint32_t> mProduceSeq = 0;      // futex word
+    mutable std::atomic<bool> mConsumerWaiting = false;
+    std::atomic<DataSignal *> mDataSignal = nullptr;
+
+    // written by the consumer (and by the producer in `makeRoomForProduce`)
+    alignas(64) std::atomic<uint64_t> mConsumePos = 0;
+    mutable std::atomic<uint64_t> mConsumerPin = kNotPinned;
+    mutable std::atomic<uint32_t> mConsumeSeq = 0;      // futex word
+    mutable std::atomic<bool> mProducerWaiting = false;
 };
 
 }  // namespace implementation
@@ -15,10 +15,16 @@
  */
 
 #include <log/log.h>
+#include PATH(APM_XSD_ENUMS_H_FILENAME)
+#include <algorithm>
 #include "stream_common.h"
 #include "util.h"
 #include "debug.h"
 
+namespace xsd {
+using namespace ::android::audio::policy::configuration::CPP_VERSION;
+}
+
 namespace android {
 namespace hardware {
 namespace audio {
@@ -86,6 +92,18 @@ Result StreamCommon::setDevices(const hidl_vec<DeviceAddress>& devices) const {
     return FAILURE(Result::NOT_SUPPORTED);
 }
 
+bool StreamCommon::isMmapNoIrq() const {
+    return std::any_of(m_flags.begin(), m_flags.end(), [](const AudioInOutFlag& flag){
+        switch (xsd::stringToAudioInOutFlag(flag)) {
+        case xsd::AudioInOutFlag::AUDIO_OUTPUT_FLAG_MMAP_NOIRQ:
+        case xsd::AudioInOutFlag::AUDIO_INPUT_FLAG_MMAP_NOIRQ:
+            return true;
+        default:
+            return false;
+        }
+    });
+}
+
 }  // namespace implementation
 }  // namespace CPP_VERSION
 }  // namespace audio
@@ -46,6 +46,7 @@ struct StreamCommon {
     void getAudioProperties(const IStream::getAudioProperties_cb &_hidl_cb) const;
     void getDevices(const IStream::getDevices_cb &_hidl_cb) const;
     Result setDevices(const hidl_vec<DeviceAddress>& devices) const;
+    bool isMmapNoIrq() const;
 
     const int32_t m_ioHandle;
     const DeviceAddress m_device;
@@ -334,28 +334,84 @@ Return<Result> StreamIn::setHwAvSync(uint32_t hwAvSync) {
 }
 
 Return<Result> StreamIn::start() {
-    return FAILURE(Result::NOT_SUPPORTED);
+    if (!mCommon.isMmapNoIrq()) {
+        return FAILURE(Result::NOT_SUPPORTED);
+    }
+    const std::shared_ptr<MmapStream> mmapStream = getMmapStream();
+    if (!mmapStream) {
+        return FAILURE(Result::INVALID_STATE);
+    }
+
+    return mmapStream->start();
 }
 
 Return<Result> StreamIn::stop() {
-    return FAILURE(Result::NOT_SUPPORTED);
+    if (!mCommon.isMmapNoIrq()) {
+        return FAILURE(Result::NOT_SUPPORTED);
+    }
+    const std::shared_ptr<MmapStream> mmapStream = getMmapStream();
+    if (!mmapStream) {
+        return FAILURE(Result::INVALID_STATE);
+    }
+
+    return mmapStream->stop();
 }
 
 Return<void> StreamIn::createMmapBuffer(int32_t minSizeFrames,
                                         createMmapBuffer_cb _hidl_cb) {
-    (void)minSizeFrames;
-    _hidl_cb(FAILURE(Result::NOT_SUPPORTED), {});
+    if (!mCommon.isMmapNoIrq()) {
+        _hidl_cb(FAILURE(Result::NOT_SUPPORTED), {});
+        return Void();
+    }
+
+    if (minSizeFrames <= 0 || minSizeFrames > (1 << 20)) {
+        _hidl_cb(FAILURE(Result::INVALID_ARGUMENTS), {});
+        return Void();
+    }
+
+    if (mReadThread || mMmapStream) {  // INVALID_STATE if the method was already called.
+        _hidl_cb(FAILURE(Result::INVALID_STATE), {});
+        return Void();
+    }
+
+    auto mmapStream = MmapStream::createIn(minSizeFrames, mCommon.m_device, mCommon.m_config);
+    if (mmapStream) {
+        _hidl_cb(Result::OK, mmapStream->getBufferInfo());
+        std::lock_guard<std::mutex> guard(mMutex);
+        mMmapStream = std::move(mmapStream);
+    } else {
+        _hidl_cb(FAILURE(Result::INVALID_ARGUMENTS), {});
+    }
+
     return Void();
 }
 
 Return<void> StreamIn::getMmapPosition(getMmapPosition_cb _hidl_cb) {
-    _hidl_cb(FAILURE(Result::NOT_SUPPORTED), {});
+    const std::shared_ptr<MmapStream> mmapStream = getMmapStream();
+    if (!mmapStream) {
+        _hidl_cb(FAILURE(mCommon.isMmapNoIrq() ? Result::INVALID_STATE
+                                               : Result::NOT_SUPPORTED), {});
+        return Void();
+    }
+
+    MmapPosition position{};
+    const Result r = mmapStream->getPosition(position);
+    _hidl_cb(r, position);
     return Void();
 }
 
 Result StreamIn::closeImpl(const bool fromDctor) {
     if (mDev) {
-        mReadThread.reset();
+        // the threads are joined outside of mMutex
+        std::unique_ptr<IOThread> readThread;
+        std::shared_ptr<MmapStream> mmapStream;
+        {
+            std::lock_guard<std::mutex> guard(mMutex);
+            readThread = std::move(mReadThread);
+            mmapStream = std::move(mMmapStream);
+        }
+        readThread.reset();
+        mmapStream.reset();
         mDev->unrefDevice(this);
         mDev = nullptr;
         return Result::OK;
@@ -372,6 +428,11 @@ Return<Result> StreamIn::close() {
     return closeImpl(false);
 }
 
+std::shared_ptr<MmapStream> StreamIn::getMmapStream() {
+    std::lock_guard<std::mutex> guard(mMutex);
+    return mMmapStream;
+}
+
 Return<void> StreamIn::getAudioSource(getAudioSource_cb _hidl_cb) {
     _hidl_cb(FAILURE(Result::NOT_SUPPORTED), {});
     return Void();
@@ -395,7 +456,7 @@ Return<void> StreamIn::prepareForReading(uint32_t frameSize,
         return Void();
     }
 
-    if (mReadThread) {  // INVALID_STATE if the method was already called.
+    if (mReadThread || mMmapStream) {  // INVALID_STATE if the method was already called.
         _hidl_cb(FAILURE(Result::INVALID_STATE), {}, {}, {}, -1);
         return Void();
     }
@@ -410,6 +471,7 @@ Return<void> StreamIn::prepareForReading(uint32_t frameSize,
                  *statusDesc,
                  t->getTid().get());
 
+        std::lock_guard<std::mutex> guard(mMutex);
         mReadThread = std::move(t);
     } else {
         _hidl_cb(FAILURE(Result::INVALID_ARGUMENTS), {}, {}, {}, -1);
@@ -15,10 +15,12 @@
  */
 
 #pragma once
+#include <mutex>
 #include PATH(android/hardware/audio/CORE_TYPES_FILE_VERSION/IStreamIn.h)
 #include PATH(android/hardware/audio/FILE_VERSION/IDevice.h)
 #include "stream_common.h"
 #include "io_thread.h"
+#include "mmap_stream.h"
 #include "primary_device.h"
 
 namespace android {
@@ -96,17 +98,23 @@ struct StreamIn : public IStreamIn {
 
 private:
     Result closeImpl(bool fromDctor);
+    // `closeImpl` could run on another binder thread, the snapshot keeps
+    // the stream alive while it is used.
+    std::shared_ptr<MmapStream> getMmapStream();
 
     sp<Device> mDev;
     const StreamCommon mCommon;
     const SinkMetadata mSinkMetadata;
+    // set and reset under mMutex
     std::unique_ptr<IOThread> mReadThread;
+    std::shared_ptr<MmapStream> mMmapStream;
 
     // The count is not reset to zero when output enters standby.
     uint64_t mFrames = 0;
 
     std::atomic<uint32_t> mInputFramesLost = 0;
     std::atomic<float> mEffectiveVolume = 1.0f;
+    std::mutex mMutex;
 };
 
 }  // namespace implementation
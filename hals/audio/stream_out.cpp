@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <android-base/file.h>
+#include <android-base/stringprintf.h>
 #include <log/log.h>
 #include <fmq/EventFlag.h>
 #include <fmq/MessageQueue.h>
@@ -115,6 +117,15 @@ public:
         }
     }
 
+    void dump(std::string &out) const {
+        std::lock_guard l(mExternalSinkReadLock);
+        if (mSink) {
+            mSink->dump(out);
+        } else {
+            out += "  standby\n";
+        }
+    }
+
     auto getDescriptors() const {
         return std::make_tuple(
                 mCommandMQ.getDesc(), mDataMQ.getDesc(), mStatusMQ.getDesc());
@@ -209,8 +220,32 @@ private:
                 }
             }
 
+            // The FMQ ring could wrap, hence two regions.
+            bool beginRead(size_t sz, Regions &regions) override {
+                if (!dataMQ.beginRead(sz, &tx)) {
+                    return false;
+                }
+                const auto first = tx.getFirstRegion();
+                const auto second = tx.getSecondRegion();
+                regions.data[0] = first.getAddress();
+                regions.size[0] = first.getLength();
+                regions.data[1] = second.getAddress();
+                regions.size[1] = second.getLength();
+                return true;
+            }
+
+            void commitRead(size_t sz) override {
+                if (dataMQ.commitRead(sz)) {
+                    totalRead += sz;
+                } else {
+                    ALOGE("WriteThread::%s:%d: DataMQ::commitRead failed",
+                          __func__, __LINE__);
+                }
+            }
+
             size_t totalRead = 0;
             DataMQ &dataMQ;
+            DataMQ::MemTransaction tx;
         };
 
         MQReader reader(mDataMQ);
@@ -362,7 +397,17 @@ Return<Result> StreamOut::setHwAvSync(uint32_t hwAvSync) {
 
 Result StreamOut::closeImpl(const bool fromDctor) {
     if (mDev) {
-        mWriteThread.reset();
+        // `debug` could be running on another thread, the threads are
+        // joined outside of mMutex.
+        std::unique_ptr<IOThread> writeThread;
+        std::shared_ptr<MmapStream> mmapStream;
+        {
+            std::lock_guard<std::mutex> guard(mMutex);
+            writeThread = std::move(mWriteThread);
+            mmapStream = std::move(mMmapStream);
+        }
+        writeThread.reset();
+        mmapStream.reset();
         mDev->unrefDevice(this);
         mDev = nullptr;
         return Result::OK;
@@ -379,23 +424,76 @@ Return<Result> StreamOut::close() {
     return closeImpl(false);
 }
 
+std::shared_ptr<MmapStream> StreamOut::getMmapStream() {
+    std::lock_guard<std::mutex> guard(mMutex);
+    return mMmapStream;
+}
+
 Return<Result> StreamOut::start() {
-    return FAILURE(Result::NOT_SUPPORTED);
+    if (!mCommon.isMmapNoIrq()) {
+        return FAILURE(Result::NOT_SUPPORTED);
+    }
+    const std::shared_ptr<MmapStream> mmapStream = getMmapStream();
+    if (!mmapStream) {
+        return FAILURE(Result::INVALID_STATE);
+    }
+
+    return mmapStream->start();
 }
 
 Return<Result> StreamOut::stop() {
-    return FAILURE(Result::NOT_SUPPORTED);
+    if (!mCommon.isMmapNoIrq()) {
+        return FAILURE(Result::NOT_SUPPORTED);
+    }
+    const std::shared_ptr<MmapStream> mmapStream = getMmapStream();
+    if (!mmapStream) {
+        return FAILURE(Result::INVALID_STATE);
+    }
+
+    return mmapStream->stop();
 }
 
 Return<void> StreamOut::createMmapBuffer(int32_t minSizeFrames,
                                          createMmapBuffer_cb _hidl_cb) {
-    (void)minSizeFrames;
-    _hidl_cb(FAILURE(Result::NOT_SUPPORTED), {});
+    if (!mCommon.isMmapNoIrq()) {
+        _hidl_cb(FAILURE(Result::NOT_SUPPORTED), {});
+        return Void();
+    }
+
+    if (minSizeFrames <= 0 || minSizeFrames > (1 << 20)) {
+        _hidl_cb(FAILURE(Result::INVALID_ARGUMENTS), {});
+        return Void();
+    }
+
+    if (mWriteThread || mMmapStream) {  // INVALID_STATE if the method was already called.
+        _hidl_cb(FAILURE(Result::INVALID_STATE), {});
+        return Void();
+    }
+
+    auto mmapStream = MmapStream::createOut(minSizeFrames, mCommon.m_device, mCommon.m_config,
+                                            [this]() { return getEffectiveVolume(); });
+    if (mmapStream) {
+        _hidl_cb(Result::OK, mmapStream->getBufferInfo());
+        std::lock_guard<std::mutex> guard(mMutex);
+        mMmapStream = std::move(mmapStream);
+    } else {
+        _hidl_cb(FAILURE(Result::INVALID_ARGUMENTS), {});
+    }
+
     return Void();
 }
 
 Return<void> StreamOut::getMmapPosition(getMmapPosition_cb _hidl_cb) {
-    _hidl_cb(FAILURE(Result::NOT_SUPPORTED), {});
+    const std::shared_ptr<MmapStream> mmapStream = getMmapStream();
+    if (!mmapStream) {
+        _hidl_cb(FAILURE(mCommon.isMmapNoIrq() ? Result::INVALID_STATE
+                                               : Result::NOT_SUPPORTED), {});
+        return Void();
+    }
+
+    MmapPosition position{};
+    const Result r = mmapStream->getPosition(position);
+    _hidl_cb(r, position);
     return Void();
 }
 
@@ -431,7 +529,7 @@ Return<void> StreamOut::prepareForWriting(uint32_t frameSize,
         return Void();
     }
 
-    if (mWriteThread) {  // INVALID_STATE if the method was already called.
+    if (mWriteThread || mMmapStream) {  // INVALID_STATE if the method was already called.
         _hidl_cb(FAILURE(Result::INVALID_STATE), {}, {}, {}, -1);
         return Void();
     }
@@ -446,6 +544,7 @@ Return<void> StreamOut::prepareForWriting(uint32_t frameSize,
                  *statusDesc,
                  t->getTid().get());
 
+        std::lock_guard<std::mutex> guard(mMutex);
         mWriteThread = std::move(t);
     } else {
         _hidl_cb(FAILURE(Result::INVALID_ARGUMENTS), {}, {}, {}, -1);
@@ -573,6 +672,30 @@ Return<Result> StreamOut::setLatencyModeCallback(
 };
 #endif
 
+Return<void> StreamOut::debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) {
+    (void)options;
+    if (!fd.getNativeHandle() || (fd->numFds < 1)) {
+        return Void();
+    }
+
+    std::string out = android::base::StringPrintf(
+        "StreamOut: ioHandle=%d device=%s format=%s sampleRate=%u channelMask=%s "
+        "frameCount=%llu volume=%.3f\n",
+        mCommon.m_ioHandle, mCommon.m_device.deviceType.c_str(),
+        mCommon.m_config.base.format.c_str(), mCommon.m_config.base.sampleRateHz,
+        mCommon.m_config.base.channelMask.c_str(),
+        (unsigned long long)mCommon.m_config.frameCount, getEffectiveVolume());
+    {
+        std::lock_guard<std::mutex> guard(mMutex);
+        if (const auto w = static_cast<WriteThread*>(mWriteThread.get())) {
+            w->dump(out);
+        }
+    }
+
+    android::base::WriteStringToFd(out, fd->data[0]);
+    return Void();
+}
+
 void StreamOut::setMasterVolume(float masterVolume) {
     std::lock_guard<std::mutex> guard(mMutex);
     mMasterVolume = masterVolume;
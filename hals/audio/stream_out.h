@@ -20,6 +20,7 @@
 #include PATH(android/hardware/audio/FILE_VERSION/IDevice.h)
 #include "stream_common.h"
 #include "io_thread.h"
+#include "mmap_stream.h"
 #include "primary_device.h"
 
 namespace android {
@@ -30,6 +31,7 @@ namespace implementation {
 
 using ::android::sp;
 using ::android::hardware::hidl_bitfield;
+using ::android::hardware::hidl_handle;
 using ::android::hardware::hidl_string;
 using ::android::hardware::hidl_vec;
 using ::android::hardware::Return;
@@ -102,6 +104,9 @@ struct StreamOut : public IStreamOut {
             const sp<IStreamOutLatencyModeCallback>& callback) override;
 #endif
 
+    // IBase
+    Return<void> debug(const hidl_handle& fd, const hidl_vec<hidl_string>& options) override;
+
     void setMasterVolume(float volume);
     float getEffectiveVolume() const { return mEffectiveVolume; }
     const DeviceAddress &getDeviceAddress() const { return mCommon.m_device; }
@@ -114,12 +119,17 @@ struct StreamOut : public IStreamOut {
 
 private:
     Result closeImpl(bool fromDctor);
+    // `closeImpl` could run on another binder thread, the snapshot keeps
+    // the stream alive while it is used.
+    std::shared_ptr<MmapStream> getMmapStream();
     void updateEffectiveVolumeLocked();
 
     sp<Device> mDev;
     const StreamCommon mCommon;
     const SourceMetadata mSourceMetadata;
+    // set and reset under mMutex, `debug` reads them from other threads
     std::unique_ptr<IOThread> mWriteThread;
+    std::shared_ptr<MmapStream> mMmapStream;
 
     float mMasterVolume = 1.0f;  // requires mMutex
     float mStreamVolume = 1.0f;  // requires mMutex
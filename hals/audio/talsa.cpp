@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <iterator>
 #include <mutex>
 #include <cutils/properties.h>
 #include <log/log.h>
@@ -34,6 +36,7 @@ int gMixerRefcounter0 = 0;
 std::mutex gMixerMutex;
 PcmPeriodSettings gPcmPeriodSettings;
 unsigned gPcmHostLatencyMs;
+unsigned gPcmRateHz;
 
 void mixerSetValueAll(struct mixer_ctl *ctl, int value) {
     const unsigned int n = mixer_ctl_get_num_values(ctl);
@@ -119,6 +122,10 @@ void init() {
 
     gPcmHostLatencyMs =
         readUnsignedProperty("ro.hardware.audio.tinyalsa.host_latency_ms", 0);
+
+    // 0 - the PCM runs at the stream rate
+    gPcmRateHz =
+        readUnsignedProperty("ro.hardware.audio.tinyalsa.pcm_rate_hz", 0);
 }
 
 PcmPeriodSettings pcmGetPcmPeriodSettings() {
@@ -129,6 +136,10 @@ unsigned pcmGetHostLatencyMs() {
     return gPcmHostLatencyMs;
 }
 
+unsigned pcmGetRateHz(const unsigned sampleRateHz) {
+    return gPcmRateHz ? gPcmRateHz : sampleRateHz;
+}
+
 void PcmDeleter::operator()(pcm_t *x) const {
     LOG_ALWAYS_FATAL_IF(::pcm_close(x) != 0);
 };
@@ -138,7 +149,8 @@ PcmPtr pcmOpen(const unsigned int dev,
                const unsigned int nChannels,
                const size_t sampleRateHz,
                const size_t frameCount,
-               const bool isOut) {
+               const bool isOut,
+               const audio_format_t format) {
     const PcmPeriodSettings periodSettings = pcmGetPcmPeriodSettings();
 
     struct pcm_config pcm_config;
@@ -151,7 +163,20 @@ PcmPtr pcmOpen(const unsigned int dev,
     // Approx frames between interrupts
     pcm_config.period_size =
         periodSettings.periodSizeMultiplier * frameCount / periodSettings.periodCount;
-    pcm_config.format = PCM_FORMAT_S16_LE;
+    switch (format) {
+    case AUDIO_FORMAT_PCM_16_BIT:
+        pcm_config.format = PCM_FORMAT_S16_LE;
+        break;
+    case AUDIO_FORMAT_PCM_24_BIT_PACKED:
+        pcm_config.format = PCM_FORMAT_S24_3LE;
+        break;
+    case AUDIO_FORMAT_PCM_FLOAT:
+        pcm_config.format = PCM_FORMAT_FLOAT_LE;
+        break;
+    default:
+        ALOGE("%s:%d unexpected format: %#x", __func__, __LINE__, format);
+        return FAILURE(nullptr);
+    }
     if (isOut) {
         pcm_config.start_threshold = pcm_config.period_size * (pcm_config.period_count - 1);
         pcm_config.stop_threshold = pcm_config.period_size * pcm_config.period_count;
@@ -187,6 +212,53 @@ PcmPtr pcmOpen(const unsigned int dev,
     return pcm;
 }
 
+PcmPtr pcmOpenNearest(const unsigned int dev,
+                      const unsigned int card,
+                      const unsigned int nChannels,
+                      unsigned &sampleRateHz,
+                      size_t &frameCount,
+                      const bool isOut,
+                      audio_format_t &format) {
+    const unsigned rates[] = { pcmGetRateHz(sampleRateHz), kFallbackPcmRateHz };
+    // the widest format first, then the narrower ones
+    const audio_format_t formats[] = {
+        AUDIO_FORMAT_PCM_FLOAT, AUDIO_FORMAT_PCM_24_BIT_PACKED, AUDIO_FORMAT_PCM_16_BIT
+    };
+    const size_t firstFormat =
+        std::find(std::begin(formats), std::end(formats), format) - std::begin(formats);
+    if (firstFormat == std::size(formats)) {
+        ALOGE("%s:%d unexpected format: %#x", __func__, __LINE__, format);
+        return FAILURE(nullptr);
+    }
+
+    for (size_t r = 0; r < std::size(rates); ++r) {
+        if ((r > 0) && (rates[r] == rates[0])) {
+            break;
+        }
+        // the same duration at the PCM rate
+        const size_t pcmFrameCount = frameCount * rates[r] / sampleRateHz;
+
+        for (size_t f = firstFormat; f < std::size(formats); ++f) {
+
+            PcmPtr pcm = pcmOpen(dev, card, nChannels, rates[r], pcmFrameCount,
+                                 isOut, formats[f]);
+            if (pcm) {
+                if ((rates[r] != sampleRateHz) || (formats[f] != format)) {
+                    ALOGW("%s:%d the PCM is opened with sampleRateHz=%u format=%#x "
+                          "instead of sampleRateHz=%u format=%#x", __func__, __LINE__,
+                          rates[r], formats[f], sampleRateHz, format);
+                }
+                sampleRateHz = rates[r];
+                frameCount = pcmFrameCount;
+                format = formats[f];
+                return pcm;
+            }
+        }
+    }
+
+    return FAILURE(nullptr);
+}
+
 int pcmRead(pcm_t *pcm, void *data, const int szBytes,
              const unsigned int frameSize) {
     LOG_ALWAYS_FATAL_IF(frameSize == 0);
@@ -16,6 +16,7 @@
 
 #pragma once
 #include <memory>
+#include <system/audio.h>
 #include <tinyalsa/asoundlib.h>
 
 namespace android {
@@ -27,6 +28,7 @@ namespace talsa {
 
 constexpr unsigned int kPcmDevice = 0;
 constexpr unsigned int kPcmCard = 0;
+constexpr unsigned int kFallbackPcmRateHz = 48000;
 
 struct PcmPeriodSettings {
     unsigned periodCount;
@@ -36,12 +38,21 @@ struct PcmPeriodSettings {
 void init();
 PcmPeriodSettings pcmGetPcmPeriodSettings();
 unsigned pcmGetHostLatencyMs();
+unsigned pcmGetRateHz(unsigned sampleRateHz);
 
 typedef struct pcm pcm_t;
 struct PcmDeleter { void operator()(pcm_t *x) const; };
 typedef std::unique_ptr<pcm_t, PcmDeleter> PcmPtr;
 PcmPtr pcmOpen(unsigned int dev, unsigned int card, unsigned int nChannels,
-               size_t sampleRateHz, size_t frameCount, bool isOut);
+               size_t sampleRateHz, size_t frameCount, bool isOut,
+               audio_format_t format);
+// Opens the PCM with the stream config if possible, otherwise with narrower
+// samples (float, then 24 bit packed, then 16 bit) and/or at
+// kFallbackPcmRateHz. `sampleRateHz`, `frameCount` and
+// `format` are updated to what the PCM was opened with.
+PcmPtr pcmOpenNearest(unsigned int dev, unsigned int card, unsigned int nChannels,
+                      unsigned &sampleRateHz, size_t &frameCount, bool isOut,
+                      audio_format_t &format);
 int pcmRead(pcm_t *pcm, void *data, int szBytes, unsigned int frameSize);
 int pcmWrite(pcm_t *pcm, const void *data, int szBytes, unsigned int frameSize);
 
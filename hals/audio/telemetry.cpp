@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cinttypes>
+#include <android-base/properties.h>
+#include <android-base/stringprintf.h>
+#include "telemetry.h"
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+namespace {
+
+size_t getBucket(const uint32_t valueUs) {
+    size_t i = 0;
+    for (uint32_t limit = Histogram::kFirstBucketUs;
+         (i < (Histogram::kBuckets - 1)) && (valueUs >= limit); limit *= 2) {
+        ++i;
+    }
+    return i;
+}
+
+uint32_t getBucketLimitUs(const size_t i) {
+    return Histogram::kFirstBucketUs << i;
+}
+
+}  // namespace
+
+void Histogram::add(const uint32_t valueUs) {
+    mBuckets[getBucket(valueUs)].fetch_add(1, std::memory_order_relaxed);
+    if (valueUs > mMaxUs.load(std::memory_order_relaxed)) {
+        mMaxUs.store(valueUs, std::memory_order_relaxed);
+    }
+}
+
+uint64_t Histogram::getCount() const {
+    uint64_t count = 0;
+    for (const auto &bucket : mBuckets) {
+        count += bucket.load(std::memory_order_relaxed);
+    }
+    return count;
+}
+
+uint32_t Histogram::getPercentileUs(const unsigned percent) const {
+    const uint64_t count = getCount();
+    if (!count) {
+        return 0;
+    }
+
+    const uint64_t rank = (count * percent + 99) / 100;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < (kBuckets - 1); ++i) {
+        sum += mBuckets[i].load(std::memory_order_relaxed);
+        if (sum >= rank) {
+            return getBucketLimitUs(i);
+        }
+    }
+    return getMaxUs();
+}
+
+void Histogram::dump(std::string &out, const char *name) const {
+    android::base::StringAppendF(
+        &out, "    %s: n=%" PRIu64 " p50<%uus p99<%uus max=%uus [",
+        name, getCount(), getPercentileUs(50), getPercentileUs(99), getMaxUs());
+
+    for (size_t i = 0; i < kBuckets; ++i) {
+        const uint64_t n = mBuckets[i].load(std::memory_order_relaxed);
+        if (n) {
+            android::base::StringAppendF(&out, " %s%uus:%" PRIu64,
+                                         (i < (kBuckets - 1)) ? "<" : ">=",
+                                         getBucketLimitUs(std::min(i, kBuckets - 2)), n);
+        }
+    }
+    out += " ]\n";
+}
+
+unsigned getTelemetryLogPeriodS() {
+    return ::android::base::GetUintProperty<unsigned>(
+        "ro.hardware.audio.telemetry_log_period_s", 0);
+}
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
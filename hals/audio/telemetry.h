@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+#include <array>
+#include <atomic>
+#include <string>
+#include <stdint.h>
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+
+// Durations in power of two buckets: <125us, <250us, ... <128ms, >=128ms.
+// `add` is wait-free, one thread adds while others dump.
+struct Histogram {
+    static constexpr size_t kBuckets = 12;
+    static constexpr uint32_t kFirstBucketUs = 125;
+
+    void add(uint32_t valueUs);
+    uint64_t getCount() const;
+    // The upper bound of the bucket holding the percentile.
+    uint32_t getPercentileUs(unsigned percent) const;
+    uint32_t getMaxUs() const { return mMaxUs.load(std::memory_order_relaxed); }
+
+    // One line: the count, p50, p99, max and the non empty buckets.
+    void dump(std::string &out, const char *name) const;
+
+private:
+    std::array<std::atomic<uint64_t>, kBuckets> mBuckets = {};
+    std::atomic<uint32_t> mMaxUs = 0;
+};
+
+// ro.hardware.audio.telemetry_log_period_s, 0 (default) disables the
+// periodic telemetry log.
+unsigned getTelemetryLogPeriodS();
+
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2025 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <string.h>
+
+#include <gtest/gtest.h>
+
+#include "../ring_buffer.h"
+
+namespace android {
+namespace hardware {
+namespace audio {
+namespace CPP_VERSION {
+namespace implementation {
+namespace {
+
+// The stream is a sequence of uint32_t counters, the sizes below keep every
+// chunk a whole number of them.
+constexpr size_t kCapacity = 4 * 1021;  // not a power of two, wraps at odd offsets
+constexpr uint32_t kNumValues = 4000000;
+constexpr auto kWait = std::chrono::milliseconds(100);
+
+RingBuffer::Timepoint deadline() {
+    return std::chrono::high_resolution_clock::now() + kWait;
+}
+
+size_t randomValues(std::mt19937 &rng, const size_t maxValues) {
+    return std::uniform_int_distribution<size_t>(1, maxValues)(rng);
+}
+
+// Without drops every value comes out once and in order.
+TEST(RingBufferTest, ProduceConsumeInOrder) {
+    RingBuffer ring(kCapacity);
+
+    std::thread producer([&ring]() {
+        std::mt19937 rng(1);
+        std::vector<uint32_t> buf(kCapacity / 4);
+        uint32_t next = 0;
+        while (next < kNumValues) {
+            if (!ring.waitForProduceAvailable(deadline())) {
+                continue;
+            }
+
+            size_t n = std::min<size_t>(randomValues(rng, buf.size()), kNumValues - next);
+            if (rng() & 1) {  // straight into the ring
+                const auto chunk = ring.getProduceChunk();
+                n = std::min(n, chunk.size / 4);
+                uint32_t *const dst = static_cast<uint32_t *>(chunk.data);
+                for (size_t i = 0; i < n; ++i) {
+                    dst[i] = next + i;
+                }
+                ASSERT_EQ(ring.produce(n * 4), n * 4);
+            } else {
+                for (size_t i = 0; i < n; ++i) {
+                    buf[i] = next + i;
+                }
+                n = ring.produce(buf.data(), n * 4) / 4;
+            }
+            next += n;
+        }
+    });
+
+    std::mt19937 rng(2);
+    uint32_t expected = 0;
+    while (expected < kNumValues) {
+        if (!ring.waitForConsumeAvailable(deadline())) {
+            continue;
+        }
+
+        const auto chunk = ring.getConsumeChunk();
+        ASSERT_EQ(chunk.size % 4, 0U);
+        const size_t n = std::min(chunk.size / 4, randomValues(rng, kCapacity / 4));
+        const uint32_t *const src = static_cast<const uint32_t *>(chunk.data);
+        for (size_t i = 0; i < n; ++i) {
+            ASSERT_EQ(src[i], expected);
+            ++expected;
+        }
+        ASSERT_EQ(ring.consume(chunk, n * 4), n * 4);
+    }
+
+    producer.join();
+    EXPECT_EQ(ring.availableToConsume(), 0U);
+}
+
+// The producer drops the oldest data while the consumer holds (pins) chunks
+// for a while. The pinned chunk must not change, what comes out is in order
+// and everything produced is either consumed or dropped.
+TEST(RingBufferTest, DropOldestKeepsPinnedChunk) {
+    RingBuffer ring(kCapacity);
+    std::atomic<bool> producerDone = false;
+    uint64_t droppedBytes = 0;
+
+    std::thread producer([&]() {
+        std::mt19937 rng(3);
+        uint32_t next = 0;
+        while (next < kNumValues) {
+            const size_t n = std::min<size_t>(randomValues(rng, kCapacity / 8),
+                                              kNumValues - next);
+            droppedBytes += ring.makeRoomForProduce(n * 4);
+
+            // the pinned chunk could still be in the way, only part could fit
+            for (size_t left = n; left > 0; ) {
+                const auto chunk = ring.getProduceChunk();
+                const size_t m = std::min(left, chunk.size / 4);
+                if (!m) {
+                    ring.waitForProduceAvailable(deadline());
+                    continue;
+                }
+
+                uint32_t *const dst = static_cast<uint32_t *>(chunk.data);
+                for (size_t i = 0; i < m; ++i) {
+                    dst[i] = next + i;
+                }
+                ASSERT_EQ(ring.produce(m * 4), m * 4);
+                next += m;
+                left -= m;
+            }
+        }
+        producerDone = true;
+    });
+
+    std::mt19937 rng(4);
+    std::vector<uint32_t> copy(kCapacity / 4);
+    uint64_t consumedBytes = 0;
+    int64_t last = -1;
+    while (!producerDone || ring.availableToConsume()) {
+        if (!ring.waitForConsumeAvailable(deadline())) {
+            continue;
+        }
+
+        const auto chunk = ring.getConsumeChunk();
+        ASSERT_EQ(chunk.size % 4, 0U);
+        const size_t n = chunk.size / 4;
+        memcpy(copy.data(), chunk.data, n * 4);
+        if (!(rng() % 8)) {
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+        ASSERT_EQ(memcmp(copy.data(), chunk.data, n * 4), 0);
+
+        for (size_t i = 0; i < n; ++i) {
+            ASSERT_GT(int64_t(copy[i]), last);
+            last = copy[i];
+        }
+        consumedBytes += ring.consume(chunk, n * 4);
+    }
+
+    producer.join();
+    EXPECT_EQ(last, int64_t(kNumValues) - 1);
+    // the consumer counts the bytes dropped while it held them as consumed
+    EXPECT_GE(consumedBytes + droppedBytes, uint64_t(kNumValues) * 4);
+    EXPECT_LE(consumedBytes, uint64_t(kNumValues) * 4);
+}
+
+// Wakes the waiting side on the other thread many times, a lost wakeup
+// would stall the test for `kWait`.
+TEST(RingBufferTest, PingPong) {
+    RingBuffer ping(64);
+    RingBuffer pong(64);
+    constexpr int kRounds = 20000;
+    std::atomic<int> timeouts = 0;
+
+    std::thread echo([&]() {
+        for (int i = 0; i < kRounds; ++i) {
+            while (!ping.waitForConsumeAvailable(deadline())) {
+                ++timeouts;
+            }
+            const auto chunk = ping.getConsumeChunk();
+            ASSERT_EQ(pong.produce(chunk.data, chunk.size), chunk.size);
+            ping.consume(chunk, chunk.size);
+        }
+    });
+
+    for (int i = 0; i < kRounds; ++i) {
+        ASSERT_EQ(ping.produce(&i, sizeof(i)), sizeof(i));
+        while (!pong.waitForConsumeAvailable(deadline())) {
+            ++timeouts;
+        }
+        const auto chunk = pong.getConsumeChunk();
+        ASSERT_EQ(chunk.size, sizeof(i));
+        int value;
+        memcpy(&value, chunk.data, sizeof(value));
+        ASSERT_EQ(value, i);
+        pong.consume(chunk, chunk.size);
+    }
+
+    echo.join();
+    EXPECT_EQ(timeouts, 0);
+}
+
+}  // namespace
+}  // namespace implementation
+}  // namespace CPP_VERSION
+}  // namespace audio
+}  // namespace hardware
+}  // namespace android
@@ -41,8 +41,9 @@ using ::android::hardware::audio::CORE_TYPES_CPP_VERSION::AudioMicrophoneDirecti
 
 namespace {
 
-const std::array<uint32_t, 8> kSupportedRatesHz = {
-    8000, 11025, 16000, 22050, 32000, 44100, 48000
+// the rates the PCM does not run at are resampled, see talsa::pcmOpenNearest
+const std::array<uint32_t, 11> kSupportedRatesHz = {
+    8000, 11025, 12000, 16000, 22050, 24000, 32000, 44100, 48000, 88200, 96000
 };
 
 bool checkSampleRateHz(uint32_t value, uint32_t &suggested) {
@@ -77,12 +78,10 @@ bool checkChannelMask(const bool isOut,
 }
 
 bool checkFormat(const AudioFormat &value, AudioFormat &suggested) {
-    switch (xsd::stringToAudioFormat(value)) {
-    case xsd::AudioFormat::AUDIO_FORMAT_PCM_16_BIT:
+    if (getPcmFormat(value) != AUDIO_FORMAT_INVALID) {
         suggested = value;
         return true;
-
-    default:
+    } else {
         suggested = toString(xsd::AudioFormat::AUDIO_FORMAT_PCM_16_BIT);
         return FAILURE(false);
     }
@@ -124,14 +123,28 @@ size_t countChannels(const AudioChannelMask &mask) {
 }
 
 size_t getBytesPerSample(const AudioFormat &format) {
-    if (format == "AUDIO_FORMAT_PCM_16_BIT") {
-        return 2;
+    const audio_format_t pcmFormat = getPcmFormat(format);
+    if (pcmFormat != AUDIO_FORMAT_INVALID) {
+        return audio_bytes_per_sample(pcmFormat);
     } else {
         ALOGE("util::%s:%d unknown format, '%s'", __func__, __LINE__, format.c_str());
         return 0;
     }
 }
 
+audio_format_t getPcmFormat(const AudioFormat &format) {
+    switch (xsd::stringToAudioFormat(format)) {
+    case xsd::AudioFormat::AUDIO_FORMAT_PCM_16_BIT:
+        return AUDIO_FORMAT_PCM_16_BIT;
+    case xsd::AudioFormat::AUDIO_FORMAT_PCM_24_BIT_PACKED:
+        return AUDIO_FORMAT_PCM_24_BIT_PACKED;
+    case xsd::AudioFormat::AUDIO_FORMAT_PCM_FLOAT:
+        return AUDIO_FORMAT_PCM_FLOAT;
+    default:
+        return AUDIO_FORMAT_INVALID;
+    }
+}
+
 bool checkAudioConfig(const AudioConfig &cfg) {
     if (xsd::isUnknownAudioFormat(cfg.base.format)
             || xsd::isUnknownAudioChannelMask(cfg.base.channelMask)) {
@@ -20,6 +20,7 @@
 #include PATH(android/hardware/audio/CORE_TYPES_FILE_VERSION/types.h)
 #include <utils/Timers.h>
 #include <cutils/sched_policy.h>
+#include <system/audio.h>
 
 namespace android {
 namespace hardware {
@@ -41,6 +42,8 @@ MicrophoneInfo getMicrophoneInfo();
 
 size_t countChannels(const AudioChannelMask &mask);
 size_t getBytesPerSample(const AudioFormat &format);
+// Returns AUDIO_FORMAT_INVALID for formats the sinks and sources can't handle.
+audio_format_t getPcmFormat(const AudioFormat &format);
 
 bool checkAudioConfig(const AudioConfig &cfg);
 bool checkAudioConfig(bool isOut,
@@ -18,6 +18,7 @@
 
 #include <inttypes.h>
 #include <cstdlib>
+#include <iterator>
 
 #include <log/log.h>
 #include <system/camera_metadata.h>
@@ -199,37 +200,55 @@ CameraMetadata BaseQemuCamera::applyMetadata(const CameraMetadata& metadata) {
     mExposureComp = calculateExposureComp(mSensorExposureDurationNs,
                                           mSensorSensitivity, mAperture);
 
-    CameraMetadataMap m = parseCameraMetadataMap(metadata);
-
-    m[ANDROID_COLOR_CORRECTION_GAINS] = kColorCorrectionGains;
-    m[ANDROID_COLOR_CORRECTION_TRANSFORM] = kColorCorrectionTransform;
-    m[ANDROID_CONTROL_AE_STATE] = uint8_t(ANDROID_CONTROL_AE_STATE_CONVERGED);
-    m[ANDROID_CONTROL_AF_STATE] = uint8_t(af.first);
-    m[ANDROID_CONTROL_AWB_STATE] = uint8_t(ANDROID_CONTROL_AWB_STATE_CONVERGED);
-    m[ANDROID_FLASH_STATE] = uint8_t(ANDROID_FLASH_STATE_UNAVAILABLE);
-    m[ANDROID_LENS_APERTURE] = mAperture;
-    m[ANDROID_LENS_FOCUS_DISTANCE] = af.second;
-    m[ANDROID_LENS_STATE] = uint8_t(getAfLensState(af.first));
-    m[ANDROID_REQUEST_PIPELINE_DEPTH] = uint8_t(4);
-    m[ANDROID_SENSOR_FRAME_DURATION] = mFrameDurationNs;
-    m[ANDROID_SENSOR_EXPOSURE_TIME] = mSensorExposureDurationNs;
-    m[ANDROID_SENSOR_SENSITIVITY] = mSensorSensitivity;
-    m[ANDROID_SENSOR_TIMESTAMP] = int64_t(0);
-    m[ANDROID_SENSOR_NEUTRAL_COLOR_POINT] = kNeutralColorPoint;
-    m[ANDROID_SENSOR_NOISE_PROFILE] = kSensorNoiseProfile;
-    m[ANDROID_SENSOR_ROLLING_SHUTTER_SKEW] = kMinSensorExposureTimeNs;
-    m[ANDROID_STATISTICS_SCENE_FLICKER] = uint8_t(ANDROID_STATISTICS_SCENE_FLICKER_NONE);
-
-    if (!find_camera_metadata_ro_entry(raw, ANDROID_STATISTICS_LENS_SHADING_MAP_MODE, &entry)
-        && (entry.data.u8[0] == ANDROID_STATISTICS_LENS_SHADING_MAP_MODE_ON)) {
-        m[ANDROID_STATISTICS_LENS_SHADING_MAP] = kLensShadingMap;
-    }
+    const uint8_t aeState = ANDROID_CONTROL_AE_STATE_CONVERGED;
+    const uint8_t afState = af.first;
+    const uint8_t awbState = ANDROID_CONTROL_AWB_STATE_CONVERGED;
+    const uint8_t flashState = ANDROID_FLASH_STATE_UNAVAILABLE;
+    const float focusDistance = af.second;
+    const uint8_t lensState = getAfLensState(af.first);
+    const uint8_t pipelineDepth = getPipelineMaxDepth();
+    const int64_t sensorTimestamp = 0;
+    const uint8_t sceneFlicker = ANDROID_STATISTICS_SCENE_FLICKER_NONE;
+
+    const CameraMetadataRef results[] = {
+        {ANDROID_COLOR_CORRECTION_GAINS, kColorCorrectionGains},
+        {ANDROID_COLOR_CORRECTION_TRANSFORM, kColorCorrectionTransform},
+        {ANDROID_CONTROL_AE_STATE, aeState},
+        {ANDROID_CONTROL_AF_STATE, afState},
+        {ANDROID_CONTROL_AWB_STATE, awbState},
+        {ANDROID_FLASH_STATE, flashState},
+        {ANDROID_LENS_APERTURE, mAperture},
+        {ANDROID_LENS_FOCUS_DISTANCE, focusDistance},
+        {ANDROID_LENS_STATE, lensState},
+        {ANDROID_REQUEST_PIPELINE_DEPTH, pipelineDepth},
+        {ANDROID_SENSOR_FRAME_DURATION, mFrameDurationNs},
+        {ANDROID_SENSOR_EXPOSURE_TIME, mSensorExposureDurationNs},
+        {ANDROID_SENSOR_SENSITIVITY, mSensorSensitivity},
+        {ANDROID_SENSOR_TIMESTAMP, sensorTimestamp},
+        {ANDROID_SENSOR_NEUTRAL_COLOR_POINT, kNeutralColorPoint},
+        {ANDROID_SENSOR_NOISE_PROFILE, kSensorNoiseProfile},
+        {ANDROID_SENSOR_ROLLING_SHUTTER_SKEW, kMinSensorExposureTimeNs},
+        {ANDROID_STATISTICS_SCENE_FLICKER, sceneFlicker},
+        {ANDROID_STATISTICS_LENS_SHADING_MAP, kLensShadingMap},  // must be the last
+    };
+
+    const bool lensShadingMapOn =
+        !find_camera_metadata_ro_entry(raw, ANDROID_STATISTICS_LENS_SHADING_MAP_MODE, &entry)
+        && (entry.data.u8[0] == ANDROID_STATISTICS_LENS_SHADING_MAP_MODE_ON);
+    const size_t nResults = std::size(results) - (lensShadingMapOn ? 0 : 1);
 
-    std::optional<CameraMetadata> maybeSerialized =
-        serializeCameraMetadataMap(m);
+    // Repeating requests usually carry the same tags, only the values which
+    // changed are patched into the previous result. Otherwise it is rebuilt.
+    if (!metadataUpdateInPlace(&mCaptureResultMetadata, metadata, results, nResults)) {
+        CameraMetadataMap m = parseCameraMetadataMap(metadata);
+        addCameraMetadataRefs(&m, results, nResults);
 
-    if (maybeSerialized) {
-        mCaptureResultMetadata = std::move(maybeSerialized.value());
+        std::optional<CameraMetadata> maybeSerialized =
+            serializeCameraMetadataMap(m);
+
+        if (maybeSerialized) {
+            mCaptureResultMetadata = std::move(maybeSerialized.value());
+        }
     }
 
     {   // reset ANDROID_CONTROL_AF_TRIGGER to IDLE
@@ -280,7 +299,7 @@ CameraMetadata BaseQemuCamera::updateCaptureResultMetadata() {
               kClass, __func__, __LINE__);
     }
 
-    return metadataCompact(mCaptureResultMetadata);
+    return mCaptureResultMetadata;  // compact, see applyMetadata
 }
 
 ////////////////////////////////////////////////////////////////////////////////
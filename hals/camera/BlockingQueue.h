@@ -29,15 +29,21 @@ namespace implementation {
 
 template <class T> struct BlockingQueue {
     BlockingQueue() = default;
+    // `put` blocks while the queue holds `capacity` elements, 0 is unbounded
+    explicit BlockingQueue(size_t maxSize) : capacity(maxSize) {}
 
     bool put(T* x)  {
-        std::lock_guard lock(mtx);
-        if (cancelled) {
-            return false;
-        } else {
-            queue.push_back(std::move(*x));
-            available.notify_one();
-            return true;
+        std::unique_lock lock(mtx);
+        while (true) {
+            if (cancelled) {
+                return false;
+            } else if (!capacity || (queue.size() < capacity)) {
+                queue.push_back(std::move(*x));
+                available.notify_one();
+                return true;
+            } else {
+                notFull.wait(lock);
+            }
         }
     }
 
@@ -47,6 +53,7 @@ template <class T> struct BlockingQueue {
             if (!queue.empty()) {
                 T x = std::move(queue.front());
                 queue.pop_front();
+                notFull.notify_one();
                 return x;
             } else if (cancelled) {
                 return std::nullopt;
@@ -63,14 +70,21 @@ template <class T> struct BlockingQueue {
         } else {
             T x = std::move(queue.front());
             queue.pop_front();
+            notFull.notify_one();
             return x;
         }
     }
 
+    size_t size() {
+        std::lock_guard lock(mtx);
+        return queue.size();
+    }
+
     void cancel() {
         std::lock_guard lock(mtx);
         cancelled = true;
-        available.notify_one();
+        available.notify_all();
+        notFull.notify_all();
     }
 
     BlockingQueue(const BlockingQueue&) = delete;
@@ -81,6 +95,8 @@ template <class T> struct BlockingQueue {
 private:
     std::deque<T> queue;
     std::condition_variable available;
+    std::condition_variable notFull;
+    const size_t capacity = 0;
     bool cancelled = false;
     std::mutex mtx;
 };
@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2025 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ui/GraphicBufferAllocator.h>
+
+#include "BufferPool.h"
+#include "debug.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace provider {
+namespace implementation {
+
+BufferPool::BufferPool(const Rect<uint16_t> size,
+                       const PixelFormat format,
+                       const BufferUsage usage,
+                       const size_t capacity,
+                       const char* const name)
+        : mSize(size)
+        , mFormat(format)
+        , mUsage(usage)
+        , mCapacity(capacity)
+        , mName(name) {
+    mFree.reserve(capacity);
+}
+
+BufferPool::~BufferPool() {
+    GraphicBufferAllocator& gba = GraphicBufferAllocator::get();
+    for (const native_handle_t* buffer : mFree) {
+        gba.free(buffer);
+    }
+}
+
+const native_handle_t* BufferPool::acquire() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mFree.empty()) {
+            const native_handle_t* buffer = mFree.back();
+            mFree.pop_back();
+            return buffer;
+        }
+    }
+
+    // first use, or more buffers in flight than the framework promised
+    return allocate();
+}
+
+void BufferPool::release(const native_handle_t* buffer) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mFree.size() < mCapacity) {
+            mFree.push_back(buffer);
+            return;
+        }
+    }
+
+    GraphicBufferAllocator::get().free(buffer);
+}
+
+const native_handle_t* BufferPool::allocate() const {
+    const native_handle_t* buffer;
+    uint32_t stride;
+    if (GraphicBufferAllocator::get().allocate(
+            mSize.width, mSize.height, static_cast<int>(mFormat), 1,
+            static_cast<uint64_t>(mUsage), &buffer, &stride, mName) == NO_ERROR) {
+        return buffer;
+    } else {
+        return FAILURE(nullptr);
+    }
+}
+
+}  // namespace implementation
+}  // namespace provider
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
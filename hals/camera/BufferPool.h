@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2025 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <aidl/android/hardware/graphics/common/BufferUsage.h>
+#include <aidl/android/hardware/graphics/common/PixelFormat.h>
+#include <cutils/native_handle.h>
+
+#include "Rect.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace provider {
+namespace implementation {
+
+using aidl::android::hardware::graphics::common::BufferUsage;
+using aidl::android::hardware::graphics::common::PixelFormat;
+
+// Intermediate gralloc buffers (e.g. the host captures into them before
+// compressing), allocated on first use and reused across requests, up to
+// `capacity` are kept. Delayed buffers keep the pool alive past the
+// camera's `close()`.
+struct BufferPool {
+    BufferPool(Rect<uint16_t> size, PixelFormat format, BufferUsage usage,
+               size_t capacity, const char* name);
+    ~BufferPool();
+
+    const native_handle_t* acquire();  // nullptr if out of memory
+    void release(const native_handle_t* buffer);
+
+private:
+    const native_handle_t* allocate() const;
+
+    const Rect<uint16_t> mSize;
+    const PixelFormat mFormat;
+    const BufferUsage mUsage;
+    const size_t mCapacity;
+    const char* const mName;
+    std::vector<const native_handle_t*> mFree;
+    std::mutex mMutex;
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+};
+
+}  // namespace implementation
+}  // namespace provider
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
@@ -18,6 +18,7 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
 #include <chrono>
 #include <memory>
 
@@ -54,6 +55,15 @@ constexpr char kClass[] = "CameraDeviceSession";
 
 constexpr int64_t kOneSecondNs = 1000000000;
 constexpr size_t kMsgQueueSize = 256 * 1024;
+constexpr unsigned kMaxDelayedCaptureThreads = 4;
+// the capture thread blocks if JPEG compression falls this far behind
+constexpr size_t kDelayedCaptureQueueSize = 8;
+
+// The capture thread and the result thread hold one frame each, the rest of
+// the pipeline (HwCamera::getPipelineMaxDepth) waits between them.
+size_t getCapturedFramesQueueSize(const int32_t pipelineMaxDepth) {
+    return std::max(pipelineMaxDepth - 2, 1);
+}
 
 struct timespec timespecAddNanos(const struct timespec t, const int64_t addNs) {
     const lldiv_t r = lldiv(t.tv_nsec + addNs, kOneSecondNs);
@@ -146,20 +156,40 @@ CameraDeviceSession::CameraDeviceSession(
          , mCb(std::move(cb))
          , mHwCamera(hwCamera)
          , mRequestQueue(kMsgQueueSize, false)
-         , mResultQueue(kMsgQueueSize, false) {
+         , mResultQueue(kMsgQueueSize, false)
+         , mCapturedFrames(getCapturedFramesQueueSize(hwCamera.getPipelineMaxDepth()))
+         , mDelayedCaptureResults(kDelayedCaptureQueueSize) {
     LOG_ALWAYS_FATAL_IF(!mRequestQueue.isValid());
     LOG_ALWAYS_FATAL_IF(!mResultQueue.isValid());
+    // captureOneFrame checks mResultThread
+    if (mHwCamera.getPipelineMaxDepth() > 1) {
+        mResultThread = std::thread(&CameraDeviceSession::resultThreadLoop, this);
+    }
     mCaptureThread = std::thread(&CameraDeviceSession::captureThreadLoop, this);
-    mDelayedCaptureThread = std::thread(&CameraDeviceSession::delayedCaptureThreadLoop, this);
+
+    const unsigned nDelayedCaptureThreads =
+        std::clamp(std::thread::hardware_concurrency() / 2, 1U, kMaxDelayedCaptureThreads);
+    for (unsigned i = 0; i < nDelayedCaptureThreads; ++i) {
+        mDelayedCaptureThreads.emplace_back(&CameraDeviceSession::delayedCaptureThreadLoop, this);
+    }
 }
 
 CameraDeviceSession::~CameraDeviceSession() {
     closeImpl();
 
+    // One stage at a time: the capture thread must not see mCapturedFrames
+    // cancelled (only the result thread calls returnCapturedFrame then) and
+    // the frames it has queued are still returned.
     mCaptureRequests.cancel();
-    mDelayedCaptureResults.cancel();
     mCaptureThread.join();
-    mDelayedCaptureThread.join();
+    mCapturedFrames.cancel();
+    if (mResultThread.joinable()) {
+        mResultThread.join();
+    }
+    mDelayedCaptureResults.cancel();
+    for (std::thread& t : mDelayedCaptureThreads) {
+        t.join();
+    }
 }
 
 ScopedAStatus CameraDeviceSession::close() {
@@ -313,6 +343,7 @@ void CameraDeviceSession::closeImpl() {
     flushImpl(std::chrono::steady_clock::now());
     mHwCamera.close();
     mStreamBufferCache.clear();
+    logDelayedCaptureStats();
 }
 
 void CameraDeviceSession::flushImpl(const std::chrono::steady_clock::time_point start) {
@@ -528,36 +559,82 @@ struct timespec CameraDeviceSession::captureOneFrame(struct timespec nextFrameT,
         nextFrameT = now;
     }
 
-    const int32_t frameNumber = req.frameNumber;
-
     auto [frameDurationNs, exposureDurationNs, metadata,
           outputBuffers, delayedOutputBuffers] =
         mHwCamera.processCaptureRequest(std::move(req.metadataUpdate),
                                         {req.buffers.begin(), req.buffers.end()});
 
-    for (hw::DelayedStreamBuffer& dsb : delayedOutputBuffers) {
+    CapturedFrame frame;
+    frame.metadata = std::move(metadata);
+    frame.outputBuffers = std::move(outputBuffers);
+    frame.delayedOutputBuffers = std::move(delayedOutputBuffers);
+    frame.shutterTimestampNs = timespec2nanos(nextFrameT);
+    frame.exposureDurationNs = exposureDurationNs;
+    frame.frameNumber = req.frameNumber;
+    frame.ok = (frameDurationNs > 0);
+
+    // blocks if the pipeline is full, the next frame is captured while
+    // the result thread returns this one. mCapturedFrames is cancelled only
+    // after this thread exits, see ~CameraDeviceSession.
+    if (!mResultThread.joinable()) {
+        returnCapturedFrame(std::move(frame));
+    } else if (!mCapturedFrames.put(&frame)) {
+        LOG_ALWAYS_FATAL("%s:%s:%d mCapturedFrames is cancelled", kClass, __func__, __LINE__);
+    }
+
+    if (frameDurationNs > 0) {
+        nextFrameT = timespecAddNanos(nextFrameT, frameDurationNs);
+    }
+
+    return nextFrameT;
+}
+
+void CameraDeviceSession::resultThreadLoop() {
+    setThreadPriority(SP_FOREGROUND, ANDROID_PRIORITY_VIDEO);
+
+    while (true) {
+        std::optional<CapturedFrame> maybeFrame = mCapturedFrames.get();
+        if (maybeFrame.has_value()) {
+            returnCapturedFrame(std::move(maybeFrame.value()));
+        } else {
+            break;
+        }
+    }
+}
+
+void CameraDeviceSession::returnCapturedFrame(CapturedFrame frame) {
+    const int32_t frameNumber = frame.frameNumber;
+    const int64_t shutterTimestampNs = frame.shutterTimestampNs;
+
+    // the shutter goes before any buffer of the frame, including delayed ones
+    notifyShutter(&*mCb, frameNumber, shutterTimestampNs,
+                  shutterTimestampNs + frame.exposureDurationNs);
+
+    for (hw::DelayedStreamBuffer& dsb : frame.delayedOutputBuffers) {
         DelayedCaptureResult dcr;
         dcr.delayedBuffer = std::move(dsb);
         dcr.frameNumber = frameNumber;
-        if (!mDelayedCaptureResults.put(&dcr)) {
+        dcr.seq = mDelayedNextSeq;
+        // blocks if the queue is full
+        if (mDelayedCaptureResults.put(&dcr)) {
+            ++mDelayedNextSeq;
+            const uint32_t depth = mDelayedCaptureResults.size();
+            if (depth > mDelayedQueueMaxDepth.load(std::memory_order_relaxed)) {
+                mDelayedQueueMaxDepth.store(depth, std::memory_order_relaxed);
+            }
+        } else {
             // `delayedBuffer(false)` only releases the buffer (fast).
-            outputBuffers.push_back(dcr.delayedBuffer(false));
+            frame.outputBuffers.push_back(dcr.delayedBuffer(false));
         }
     }
 
-    const int64_t shutterTimestampNs = timespec2nanos(nextFrameT);
-    notifyShutter(&*mCb, frameNumber, shutterTimestampNs, shutterTimestampNs + exposureDurationNs);
-    metadataSetShutterTimestamp(&metadata, shutterTimestampNs);
+    metadataSetShutterTimestamp(&frame.metadata, shutterTimestampNs);
     consumeCaptureResult(makeCaptureResult(frameNumber,
-        std::move(metadata), std::move(outputBuffers)));
+        std::move(frame.metadata), std::move(frame.outputBuffers)));
 
-    if (frameDurationNs > 0) {
-        nextFrameT = timespecAddNanos(nextFrameT, frameDurationNs);
-    } else {
+    if (!frame.ok) {
         notifyError(&*mCb, frameNumber, -1, ErrorCode::ERROR_DEVICE);
     }
-
-    return nextFrameT;
 }
 
 void CameraDeviceSession::delayedCaptureThreadLoop() {
@@ -566,19 +643,62 @@ void CameraDeviceSession::delayedCaptureThreadLoop() {
         if (maybeDCR.has_value()) {
             const DelayedCaptureResult& dcr = maybeDCR.value();
 
-            // `dcr.delayedBuffer(true)` is expected to be slow, so we do not
-            // produce too much IPC traffic here. This also returns buffes to
-            // the framework earlier to reuse in capture requests.
-            std::vector<StreamBuffer> outputBuffers(1);
-            outputBuffers.front() = dcr.delayedBuffer(!mFlushing);
-            consumeCaptureResult(makeCaptureResult(dcr.frameNumber,
-                {}, std::move(outputBuffers)));
+            const auto start = std::chrono::steady_clock::now();
+            StreamBuffer sb = dcr.delayedBuffer(!mFlushing);
+            const uint32_t us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+
+            mDelayedBuffersProcessed.fetch_add(1, std::memory_order_relaxed);
+            mDelayedBuffersTotalUs.fetch_add(us, std::memory_order_relaxed);
+            uint32_t maxUs = mDelayedBuffersMaxUs.load(std::memory_order_relaxed);
+            while ((us > maxUs) &&
+                   !mDelayedBuffersMaxUs.compare_exchange_weak(maxUs, us,
+                                                               std::memory_order_relaxed)) {}
+
+            returnDelayedCaptureResult(dcr.seq, dcr.frameNumber, std::move(sb));
         } else {
             break;
         }
     }
 }
 
+// Returns the results in the order they were queued, `seq` might have to wait
+// for the older ones still being processed.
+void CameraDeviceSession::returnDelayedCaptureResult(const uint64_t seq,
+                                                     const int frameNumber,
+                                                     StreamBuffer sb) {
+    std::lock_guard<std::mutex> guard(mDelayedReadyResultsMtx);
+    mDelayedReadyResults.insert({seq, {frameNumber, std::move(sb)}});
+
+    while (!mDelayedReadyResults.empty() &&
+           (mDelayedReadyResults.begin()->first == mDelayedReturnSeq)) {
+        auto& [readyFrameNumber, readySb] = mDelayedReadyResults.begin()->second;
+
+        // One buffer per result, so we do not produce too much IPC traffic
+        // here. This also returns buffers to the framework earlier to reuse
+        // in capture requests.
+        std::vector<StreamBuffer> outputBuffers(1);
+        outputBuffers.front() = std::move(readySb);
+        consumeCaptureResult(makeCaptureResult(readyFrameNumber,
+            {}, std::move(outputBuffers)));
+
+        mDelayedReadyResults.erase(mDelayedReadyResults.begin());
+        ++mDelayedReturnSeq;
+    }
+}
+
+void CameraDeviceSession::logDelayedCaptureStats() {
+    const uint64_t n = mDelayedBuffersProcessed.exchange(0, std::memory_order_relaxed);
+    const uint64_t totalUs = mDelayedBuffersTotalUs.exchange(0, std::memory_order_relaxed);
+    const uint32_t maxUs = mDelayedBuffersMaxUs.exchange(0, std::memory_order_relaxed);
+    const uint32_t maxDepth = mDelayedQueueMaxDepth.exchange(0, std::memory_order_relaxed);
+    if (n) {
+        ALOGI("%s:%s:%d delayed buffers: n=%" PRIu64 " avg=%" PRIu64 "us max=%uus "
+              "maxQueueDepth=%u threads=%zu", kClass, __func__, __LINE__,
+              n, totalUs / n, maxUs, maxDepth, mDelayedCaptureThreads.size());
+    }
+}
+
 void CameraDeviceSession::disposeCaptureRequest(HwCaptureRequest req) {
     notifyError(&*mCb, req.frameNumber, -1, ErrorCode::ERROR_REQUEST);
 
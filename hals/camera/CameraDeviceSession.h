@@ -18,6 +18,7 @@
 
 #include <chrono>
 #include <deque>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <optional>
@@ -106,6 +107,19 @@ private:
     struct DelayedCaptureResult {
         hw::DelayedStreamBuffer delayedBuffer;
         int frameNumber;
+        uint64_t seq;  // results are returned in this order
+    };
+
+    // A frame the camera has captured, its results are returned by
+    // resultThreadLoop while the next frame is being captured.
+    struct CapturedFrame {
+        CameraMetadata metadata;
+        std::vector<StreamBuffer> outputBuffers;
+        std::vector<hw::DelayedStreamBuffer> delayedOutputBuffers;
+        int64_t shutterTimestampNs;
+        int64_t exposureDurationNs;
+        int frameNumber;
+        bool ok;
     };
 
     void closeImpl();
@@ -116,7 +130,11 @@ private:
                                hw::HwCamera& hwCamera);
     Status processOneCaptureRequest(const CaptureRequest& request);
     void captureThreadLoop();
+    void resultThreadLoop();
+    void returnCapturedFrame(CapturedFrame frame);
     void delayedCaptureThreadLoop();
+    void returnDelayedCaptureResult(uint64_t seq, int frameNumber, StreamBuffer sb);
+    void logDelayedCaptureStats();
     bool popCaptureRequest(HwCaptureRequest* req);
     struct timespec captureOneFrame(struct timespec nextFrameT, HwCaptureRequest req);
     void disposeCaptureRequest(HwCaptureRequest req);
@@ -133,14 +151,28 @@ private:
     StreamBufferCache mStreamBufferCache;
 
     BlockingQueue<HwCaptureRequest> mCaptureRequests;
+    BlockingQueue<CapturedFrame> mCapturedFrames;
     BlockingQueue<DelayedCaptureResult> mDelayedCaptureResults;
 
     size_t mNumBuffersInFlight = 0;
     std::condition_variable mNoBuffersInFlight;
     std::mutex mNumBuffersInFlightMtx;
 
+    // delayed buffers run in parallel on mDelayedCaptureThreads, the results
+    // wait in mDelayedReadyResults for the older ones
+    std::map<uint64_t, std::pair<int, StreamBuffer>> mDelayedReadyResults;
+    uint64_t mDelayedReturnSeq = 0;  // requires mDelayedReadyResultsMtx
+    std::mutex mDelayedReadyResultsMtx;
+    uint64_t mDelayedNextSeq = 0;    // returnCapturedFrame only
+
+    std::atomic<uint64_t> mDelayedBuffersProcessed = 0;
+    std::atomic<uint64_t> mDelayedBuffersTotalUs = 0;
+    std::atomic<uint32_t> mDelayedBuffersMaxUs = 0;
+    std::atomic<uint32_t> mDelayedQueueMaxDepth = 0;
+
     std::thread mCaptureThread;
-    std::thread mDelayedCaptureThread;
+    std::thread mResultThread;  // if the pipeline is deeper than one frame
+    std::vector<std::thread> mDelayedCaptureThreads;
 
     std::atomic<bool> mFlushing = false;
 };
@@ -88,16 +88,45 @@ constexpr uint32_t toR8G8B8A8(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
     return uint32_t(r) | (uint32_t(g) << 8) | (uint32_t(b) << 16) | (uint32_t(a) << 24);
 }
 
+// Replicates the high bits into the low ones like GL does
+constexpr uint32_t r5g6b5ToR8G8B8A8(const uint16_t c) {
+    const uint32_t r = (c >> 11) & 31;
+    const uint32_t g = (c >> 5) & 63;
+    const uint32_t b = c & 31;
+    return toR8G8B8A8((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2), 255);
+}
+
 constexpr double degrees2rad(const double degrees) {
     return degrees * M_PI / 180.0;
 }
 
+// The GL and the software renderers draw the same texels.
+soft3d::Texture makeTexture(const uint16_t width, const uint16_t height, const bool linear,
+                            std::vector<uint32_t> texels) {
+    soft3d::Texture texture;
+    texture.texels = std::move(texels);
+    texture.width = width;
+    texture.height = height;
+    texture.linear = linear;
+    return texture;
+}
+
+abc3d::AutoTexture createGlTexture(const soft3d::Texture& texture) {
+    abc3d::AutoTexture tex(GL_TEXTURE_2D, GL_RGBA, texture.width, texture.height,
+                           GL_RGBA, GL_UNSIGNED_BYTE, texture.texels.data());
+    const GLint filter = texture.linear ? GL_LINEAR : GL_NEAREST;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+
+    return tex;
+}
+
 // This texture is useful to debug camera orientation and image aspect ratio
-abc3d::AutoTexture loadTestPatternTextureA() {
-    constexpr uint16_t B = toR5G6B5(.4, .4, .4);
-    constexpr uint16_t R = toR5G6B5( 1, .1, .1);
+soft3d::Texture loadTestPatternTextureA() {
+    constexpr uint32_t B = r5g6b5ToR8G8B8A8(toR5G6B5(.4, .4, .4));
+    constexpr uint32_t R = r5g6b5ToR8G8B8A8(toR5G6B5( 1, .1, .1));
 
-    static const uint16_t texels[] = {
+    static const uint32_t texels[] = {
         B, R, R, R, R, R, B, B,
         R, B, B, B, B, B, R, B,
         B, B, B, B, B, B, R, B,
@@ -108,16 +137,12 @@ abc3d::AutoTexture loadTestPatternTextureA() {
         B, R, R, R, R, R, B, R,
     };
 
-    abc3d::AutoTexture tex(GL_TEXTURE_2D, GL_RGB, 8, 8,
-                           GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texels);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-    return tex;
+    return makeTexture(8, 8, false,
+                       std::vector<uint32_t>(std::begin(texels), std::end(texels)));
 }
 
 // This texture is useful to debug camera dataspace
-abc3d::AutoTexture loadTestPatternTextureColors() {
+soft3d::Texture loadTestPatternTextureColors() {
     static const uint32_t texels[] = {
         toR8G8B8A8(32, 0, 0, 255), toR8G8B8A8(64, 0, 0, 255), toR8G8B8A8(96, 0, 0, 255), toR8G8B8A8(128, 0, 0, 255),
         toR8G8B8A8(160, 0, 0, 255), toR8G8B8A8(192, 0, 0, 255), toR8G8B8A8(224, 0, 0, 255), toR8G8B8A8(255, 0, 0, 255),
@@ -144,25 +169,21 @@ abc3d::AutoTexture loadTestPatternTextureColors() {
         toR8G8B8A8(128, 128, 128, 255), toR8G8B8A8(160, 160, 160, 255), toR8G8B8A8(192, 192, 192, 255), toR8G8B8A8(224, 224, 224, 255),
     };
 
-    abc3d::AutoTexture tex(GL_TEXTURE_2D, GL_RGBA, 8, 8,
-                           GL_RGBA, GL_UNSIGNED_BYTE, texels);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-    return tex;
+    return makeTexture(8, 8, false,
+                       std::vector<uint32_t>(std::begin(texels), std::end(texels)));
 }
 
 // This texture is used to pass CtsVerifier
-abc3d::AutoTexture loadTestPatternTextureAcircles() {
-    constexpr uint16_t kPalette[] = {
-        toR5G6B5(0, 0, 0),
-        toR5G6B5(.25, .25, .25),
-        toR5G6B5(.5, .5, .5),
-        toR5G6B5(1, 1, 0),
-        toR5G6B5(1, 1, 1),
+soft3d::Texture loadTestPatternTextureAcircles() {
+    constexpr uint32_t kPalette[] = {
+        r5g6b5ToR8G8B8A8(toR5G6B5(0, 0, 0)),
+        r5g6b5ToR8G8B8A8(toR5G6B5(.25, .25, .25)),
+        r5g6b5ToR8G8B8A8(toR5G6B5(.5, .5, .5)),
+        r5g6b5ToR8G8B8A8(toR5G6B5(1, 1, 0)),
+        r5g6b5ToR8G8B8A8(toR5G6B5(1, 1, 1)),
     };
 
-    std::vector<uint16_t> texels;
+    std::vector<uint32_t> texels;
     texels.reserve(kAcirclesPatternWidth * kAcirclesPatternWidth);
 
     auto i = std::begin(kAcirclesPatternRLE);
@@ -171,7 +192,7 @@ abc3d::AutoTexture loadTestPatternTextureAcircles() {
         const unsigned x = *i;
         ++i;
         unsigned n;
-        uint16_t color;
+        uint32_t color;
         if (x & 1) {
             n = (x >> 3) + 1;
             color = kPalette[(x >> 1) & 3];
@@ -187,23 +208,24 @@ abc3d::AutoTexture loadTestPatternTextureAcircles() {
         texels.insert(texels.end(), n, color);
     }
 
-    abc3d::AutoTexture tex(GL_TEXTURE_2D, GL_RGB,
-                           kAcirclesPatternWidth, kAcirclesPatternWidth,
-                           GL_RGB, GL_UNSIGNED_SHORT_5_6_5, texels.data());
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    return tex;
+    return makeTexture(kAcirclesPatternWidth, kAcirclesPatternWidth, true,
+                       std::move(texels));
 }
 
-abc3d::AutoTexture loadTestPatternTexture() {
+std::string getProperty(const char* name) {
     std::string valueStr =
-        base::GetProperty("vendor.qemu.FakeRotatingCamera.scene", "");
+        base::GetProperty(std::string("vendor.qemu.FakeRotatingCamera.") + name, "");
     if (valueStr.empty()) {
         valueStr =
-            base::GetProperty("ro.boot.qemu.FakeRotatingCamera.scene", "");
+            base::GetProperty(std::string("ro.boot.qemu.FakeRotatingCamera.") + name, "");
     }
 
+    return valueStr;
+}
+
+soft3d::Texture loadTestPatternTexture() {
+    const std::string valueStr = getProperty("scene");
+
     if (strcmp(valueStr.c_str(), "a") == 0) {
         return loadTestPatternTextureA();
     } else if (strcmp(valueStr.c_str(), "colors") == 0) {
@@ -213,6 +235,14 @@ abc3d::AutoTexture loadTestPatternTexture() {
     }
 }
 
+// Renders on the CPU instead of EGL/GLES, e.g. where there is no GPU
+bool useSoftwareRenderer() {
+    return getProperty("renderer") == "software";
+}
+
+// YUV and JPEG are converted from here with the software renderer
+thread_local std::vector<uint32_t> gSoftwareRgbaScratch;
+
 bool compressNV21IntoJpeg(const Rect<uint16_t> imageSize,
                           const uint8_t* nv21data,
                           const CameraMetadata& metadata,
@@ -229,6 +259,7 @@ bool compressNV21IntoJpeg(const Rect<uint16_t> imageSize,
 
 FakeRotatingCamera::FakeRotatingCamera(const bool isBackFacing)
         : mIsBackFacing(isBackFacing)
+        , mUseSoftwareRenderer(useSoftwareRenderer())
         , mAFStateMachine(200, 1, 2) {}
 
 FakeRotatingCamera::~FakeRotatingCamera() {
@@ -241,10 +272,14 @@ FakeRotatingCamera::overrideStreamParams(const PixelFormat format,
                                          const Dataspace dataspace) const {
     constexpr BufferUsage kRgbaExtraUsage = usageOr(BufferUsage::CAMERA_OUTPUT,
                                                     BufferUsage::GPU_RENDER_TARGET);
+    constexpr BufferUsage kRgbaSoftwareExtraUsage = usageOr(BufferUsage::CAMERA_OUTPUT,
+                                                            BufferUsage::CPU_WRITE_OFTEN);
     constexpr BufferUsage kYuvExtraUsage = usageOr(BufferUsage::CAMERA_OUTPUT,
                                                    BufferUsage::CPU_WRITE_OFTEN);
     constexpr BufferUsage kBlobExtraUsage = usageOr(BufferUsage::CAMERA_OUTPUT,
                                                     BufferUsage::CPU_WRITE_OFTEN);
+    const BufferUsage rgbaExtraUsage =
+        mUseSoftwareRenderer ? kRgbaSoftwareExtraUsage : kRgbaExtraUsage;
 
     switch (format) {
     case PixelFormat::YCBCR_420_888:
@@ -256,12 +291,12 @@ FakeRotatingCamera::overrideStreamParams(const PixelFormat format,
             return {PixelFormat::YCBCR_420_888, usageOr(usage, kYuvExtraUsage),
                     Dataspace::JFIF, 8};
         } else {
-            return {PixelFormat::RGBA_8888, usageOr(usage, kRgbaExtraUsage),
+            return {PixelFormat::RGBA_8888, usageOr(usage, rgbaExtraUsage),
                     Dataspace::UNKNOWN, 4};
         }
 
     case PixelFormat::RGBA_8888:
-        return {PixelFormat::RGBA_8888, usageOr(usage, kRgbaExtraUsage),
+        return {PixelFormat::RGBA_8888, usageOr(usage, rgbaExtraUsage),
                 Dataspace::UNKNOWN, (usageTest(usage, BufferUsage::VIDEO_ENCODER) ? 8 : 4)};
 
     case PixelFormat::BLOB:
@@ -296,9 +331,16 @@ bool FakeRotatingCamera::configure(const CameraMetadata& sessionParams,
         }
     }
 
-    const abc3d::EglCurrentContext currentContext = initOpenGL();
-    if (!currentContext.ok()) {
-        return FAILURE(false);
+    abc3d::EglCurrentContext currentContext;
+    if (mUseSoftwareRenderer) {
+        if (!mTestPatternTexture.ok()) {
+            mTestPatternTexture = loadTestPatternTexture();
+        }
+    } else {
+        currentContext = initOpenGL();
+        if (!currentContext.ok()) {
+            return FAILURE(false);
+        }
     }
 
     LOG_ALWAYS_FATAL_IF(!mStreamInfoCache.empty());
@@ -312,7 +354,7 @@ bool FakeRotatingCamera::configure(const CameraMetadata& sessionParams,
         si.pixelFormat = halStreams->overrideFormat;
         si.blobBufferSize = streams->bufferSize;
 
-        if (si.pixelFormat != PixelFormat::RGBA_8888) {
+        if ((si.pixelFormat != PixelFormat::RGBA_8888) && !mUseSoftwareRenderer) {
             const native_handle_t* buffer;
             GraphicBufferAllocator& gba = GraphicBufferAllocator::get();
 
@@ -348,7 +390,7 @@ abc3d::EglCurrentContext FakeRotatingCamera::initOpenGL() {
         return abc3d::EglCurrentContext();
     }
 
-    abc3d::AutoTexture testPatternTexture = loadTestPatternTexture();
+    abc3d::AutoTexture testPatternTexture = createGlTexture(loadTestPatternTexture());
     if (!testPatternTexture.ok()) {
         return abc3d::EglCurrentContext();
     }
@@ -417,7 +459,8 @@ void main() {
 void FakeRotatingCamera::closeImpl(const bool everything) {
     {
         const abc3d::EglCurrentContext currentContext = mEglContext.getCurrentContext();
-        LOG_ALWAYS_FATAL_IF(!mStreamInfoCache.empty() && !currentContext.ok());
+        LOG_ALWAYS_FATAL_IF(!mStreamInfoCache.empty() && !currentContext.ok() &&
+                            !mUseSoftwareRenderer);
         mStreamInfoCache.clear();
 
         if (everything) {
@@ -427,6 +470,7 @@ void FakeRotatingCamera::closeImpl(const bool everything) {
     }
 
     if (everything) {
+        mTestPatternTexture = {};
         mEglContext.clear();
         mQemuChannel.reset();
     }
@@ -445,9 +489,12 @@ FakeRotatingCamera::processCaptureRequest(CameraMetadata metadataUpdate,
     std::vector<DelayedStreamBuffer> delayedOutputBuffers;
     outputBuffers.reserve(csbsSize);
 
-    const abc3d::EglCurrentContext currentContext = mEglContext.getCurrentContext();
-    if (!currentContext.ok()) {
-        goto fail;
+    abc3d::EglCurrentContext currentContext;
+    if (!mUseSoftwareRenderer) {
+        currentContext = mEglContext.getCurrentContext();
+        if (!currentContext.ok()) {
+            goto fail;
+        }
     }
 
     RenderParams renderParams;
@@ -543,42 +590,38 @@ bool FakeRotatingCamera::captureFrameRGBA(const StreamInfo& si,
         return FAILURE(false);
     }
 
-    return renderIntoRGBA(si, renderParams, csb->getBuffer());
+    if (mUseSoftwareRenderer) {
+        return renderIntoRGBASoftware(si, renderParams, csb->getBuffer());
+    } else {
+        return renderIntoRGBA(si, renderParams, csb->getBuffer());
+    }
 }
 
 bool FakeRotatingCamera::captureFrameYUV(const StreamInfo& si,
                                          const RenderParams& renderParams,
                                          CachedStreamBuffer* csb) const {
-    LOG_ALWAYS_FATAL_IF(!si.rgbaBuffer);
-    if (!renderIntoRGBA(si, renderParams, si.rgbaBuffer.get())) {
+    const uint32_t* rgba = lockRenderedRGBA(si, renderParams);
+    if (!rgba) {
         return false;
     }
 
     if (!csb->waitAcquireFence(mFrameDurationNs / 2000000)) {
+        unlockRenderedRGBA(si);
         return false;
     }
 
-    void* rgba = nullptr;
-    if (GraphicBufferMapper::get().lock(
-            si.rgbaBuffer.get(), static_cast<uint32_t>(BufferUsage::CPU_READ_OFTEN),
-            {si.size.width, si.size.height}, &rgba) != NO_ERROR) {
-        return FAILURE(false);
-    }
-
     android_ycbcr ycbcr;
     if (GraphicBufferMapper::get().lockYCbCr(
             csb->getBuffer(), static_cast<uint32_t>(BufferUsage::CPU_WRITE_OFTEN),
             {si.size.width, si.size.height}, &ycbcr) != NO_ERROR) {
-        LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(si.rgbaBuffer.get()) != NO_ERROR);
+        unlockRenderedRGBA(si);
         return FAILURE(false);
     }
 
-    const bool converted = conv::rgba2yuv(si.size.width, si.size.height,
-                                          static_cast<const uint32_t*>(rgba),
-                                          ycbcr);
+    const bool converted = conv::rgba2yuv(si.size.width, si.size.height, rgba, ycbcr);
 
     LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(csb->getBuffer()) != NO_ERROR);
-    LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(si.rgbaBuffer.get()) != NO_ERROR);
+    unlockRenderedRGBA(si);
 
     return converted;
 }
@@ -610,14 +653,8 @@ DelayedStreamBuffer FakeRotatingCamera::captureFrameJpeg(const StreamInfo& si,
 std::vector<uint8_t>
 FakeRotatingCamera::captureFrameForCompressing(const StreamInfo& si,
                                                const RenderParams& renderParams) const {
-    if (!renderIntoRGBA(si, renderParams, si.rgbaBuffer.get())) {
-        return {};
-    }
-
-    void* rgba = nullptr;
-    if (GraphicBufferMapper::get().lock(
-            si.rgbaBuffer.get(), static_cast<uint32_t>(BufferUsage::CPU_READ_OFTEN),
-            {si.size.width, si.size.height}, &rgba) != NO_ERROR) {
+    const uint32_t* rgba = lockRenderedRGBA(si, renderParams);
+    if (!rgba) {
         return {};
     }
 
@@ -625,11 +662,9 @@ FakeRotatingCamera::captureFrameForCompressing(const StreamInfo& si,
     const android_ycbcr ycbcr = yuv::NV21init(si.size.width, si.size.height,
                                               nv21data.data());
 
-    const bool converted = conv::rgba2yuv(si.size.width, si.size.height,
-                                          static_cast<const uint32_t*>(rgba),
-                                          ycbcr);
+    const bool converted = conv::rgba2yuv(si.size.width, si.size.height, rgba, ycbcr);
 
-    LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(si.rgbaBuffer.get()) != NO_ERROR);
+    unlockRenderedRGBA(si);
 
     if (converted) {
         return nv21data;
@@ -638,47 +673,82 @@ FakeRotatingCamera::captureFrameForCompressing(const StreamInfo& si,
     }
 }
 
-bool FakeRotatingCamera::drawScene(const Rect<uint16_t> imageSize,
-                                   const RenderParams& renderParams,
-                                   const bool isHardwareBuffer) const {
-    float pvMatrix44[16];
-    {
-        float projectionMatrix44[16];
-        float viewMatrix44[16];
-
-        // This matrix takes into account specific behaviors below:
-        // * The Y axis if rendering int0 AHardwareBuffer goes down while it
-        //   goes up everywhere else (e.g. when rendering to `EGLSurface`).
-        // * We set `sensorOrientation=90` because a lot of places in Android and
-        //   3Ps assume this and don't work properly with `sensorOrientation=0`.
-        const float workaroundMatrix44[16] = {
-            0, (isHardwareBuffer ? -1.0f : 1.0f), 0, 0,
-           -1,                                 0, 0, 0,
-            0,                                 0, 1, 0,
-            0,                                 0, 0, 1,
-        };
-
-        {
-            constexpr double kNear = 1.0;
-            constexpr double kFar = 10.0;
-
-            // We use `height` to calculate `right` because the image is 90degrees
-            // rotated (sensorOrientation=90).
-            const double right = kNear * (.5 * getSensorSize().height / getSensorDPI() / getDefaultFocalLength());
-            const double top = right / imageSize.width * imageSize.height;
-            abc3d::frustum(pvMatrix44, -right, right, -top, top,
-                           kNear, kFar);
-        }
+const uint32_t* FakeRotatingCamera::lockRenderedRGBA(const StreamInfo& si,
+                                                     const RenderParams& renderParams) const {
+    if (mUseSoftwareRenderer) {
+        std::vector<uint32_t>& rgba = gSoftwareRgbaScratch;
+        rgba.resize(size_t(si.size.width) * si.size.height);
+        return drawSceneSoftware(si.size, renderParams, rgba.data(), si.size.width) ?
+            rgba.data() : nullptr;
+    }
 
-        abc3d::mulM44(projectionMatrix44, pvMatrix44, workaroundMatrix44);
+    LOG_ALWAYS_FATAL_IF(!si.rgbaBuffer);
+    if (!renderIntoRGBA(si, renderParams, si.rgbaBuffer.get())) {
+        return nullptr;
+    }
 
-        {
-            const auto& cam = renderParams.cameraParams;
-            abc3d::lookAtXyzRot(viewMatrix44, cam.pos3, cam.rotXYZ3);
-        }
+    void* rgba = nullptr;
+    if (GraphicBufferMapper::get().lock(
+            si.rgbaBuffer.get(), static_cast<uint32_t>(BufferUsage::CPU_READ_OFTEN),
+            {si.size.width, si.size.height}, &rgba) != NO_ERROR) {
+        return FAILURE(nullptr);
+    }
+
+    return static_cast<const uint32_t*>(rgba);
+}
 
-        abc3d::mulM44(pvMatrix44, projectionMatrix44, viewMatrix44);
+void FakeRotatingCamera::unlockRenderedRGBA(const StreamInfo& si) const {
+    if (!mUseSoftwareRenderer) {
+        LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(si.rgbaBuffer.get()) != NO_ERROR);
     }
+}
+
+void FakeRotatingCamera::getPvMatrix(const Rect<uint16_t> imageSize,
+                                     const RenderParams& renderParams,
+                                     const bool isHardwareBuffer,
+                                     float pvMatrix44[]) const {
+    float projectionMatrix44[16];
+    float viewMatrix44[16];
+
+    // This matrix takes into account specific behaviors below:
+    // * The Y axis if rendering int0 AHardwareBuffer goes down while it
+    //   goes up everywhere else (e.g. when rendering to `EGLSurface`).
+    // * We set `sensorOrientation=90` because a lot of places in Android and
+    //   3Ps assume this and don't work properly with `sensorOrientation=0`.
+    const float workaroundMatrix44[16] = {
+        0, (isHardwareBuffer ? -1.0f : 1.0f), 0, 0,
+       -1,                                 0, 0, 0,
+        0,                                 0, 1, 0,
+        0,                                 0, 0, 1,
+    };
+
+    {
+        constexpr double kNear = 1.0;
+        constexpr double kFar = 10.0;
+
+        // We use `height` to calculate `right` because the image is 90degrees
+        // rotated (sensorOrientation=90).
+        const double right = kNear * (.5 * getSensorSize().height / getSensorDPI() / getDefaultFocalLength());
+        const double top = right / imageSize.width * imageSize.height;
+        abc3d::frustum(pvMatrix44, -right, right, -top, top,
+                       kNear, kFar);
+    }
+
+    abc3d::mulM44(projectionMatrix44, pvMatrix44, workaroundMatrix44);
+
+    {
+        const auto& cam = renderParams.cameraParams;
+        abc3d::lookAtXyzRot(viewMatrix44, cam.pos3, cam.rotXYZ3);
+    }
+
+    abc3d::mulM44(pvMatrix44, projectionMatrix44, viewMatrix44);
+}
+
+bool FakeRotatingCamera::drawScene(const Rect<uint16_t> imageSize,
+                                   const RenderParams& renderParams,
+                                   const bool isHardwareBuffer) const {
+    float pvMatrix44[16];
+    getPvMatrix(imageSize, renderParams, isHardwareBuffer, pvMatrix44);
 
     glViewport(0, 0, imageSize.width, imageSize.height);
     const bool result = drawSceneImpl(pvMatrix44);
@@ -726,6 +796,24 @@ bool FakeRotatingCamera::drawSceneImpl(const float pvMatrix44[]) const {
     return true;
 }
 
+bool FakeRotatingCamera::drawSceneSoftware(const Rect<uint16_t> imageSize,
+                                           const RenderParams& renderParams,
+                                           uint32_t* rgba, const size_t stride) const {
+    // the same quad and the clear color as in drawSceneImpl
+    static const float kOrigin3[] = {-1, 0, -1};
+    static const float kSAxis3[] = {2, 0, 0};
+    static const float kTAxis3[] = {0, 0, 2};
+    constexpr uint32_t kClearColor = toR8G8B8A8(51, 77, 51, 255);
+
+    // the first row goes to the bottom of the viewport as with AHardwareBuffer
+    float pvMatrix44[16];
+    getPvMatrix(imageSize, renderParams, true, pvMatrix44);
+
+    return soft3d::drawTexturedQuad(rgba, imageSize.width, imageSize.height, stride,
+                                    kClearColor, pvMatrix44,
+                                    kOrigin3, kSAxis3, kTAxis3, mTestPatternTexture);
+}
+
 bool FakeRotatingCamera::renderIntoRGBA(const StreamInfo& si,
                                         const RenderParams& renderParams,
                                         const native_handle_t* rgbaBuffer) const {
@@ -756,6 +844,30 @@ bool FakeRotatingCamera::renderIntoRGBA(const StreamInfo& si,
     return drawScene(si.size, renderParams, true);
 }
 
+bool FakeRotatingCamera::renderIntoRGBASoftware(const StreamInfo& si,
+                                                const RenderParams& renderParams,
+                                                const native_handle_t* rgbaBuffer) const {
+    void* rgba = nullptr;
+    int32_t bytesPerPixel = 0;
+    int32_t bytesPerStride = 0;
+    if (GraphicBufferMapper::get().lock(
+            rgbaBuffer, static_cast<uint32_t>(BufferUsage::CPU_WRITE_OFTEN),
+            {si.size.width, si.size.height}, &rgba,
+            &bytesPerPixel, &bytesPerStride) != NO_ERROR) {
+        return FAILURE(false);
+    }
+
+    const size_t stride = (bytesPerStride > 0) ?
+        (bytesPerStride / sizeof(uint32_t)) : si.size.width;
+
+    const bool result = drawSceneSoftware(si.size, renderParams,
+                                          static_cast<uint32_t*>(rgba), stride);
+
+    LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(rgbaBuffer) != NO_ERROR);
+
+    return result;
+}
+
 bool FakeRotatingCamera::readSensors(SensorValues* vals) {
     static const char kReadCommand[] = "get";
 
@@ -808,7 +920,7 @@ CameraMetadata FakeRotatingCamera::applyMetadata(const CameraMetadata& metadata)
     m[ANDROID_LENS_APERTURE] = getDefaultAperture();
     m[ANDROID_LENS_FOCUS_DISTANCE] = af.second;
     m[ANDROID_LENS_STATE] = uint8_t(getAfLensState(af.first));
-    m[ANDROID_REQUEST_PIPELINE_DEPTH] = uint8_t(4);
+    m[ANDROID_REQUEST_PIPELINE_DEPTH] = uint8_t(getPipelineMaxDepth());
     m[ANDROID_SENSOR_FRAME_DURATION] = mFrameDurationNs;
     m[ANDROID_SENSOR_EXPOSURE_TIME] = kDefaultSensorExposureTimeNs;
     m[ANDROID_SENSOR_SENSITIVITY] = getDefaultSensorSensitivity();
@@ -21,6 +21,7 @@
 #include <android-base/unique_fd.h>
 
 #include "abc3d.h"
+#include "soft3d.h"
 
 #include "AutoNativeHandle.h"
 #include "AFStateMachine.h"
@@ -110,18 +111,32 @@ private:
                                          CachedStreamBuffer* csb) const;
     std::vector<uint8_t> captureFrameForCompressing(const StreamInfo& si,
                                                     const RenderParams& renderParams) const;
+    const uint32_t* lockRenderedRGBA(const StreamInfo& si,
+                                     const RenderParams& renderParams) const;
+    void unlockRenderedRGBA(const StreamInfo& si) const;
     bool renderIntoRGBA(const StreamInfo& si,
                         const RenderParams& renderParams,
                         const native_handle_t* rgbaBuffer) const;
+    bool renderIntoRGBASoftware(const StreamInfo& si,
+                                const RenderParams& renderParams,
+                                const native_handle_t* rgbaBuffer) const;
+    void getPvMatrix(Rect<uint16_t> imageSize,
+                     const RenderParams& renderParams,
+                     bool isHardwareBuffer,
+                     float pvMatrix44[]) const;
     bool drawScene(Rect<uint16_t> imageSize,
                    const RenderParams& renderParams,
                    bool isHardwareBuffer) const;
     bool drawSceneImpl(const float pvMatrix44[]) const;
+    bool drawSceneSoftware(Rect<uint16_t> imageSize,
+                           const RenderParams& renderParams,
+                           uint32_t* rgba, size_t stride) const;
     CameraMetadata applyMetadata(const CameraMetadata& metadata);
     CameraMetadata updateCaptureResultMetadata();
     bool readSensors(SensorValues* vals);
 
     const bool mIsBackFacing;
+    const bool mUseSoftwareRenderer;  // no EGL/GLES if true
     AFStateMachine mAFStateMachine;
     std::unordered_map<int32_t, StreamInfo> mStreamInfoCache;
     base::unique_fd mQemuChannel;
@@ -134,6 +149,8 @@ private:
     GLint mGlProgramUniformPvmMatrixLoc;
     abc3d::AutoProgram mGlProgram;
 
+    soft3d::Texture mTestPatternTexture;  // for mUseSoftwareRenderer
+
     CameraMetadata mCaptureResultMetadata;
     int64_t mFrameDurationNs = 0;
 };
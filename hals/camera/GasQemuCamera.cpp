@@ -14,6 +14,8 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+
 #include <linux/videodev2.h>
 #include <ui/GraphicBufferAllocator.h>
 #include <ui/GraphicBufferMapper.h>
@@ -25,6 +27,7 @@
 #include "debug.h"
 #include "jpeg.h"
 #include "qemu_channel.h"
+#include "yuv.h"
 
 namespace android {
 namespace hardware {
@@ -38,6 +41,9 @@ constexpr char kClass[] = "GasQemuCamera";
 constexpr BufferUsage usageOr(const BufferUsage a, const BufferUsage b) {
     return static_cast<BufferUsage>(static_cast<uint64_t>(a) | static_cast<uint64_t>(b));
 }
+
+constexpr BufferUsage kIntermediateBufferUsage =
+    usageOr(BufferUsage::CAMERA_OUTPUT, BufferUsage::CPU_READ_OFTEN);
 }  // namespace
 
 GasQemuCamera::GasQemuCamera(const Parameters& params)
@@ -64,6 +70,7 @@ bool GasQemuCamera::configure(const CameraMetadata& sessionParams,
         mQemuChannel = std::move(qemuChannel);
     }
 
+    mStreams.clear();  // drop the old pools before the new ones fill up
     mStreams.resize(nStreams);
     for (size_t i = 0; i < nStreams; ++i, ++streams, ++halStreams) {
         LOG_ALWAYS_FATAL_IF(streams->id != halStreams->id);
@@ -73,6 +80,24 @@ bool GasQemuCamera::configure(const CameraMetadata& sessionParams,
         si.size.height = streams->height;
         si.blobBufferSize = streams->bufferSize;
         si.format = halStreams->overrideFormat;
+
+        // the host writes into these at `offset=`, see queryFrame
+        switch (si.format) {
+        case PixelFormat::BLOB:
+            si.bufferPool = std::make_shared<BufferPool>(
+                si.size, PixelFormat::YCBCR_420_888, kIntermediateBufferUsage,
+                halStreams->maxBuffers, kClass);
+            break;
+
+        case PixelFormat::RAW16:
+            si.bufferPool = std::make_shared<BufferPool>(
+                si.size, PixelFormat::RGBA_8888, kIntermediateBufferUsage,
+                halStreams->maxBuffers, kClass);
+            break;
+
+        default:
+            break;
+        }
     }
 
     applyMetadata(sessionParams);
@@ -88,6 +113,7 @@ void GasQemuCamera::close() {
         }
         mQemuChannel.reset();
     }
+    freeSourceImage();
     mStreams.clear();
 }
 
@@ -104,6 +130,10 @@ GasQemuCamera::processCaptureRequest(CameraMetadata metadataUpdate,
     std::vector<DelayedStreamBuffer> delayedOutputBuffers;
     outputBuffers.reserve(csbsSize);
 
+    std::vector<const StreamInfo*> sis(csbsSize, nullptr);
+    Rect<uint16_t> sourceSize = {0, 0};
+    size_t nOutputs = 0;
+
     for (size_t i = 0; i < csbsSize; ++i) {
         CachedStreamBuffer* csb = csbs[i];
         LOG_ALWAYS_FATAL_IF(!csb);  // otherwise mNumBuffersInFlight will be hard
@@ -127,34 +157,109 @@ GasQemuCamera::processCaptureRequest(CameraMetadata metadataUpdate,
         }
 
         if (si) {
-            captureFrame(*si, csb, &outputBuffers, &delayedOutputBuffers);
+            sis[i] = si;
+            ++nOutputs;
+            sourceSize.width = std::max(sourceSize.width, si->size.width);
+            sourceSize.height = std::max(sourceSize.height, si->size.height);
+        }
+    }
+
+    // Several outputs are derived from one host frame instead of querying
+    // the host for each of them. The frame is as wide as the widest output
+    // and as tall as the tallest one, so every output is a crop of it at
+    // no more than its resolution (1920x1080 and 1600x1200 make 1920x1200).
+    SourceFrame sourceFrame;
+    const SourceFrame* source = nullptr;
+    if ((nOutputs > 1) && lockSourceFrame(sourceSize, &sourceFrame)) {
+        source = &sourceFrame;
+    }
+
+    for (size_t i = 0; i < csbsSize; ++i) {
+        CachedStreamBuffer* csb = csbs[i];
+        if (sis[i]) {
+            captureFrame(*sis[i], csb, source, &outputBuffers, &delayedOutputBuffers);
         } else {
             outputBuffers.push_back(csb->finish(false));
         }
     }
 
+    if (source) {
+        unlockSourceFrame();
+    }
+
     return make_tuple((mQemuChannel.ok() ? mFrameDurationNs : FAILURE(-1)),
                       mSensorExposureDurationNs,
                       std::move(resultMetadata), std::move(outputBuffers),
                       std::move(delayedOutputBuffers));
 }
 
+bool GasQemuCamera::lockSourceFrame(const Rect<uint16_t> size, SourceFrame* source) {
+    if (!mSourceImage || !(mSourceImageSize == size)) {
+        freeSourceImage();
+
+        uint32_t stride;
+        if (GraphicBufferAllocator::get().allocate(
+                size.width, size.height, static_cast<int>(PixelFormat::YCBCR_420_888), 1,
+                static_cast<uint64_t>(kIntermediateBufferUsage), &mSourceImage, &stride,
+                "GasQemuCamera") != NO_ERROR) {
+            mSourceImage = nullptr;
+            return FAILURE(false);
+        }
+        mSourceImageSize = size;
+    }
+
+    const cb_handle_t* const cb = cb_handle_t::from(mSourceImage);
+    if (!cb) {
+        return FAILURE(false);
+    }
+
+    if (!queryFrame(size, V4L2_PIX_FMT_YUV420, mExposureComp, cb->getMmapedOffset())) {
+        return FAILURE(false);
+    }
+
+    if (GraphicBufferMapper::get().lockYCbCr(
+            mSourceImage, static_cast<uint32_t>(BufferUsage::CPU_READ_OFTEN),
+            {size.width, size.height}, &source->ycbcr) != NO_ERROR) {
+        return FAILURE(false);
+    }
+
+    if (source->ycbcr.chroma_step != 1) {
+        unlockSourceFrame();
+        return FAILURE(false);
+    }
+
+    source->size = size;
+    return true;
+}
+
+void GasQemuCamera::unlockSourceFrame() {
+    LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(mSourceImage) != NO_ERROR);
+}
+
+void GasQemuCamera::freeSourceImage() {
+    if (mSourceImage) {
+        GraphicBufferAllocator::get().free(mSourceImage);
+        mSourceImage = nullptr;
+    }
+}
+
 void GasQemuCamera::captureFrame(const StreamInfo& si,
                                  CachedStreamBuffer* csb,
+                                 const SourceFrame* source,
                                  std::vector<StreamBuffer>* outputBuffers,
                                  std::vector<DelayedStreamBuffer>* delayedOutputBuffers) const {
     switch (si.format) {
     case PixelFormat::YCBCR_420_888:
-        outputBuffers->push_back(csb->finish(captureFrameYUV(si, csb)));
+        outputBuffers->push_back(csb->finish(captureFrameYUV(si, csb, source)));
         break;
     case PixelFormat::RGBA_8888:
-        outputBuffers->push_back(csb->finish(captureFrameRGBA(si, csb)));
+        outputBuffers->push_back(csb->finish(captureFrameRGBA(si, csb, source)));
         break;
     case PixelFormat::RAW16:
-        delayedOutputBuffers->push_back(captureFrameRAW16(si, csb));
+        delayedOutputBuffers->push_back(captureFrameRAW16(si, csb, source));
         break;
     case PixelFormat::BLOB:
-        delayedOutputBuffers->push_back(captureFrameJpeg(si, csb));
+        delayedOutputBuffers->push_back(captureFrameJpeg(si, csb, source));
         break;
     default:
         ALOGE("%s:%s:%d: unexpected format=%s", kClass,
@@ -165,7 +270,8 @@ void GasQemuCamera::captureFrame(const StreamInfo& si,
 }
 
 bool GasQemuCamera::captureFrameYUV(const StreamInfo& si,
-                                    CachedStreamBuffer* csb) const {
+                                    CachedStreamBuffer* csb,
+                                    const SourceFrame* source) const {
     if (!csb->waitAcquireFence(mFrameDurationNs / 2000000)) {
         return FAILURE(false);
     }
@@ -183,15 +289,18 @@ bool GasQemuCamera::captureFrameYUV(const StreamInfo& si,
         return FAILURE(false);
     }
 
-    bool const res = queryFrame(si.size, V4L2_PIX_FMT_YUV420,
-                                mExposureComp, cb->getMmapedOffset());
+    bool const res = source ?
+        yuv::cropScale(source->size.width, source->size.height, source->ycbcr,
+                       size.width, size.height, ycbcr) :
+        queryFrame(si.size, V4L2_PIX_FMT_YUV420, mExposureComp, cb->getMmapedOffset());
 
     LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(cb) != NO_ERROR);
     return res;
 }
 
 bool GasQemuCamera::captureFrameRGBA(const StreamInfo& si,
-                                     CachedStreamBuffer* csb) const {
+                                     CachedStreamBuffer* csb,
+                                     const SourceFrame* source) const {
     if (!csb->waitAcquireFence(mFrameDurationNs / 2000000)) {
         return FAILURE(false);
     }
@@ -209,24 +318,27 @@ bool GasQemuCamera::captureFrameRGBA(const StreamInfo& si,
         return FAILURE(false);
     }
 
-    bool const res = queryFrame(si.size, V4L2_PIX_FMT_RGB32,
-                                mExposureComp, cb->getMmapedOffset());
+    bool const res = source ?
+        yuv::cropScaleToRGBA(source->size.width, source->size.height, source->ycbcr,
+                             size.width, size.height, mem, size.width * 4) :
+        queryFrame(si.size, V4L2_PIX_FMT_RGB32, mExposureComp, cb->getMmapedOffset());
 
     LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(cb) != NO_ERROR);
     return res;
 }
 
 DelayedStreamBuffer GasQemuCamera::captureFrameRAW16(const StreamInfo& si,
-                                                     CachedStreamBuffer* csb) const {
+                                                     CachedStreamBuffer* csb,
+                                                     const SourceFrame* source) const {
     const native_handle_t* const image = captureFrameForCompressing(
-        si.size, PixelFormat::RGBA_8888, V4L2_PIX_FMT_RGB32);
+        si, PixelFormat::RGBA_8888, V4L2_PIX_FMT_RGB32, source);
 
     const Rect<uint16_t> imageSize = si.size;
     const int64_t frameDurationNs = mFrameDurationNs;
     CameraMetadata metadata = mCaptureResultMetadata;
 
     return [csb, image, imageSize, metadata = std::move(metadata),
-            frameDurationNs](const bool ok) -> StreamBuffer {
+            frameDurationNs, bufferPool = si.bufferPool](const bool ok) -> StreamBuffer {
         StreamBuffer sb;
         if (ok && image && csb->waitAcquireFence(frameDurationNs / 1000000)) {
             void* mem = nullptr;
@@ -242,15 +354,16 @@ DelayedStreamBuffer GasQemuCamera::captureFrameRAW16(const StreamInfo& si,
             sb = csb->finish(false);
         }
         if (image) {
-            GraphicBufferAllocator::get().free(image);
+            bufferPool->release(image);
         }
         return sb;
     };
 }
 DelayedStreamBuffer GasQemuCamera::captureFrameJpeg(const StreamInfo& si,
-                                                    CachedStreamBuffer* csb) const {
+                                                    CachedStreamBuffer* csb,
+                                                    const SourceFrame* source) const {
     const native_handle_t* const image = captureFrameForCompressing(
-        si.size, PixelFormat::YCBCR_420_888, V4L2_PIX_FMT_YUV420);
+        si, PixelFormat::YCBCR_420_888, V4L2_PIX_FMT_YUV420, source);
 
     const Rect<uint16_t> imageSize = si.size;
     const uint32_t jpegBufferSize = si.blobBufferSize;
@@ -258,7 +371,7 @@ DelayedStreamBuffer GasQemuCamera::captureFrameJpeg(const StreamInfo& si,
     CameraMetadata metadata = mCaptureResultMetadata;
 
     return [csb, image, imageSize, metadata = std::move(metadata), jpegBufferSize,
-            frameDurationNs](const bool ok) -> StreamBuffer {
+            frameDurationNs, bufferPool = si.bufferPool](const bool ok) -> StreamBuffer {
         StreamBuffer sb;
         if (ok && image && csb->waitAcquireFence(frameDurationNs / 1000000)) {
             android_ycbcr imageYcbcr;
@@ -276,37 +389,59 @@ DelayedStreamBuffer GasQemuCamera::captureFrameJpeg(const StreamInfo& si,
         }
 
         if (image) {
-            GraphicBufferAllocator::get().free(image);
+            bufferPool->release(image);
         }
         return sb;
     };
 }
 
 const native_handle_t* GasQemuCamera::captureFrameForCompressing(
-        const Rect<uint16_t> dim,
+        const StreamInfo& si,
         const PixelFormat bufferFormat,
-        const uint32_t qemuFormat) const {
-    constexpr BufferUsage kUsage = usageOr(BufferUsage::CAMERA_OUTPUT,
-                                           BufferUsage::CPU_READ_OFTEN);
+        const uint32_t qemuFormat,
+        const SourceFrame* source) const {
+    BufferPool& bufferPool = *si.bufferPool;
+    const Rect<uint16_t> dim = si.size;
 
-    GraphicBufferAllocator& gba = GraphicBufferAllocator::get();
-
-    const native_handle_t* image = nullptr;
-    uint32_t stride;
-    if (gba.allocate(dim.width, dim.height, static_cast<int>(bufferFormat), 1,
-                     static_cast<uint64_t>(kUsage), &image, &stride,
-                     "GasQemuCamera") != NO_ERROR) {
+    const native_handle_t* const image = bufferPool.acquire();
+    if (!image) {
         return FAILURE(nullptr);
     }
 
     const cb_handle_t* const cb = cb_handle_t::from(image);
     if (!cb) {
-        gba.free(image);
+        bufferPool.release(image);
         return FAILURE(nullptr);
     }
 
-    if (!queryFrame(dim, qemuFormat, mExposureComp, cb->getMmapedOffset())) {
-        gba.free(image);
+    if (source) {
+        // the delayed buffers outlive the source frame, derive them now
+        GraphicBufferMapper& gbm = GraphicBufferMapper::get();
+        const uint32_t usage = static_cast<uint32_t>(BufferUsage::CPU_WRITE_OFTEN);
+        bool res = false;
+        if (bufferFormat == PixelFormat::RGBA_8888) {
+            void* mem = nullptr;
+            if (gbm.lock(image, usage, {dim.width, dim.height}, &mem) == NO_ERROR) {
+                res = yuv::cropScaleToRGBA(source->size.width, source->size.height,
+                                           source->ycbcr, dim.width, dim.height,
+                                           mem, dim.width * 4);
+                LOG_ALWAYS_FATAL_IF(gbm.unlock(image) != NO_ERROR);
+            }
+        } else {
+            android_ycbcr ycbcr;
+            if (gbm.lockYCbCr(image, usage, {dim.width, dim.height}, &ycbcr) == NO_ERROR) {
+                res = yuv::cropScale(source->size.width, source->size.height,
+                                     source->ycbcr, dim.width, dim.height, ycbcr);
+                LOG_ALWAYS_FATAL_IF(gbm.unlock(image) != NO_ERROR);
+            }
+        }
+
+        if (!res) {
+            bufferPool.release(image);
+            return FAILURE(nullptr);
+        }
+    } else if (!queryFrame(dim, qemuFormat, mExposureComp, cb->getMmapedOffset())) {
+        bufferPool.release(image);
         return FAILURE(nullptr);
     }
 
@@ -16,11 +16,14 @@
 
 #pragma once
 
+#include <memory>
 #include <vector>
 
 #include <android-base/unique_fd.h>
+#include <system/graphics.h>
 
 #include "BaseQemuCamera.h"
+#include "BufferPool.h"
 
 namespace android {
 namespace hardware {
@@ -46,26 +49,48 @@ private:
         uint32_t blobBufferSize;
         PixelFormat format;
         Rect<uint16_t> size;
+        std::shared_ptr<BufferPool> bufferPool;  // for BLOB and RAW16
     };
 
+    // A host frame (I420) the outputs of a request are derived from.
+    struct SourceFrame {
+        android_ycbcr ycbcr;
+        Rect<uint16_t> size;
+    };
+
+    bool lockSourceFrame(Rect<uint16_t> size, SourceFrame* source);
+    void unlockSourceFrame();
+    void freeSourceImage();
+
     void captureFrame(const StreamInfo& si,
                       CachedStreamBuffer* csb,
+                      const SourceFrame* source,
                       std::vector<StreamBuffer>* outputBuffers,
                       std::vector<DelayedStreamBuffer>* delayedOutputBuffers) const;
-    bool captureFrameYUV(const StreamInfo& si, CachedStreamBuffer* dst) const;
-    bool captureFrameRGBA(const StreamInfo& si, CachedStreamBuffer* dst) const;
+    bool captureFrameYUV(const StreamInfo& si, CachedStreamBuffer* dst,
+                         const SourceFrame* source) const;
+    bool captureFrameRGBA(const StreamInfo& si, CachedStreamBuffer* dst,
+                          const SourceFrame* source) const;
     DelayedStreamBuffer captureFrameRAW16(const StreamInfo& si,
-                                          CachedStreamBuffer* csb) const;
+                                          CachedStreamBuffer* csb,
+                                          const SourceFrame* source) const;
     DelayedStreamBuffer captureFrameJpeg(const StreamInfo& si,
-                                         CachedStreamBuffer* csb) const;
-    const native_handle_t* captureFrameForCompressing(Rect<uint16_t> dim,
+                                         CachedStreamBuffer* csb,
+                                         const SourceFrame* source) const;
+    const native_handle_t* captureFrameForCompressing(const StreamInfo& si,
                                                       PixelFormat bufferFormat,
-                                                      uint32_t qemuFormat) const;
+                                                      uint32_t qemuFormat,
+                                                      const SourceFrame* source) const;
     bool queryFrame(Rect<uint16_t> dim, uint32_t pixelFormat,
                     float exposureComp, uint64_t dataOffset) const;
 
     std::vector<StreamInfo> mStreams;
     base::unique_fd mQemuChannel;
+
+    // Requests with several outputs query the host once into this buffer,
+    // kept between requests.
+    const native_handle_t* mSourceImage = nullptr;
+    Rect<uint16_t> mSourceImageSize;
 };
 
 }  // namespace hw
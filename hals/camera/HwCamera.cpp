@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <android-base/properties.h>
 #include <hardware/camera3.h>
 #include <ui/GraphicBufferMapper.h>
 
@@ -264,8 +265,11 @@ float HwCamera::getMinimumFocusDistance() const {
     return 0.1;
 }
 
+// Frames in flight between the capture and the result, see CameraDeviceSession.
 int32_t HwCamera::getPipelineMaxDepth() const {
-    return 4;
+    static const int32_t depth = base::GetIntProperty<int32_t>(
+        "ro.boot.qemu.camera.pipeline_max_depth", 4, 1, 8);
+    return depth;
 }
 
 uint32_t HwCamera::getAvailableCapabilitiesBitmap() const {
@@ -39,9 +39,9 @@ using namespace std::literals;
 namespace {
 constexpr char kClass[] = "MinigbmQemuCamera";
 
-constexpr uint64_t kDelayedBufferAllocUsage =
+constexpr BufferUsage kDelayedBufferAllocUsage = static_cast<BufferUsage>(
     static_cast<uint64_t>(BufferUsage::CAMERA_OUTPUT) |
-    static_cast<uint64_t>(BufferUsage::CPU_READ_OFTEN);
+    static_cast<uint64_t>(BufferUsage::CPU_READ_OFTEN));
 
 }  // namespace
 
@@ -56,6 +56,8 @@ bool MinigbmQemuCamera::configure(const CameraMetadata& sessionParams,
                                   const HalStream* halStreams) {
     constexpr std::string_view kConfigureQueryPrefix = "configure streams="sv;
 
+    mStreams.clear();  // drop the old pools before the new ones fill up
+
     std::string query;
     query.reserve(kConfigureQueryPrefix.size() + 30U * nStreams);
     query.append(kConfigureQueryPrefix);
@@ -74,10 +76,16 @@ bool MinigbmQemuCamera::configure(const CameraMetadata& sessionParams,
         switch (si.format) {
         case PixelFormat::BLOB:
             hostFormat = PixelFormat::YCBCR_420_888;
+            si.bufferPool = std::make_shared<BufferPool>(si.size, hostFormat,
+                                                         kDelayedBufferAllocUsage,
+                                                         halStreams->maxBuffers, kClass);
             break;
 
         case PixelFormat::RAW16:
             hostFormat = PixelFormat::RGBA_8888;
+            si.bufferPool = std::make_shared<BufferPool>(si.size, hostFormat,
+                                                         kDelayedBufferAllocUsage,
+                                                         halStreams->maxBuffers, kClass);
             break;
 
         default:
@@ -167,77 +175,63 @@ MinigbmQemuCamera::processCaptureRequest(CameraMetadata metadataUpdate,
         }
 
         switch (si->format) {
-        case PixelFormat::BLOB: {
+        case PixelFormat::BLOB:
+            captureBuf = si->bufferPool->acquire();
+            if (captureBuf) {
                 const Rect<uint16_t> imageSize = si->size;
-                GraphicBufferAllocator& gba = GraphicBufferAllocator::get();
-                uint32_t stride;
-                if (gba.allocate(imageSize.width, imageSize.height,
-                                 static_cast<int>(PixelFormat::YCBCR_420_888), 1,
-                                 kDelayedBufferAllocUsage, &captureBuf, &stride,
-                                 "MinigbmQemuCamera") == NO_ERROR) {
-                    CameraMetadata metadata = mCaptureResultMetadata;
-                    const size_t jpegBufferSize = si->blobBufferSize;
-                    delayedOutputBuffers.push_back([captureBuf, csb, imageSize, jpegBufferSize,
-                                                    metadata = std::move(metadata)]
-                                                   (const bool ok) -> StreamBuffer {
-                        StreamBuffer sb;
-                        if (ok && csb->waitAcquireFence(100)) {
-                            android_ycbcr imageYcbcr;
-                            if (GraphicBufferMapper::get().lockYCbCr(
-                                    captureBuf, static_cast<uint32_t>(BufferUsage::CPU_READ_OFTEN),
-                                    {imageSize.width, imageSize.height}, &imageYcbcr) == NO_ERROR) {
-                                sb = csb->finish(compressJpeg(imageSize, imageYcbcr, metadata,
-                                                              csb->getBuffer(), jpegBufferSize));
-                                LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(captureBuf) != NO_ERROR);
-                            } else {
-                                sb = csb->finish(FAILURE(false));
-                            }
+                CameraMetadata metadata = mCaptureResultMetadata;
+                const size_t jpegBufferSize = si->blobBufferSize;
+                delayedOutputBuffers.push_back([captureBuf, csb, imageSize, jpegBufferSize,
+                                                bufferPool = si->bufferPool,
+                                                metadata = std::move(metadata)]
+                                               (const bool ok) -> StreamBuffer {
+                    StreamBuffer sb;
+                    if (ok && csb->waitAcquireFence(100)) {
+                        android_ycbcr imageYcbcr;
+                        if (GraphicBufferMapper::get().lockYCbCr(
+                                captureBuf, static_cast<uint32_t>(BufferUsage::CPU_READ_OFTEN),
+                                {imageSize.width, imageSize.height}, &imageYcbcr) == NO_ERROR) {
+                            sb = csb->finish(compressJpeg(imageSize, imageYcbcr, metadata,
+                                                          csb->getBuffer(), jpegBufferSize));
+                            LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(captureBuf) != NO_ERROR);
                         } else {
-                            sb = csb->finish(false);
+                            sb = csb->finish(FAILURE(false));
                         }
+                    } else {
+                        sb = csb->finish(false);
+                    }
 
-                        GraphicBufferAllocator::get().free(captureBuf);
-                        return sb;
-                    });
-                } else {
-                    captureBuf = nullptr;
-                }
+                    bufferPool->release(captureBuf);
+                    return sb;
+                });
             }
             break;
 
-        case PixelFormat::RAW16: {
+        case PixelFormat::RAW16:
+            captureBuf = si->bufferPool->acquire();
+            if (captureBuf) {
                 const Rect<uint16_t> imageSize = si->size;
-                GraphicBufferAllocator& gba = GraphicBufferAllocator::get();
-                uint32_t stride;
-                if (gba.allocate(imageSize.width, imageSize.height,
-                                 static_cast<int>(PixelFormat::RGBA_8888), 1,
-                                 kDelayedBufferAllocUsage, &captureBuf, &stride,
-                                 "MinigbmQemuCamera") == NO_ERROR) {
-                    CameraMetadata metadata = mCaptureResultMetadata;
-                    delayedOutputBuffers.push_back([captureBuf, csb, imageSize,
-                                                    metadata = std::move(metadata)]
-                                                   (const bool ok) -> StreamBuffer {
-                        StreamBuffer sb;
-                        if (ok && csb->waitAcquireFence(100)) {
-                            void* mem = nullptr;
-                            if (GraphicBufferMapper::get().lock(
-                                    captureBuf, static_cast<uint32_t>(BufferUsage::CPU_READ_OFTEN),
-                                    {imageSize.width, imageSize.height}, &mem) == NO_ERROR) {
-                                sb = csb->finish(convertRGBAtoRAW16(imageSize, mem, csb->getBuffer()));
-                                LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(captureBuf) != NO_ERROR);
-                            } else {
-                                sb = csb->finish(FAILURE(false));
-                            }
+                delayedOutputBuffers.push_back([captureBuf, csb, imageSize,
+                                                bufferPool = si->bufferPool]
+                                               (const bool ok) -> StreamBuffer {
+                    StreamBuffer sb;
+                    if (ok && csb->waitAcquireFence(100)) {
+                        void* mem = nullptr;
+                        if (GraphicBufferMapper::get().lock(
+                                captureBuf, static_cast<uint32_t>(BufferUsage::CPU_READ_OFTEN),
+                                {imageSize.width, imageSize.height}, &mem) == NO_ERROR) {
+                            sb = csb->finish(convertRGBAtoRAW16(imageSize, mem, csb->getBuffer()));
+                            LOG_ALWAYS_FATAL_IF(GraphicBufferMapper::get().unlock(captureBuf) != NO_ERROR);
                         } else {
-                            sb = csb->finish(false);
+                            sb = csb->finish(FAILURE(false));
                         }
+                    } else {
+                        sb = csb->finish(false);
+                    }
 
-                        GraphicBufferAllocator::get().free(captureBuf);
-                        return sb;
-                    });
-                } else {
-                    captureBuf = nullptr;
-                }
+                    bufferPool->release(captureBuf);
+                    return sb;
+                });
             }
             break;
 
@@ -272,8 +266,8 @@ failCsb:    outputBuffers.push_back(csb->finish(false));
 
         for (const DelayedStreamBuffer& dsb : delayedOutputBuffers) {
             outputBuffers.push_back(dsb(false));
-            delayedOutputBuffers.clear();
         }
+        delayedOutputBuffers.clear();
     }
 
     return make_tuple((mQemuChannel.ok() ? mFrameDurationNs : FAILURE(-1)),
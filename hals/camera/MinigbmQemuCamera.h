@@ -16,11 +16,13 @@
 
 #pragma once
 
+#include <memory>
 #include <vector>
 
 #include <gfxstream/guest/GfxStreamGralloc.h>
 
 #include "BaseQemuCamera.h"
+#include "BufferPool.h"
 
 namespace android {
 namespace hardware {
@@ -46,6 +48,7 @@ private:
         uint32_t blobBufferSize;
         PixelFormat format;
         Rect<uint16_t> size;
+        std::shared_ptr<BufferPool> bufferPool;  // for BLOB and RAW16
     };
 
     const std::unique_ptr<gfxstream::Gralloc> mGfxGralloc;
@@ -14,6 +14,12 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE4_1__)
+#include <smmintrin.h>
+#endif
 #include <libyuv/convert.h>
 #include "converters.h"
 #include "debug.h"
@@ -51,6 +57,224 @@ constexpr int32_t kCx_Clamp = 255 << kCx_Shift;
 #define RGB2CB(R, G, B) (kCB_R * (R) + kCB_G * (G) + kCB_B * (B) + kCx_Add)
 #define RGB2CR(R, G, B) (kCR_R * (R) + kCR_G * (G) + kCR_B * (B) + kCx_Add)
 
+namespace {
+
+// Converts two rows of `width` RGBA pixels. The loop goes through the RGBA
+// image 2rows X 2columns at once. Each four RGBA pixels produce four Y values
+// and one {Cb, Cr} pair. R, G and B components of those 4 pixels are averaged
+// (this is why they are called R4, G4 and B4) before converting to the
+// {Cb, Cr} pair. The code does not have a separate divizion by 4 to average
+// the color components, instead `2` is added to the Cx shift.
+void rgba2yuvRows(size_t width, const uint32_t* r0, const uint32_t* r1,
+                  uint8_t* y0, uint8_t* y1, uint8_t* cb0, uint8_t* cr0,
+                  const size_t chromaStep) {
+    for (; width > 0; width -= 2, r0 += 2, r1 += 2, y0 += 2, y1 += 2,
+                      cb0 += chromaStep, cr0 += chromaStep) {
+        int32_t r4;
+        int32_t g4;
+        int32_t b4;
+        int32_t tmp0;
+        int32_t tmp1;
+
+        {
+            const uint32_t p00 = r0[0];
+            const uint32_t p01 = r0[1];
+            const int32_t r00 = p00 & 0xFF;
+            const int32_t r01 = p01 & 0xFF;
+            const int32_t g00 = (p00 >> 8) & 0xFF;
+            const int32_t g01 = (p01 >> 8) & 0xFF;
+            const int32_t b00 = (p00 >> 16) & 0xFF;
+            const int32_t b01 = (p01 >> 16) & 0xFF;
+            r4 = r00 + r01;
+            g4 = g00 + g01;
+            b4 = b00 + b01;
+            tmp0 = RGB2Y(r00, g00, b00);
+            tmp1 = RGB2Y(r01, g01, b01);
+            tmp0 = CLAMP_SHIFT(tmp0, 0, kY_Clamp, kY_Shift);
+            tmp1 = CLAMP_SHIFT(tmp1, 0, kY_Clamp, kY_Shift);
+            y0[0] = tmp0;
+            y0[1] = tmp1;
+        }
+        {
+            const uint32_t p10 = r1[0];
+            const uint32_t p11 = r1[1];
+            const int32_t r10 = p10 & 0xFF;
+            const int32_t r11 = p11 & 0xFF;
+            const int32_t g10 = (p10 >> 8) & 0xFF;
+            const int32_t g11 = (p11 >> 8) & 0xFF;
+            const int32_t b10 = (p10 >> 16) & 0xFF;
+            const int32_t b11 = (p11 >> 16) & 0xFF;
+            r4 += (r10 + r11);
+            g4 += (g10 + g11);
+            b4 += (b10 + b11);
+            tmp0 = RGB2Y(r10, g10, b10);
+            tmp1 = RGB2Y(r11, g11, b11);
+            tmp0 = CLAMP_SHIFT(tmp0, 0, kY_Clamp, kY_Shift);
+            tmp1 = CLAMP_SHIFT(tmp1, 0, kY_Clamp, kY_Shift);
+            y1[0] = tmp0;
+            y1[1] = tmp1;
+        }
+
+        tmp0 = RGB2CB(r4, g4, b4);
+        tmp1 = RGB2CR(r4, g4, b4);
+        tmp0 = CLAMP_SHIFT(tmp0, 0, kCx_Clamp, kCx_Shift);
+        tmp1 = CLAMP_SHIFT(tmp1, 0, kCx_Clamp, kCx_Shift);
+        *cb0 = tmp0;
+        *cr0 = tmp1;
+    }
+}
+
+// Same as rgba2yuvRows (bit exact) for interleaved chroma (NV12 and NV21),
+// `cx` points to the first chroma byte of the pair. Returns the number of
+// pixels converted, the caller converts the rest with rgba2yuvRows.
+#if defined(__ARM_NEON)
+uint8x8_t rgb2ySimd(const uint16x8_t r, const uint16x8_t g, const uint16x8_t b) {
+    uint32x4_t lo = vmull_n_u16(vget_low_u16(r), kY_R);
+    lo = vmlal_n_u16(lo, vget_low_u16(g), kY_G);
+    lo = vmlal_n_u16(lo, vget_low_u16(b), kY_B);
+    uint32x4_t hi = vmull_n_u16(vget_high_u16(r), kY_R);
+    hi = vmlal_n_u16(hi, vget_high_u16(g), kY_G);
+    hi = vmlal_n_u16(hi, vget_high_u16(b), kY_B);
+
+    // RGB2Y is always within [0, kY_Clamp), kY_Add is zero
+    return vmovn_u16(vcombine_u16(vshrn_n_u32(lo, kY_Shift), vshrn_n_u32(hi, kY_Shift)));
+}
+
+void rgb2ySimd(const uint8x16x4_t& rgba, uint8_t* y) {
+    vst1q_u8(y, vcombine_u8(
+        rgb2ySimd(vmovl_u8(vget_low_u8(rgba.val[0])),
+                  vmovl_u8(vget_low_u8(rgba.val[1])),
+                  vmovl_u8(vget_low_u8(rgba.val[2]))),
+        rgb2ySimd(vmovl_u8(vget_high_u8(rgba.val[0])),
+                  vmovl_u8(vget_high_u8(rgba.val[1])),
+                  vmovl_u8(vget_high_u8(rgba.val[2])))));
+}
+
+// The coefficient for `b` (Cb) or `r` (Cr) is 0.5 which does not fit into
+// int16_t, it is applied as a shift.
+int32x4_t rgb2cxSimd(const int16x4_t half, const int16x4_t x1, const int32_t k1,
+                     const int16x4_t x2, const int32_t k2) {
+    static_assert(kCB_B == (1 << 15));
+    static_assert(kCR_R == (1 << 15));
+
+    int32x4_t cx = vaddq_s32(vdupq_n_s32(kCx_Add), vshll_n_s16(half, 15));
+    cx = vmlal_n_s16(cx, x1, k1);
+    cx = vmlal_n_s16(cx, x2, k2);
+    cx = vmaxq_s32(vminq_s32(cx, vdupq_n_s32(kCx_Clamp)), vdupq_n_s32(0));
+    return vshrq_n_s32(cx, kCx_Shift);
+}
+
+size_t rgba2nvRowsSimd(const size_t width, const uint32_t* r0, const uint32_t* r1,
+                       uint8_t* y0, uint8_t* y1, uint8_t* cx, const bool cbFirst) {
+    size_t col = 0;
+    for (; (width - col) >= 16; col += 16, r0 += 16, r1 += 16, y0 += 16, y1 += 16, cx += 16) {
+        // val[0] is R, val[1] is G, val[2] is B
+        const uint8x16x4_t p0 = vld4q_u8(reinterpret_cast<const uint8_t*>(r0));
+        const uint8x16x4_t p1 = vld4q_u8(reinterpret_cast<const uint8_t*>(r1));
+        rgb2ySimd(p0, y0);
+        rgb2ySimd(p1, y1);
+
+        const int16x8_t r4 = vreinterpretq_s16_u16(
+            vaddq_u16(vpaddlq_u8(p0.val[0]), vpaddlq_u8(p1.val[0])));
+        const int16x8_t g4 = vreinterpretq_s16_u16(
+            vaddq_u16(vpaddlq_u8(p0.val[1]), vpaddlq_u8(p1.val[1])));
+        const int16x8_t b4 = vreinterpretq_s16_u16(
+            vaddq_u16(vpaddlq_u8(p0.val[2]), vpaddlq_u8(p1.val[2])));
+
+        const uint8x8_t cb = vqmovun_s16(vcombine_s16(
+            vmovn_s32(rgb2cxSimd(vget_low_s16(b4), vget_low_s16(r4), kCB_R,
+                                 vget_low_s16(g4), kCB_G)),
+            vmovn_s32(rgb2cxSimd(vget_high_s16(b4), vget_high_s16(r4), kCB_R,
+                                 vget_high_s16(g4), kCB_G))));
+        const uint8x8_t cr = vqmovun_s16(vcombine_s16(
+            vmovn_s32(rgb2cxSimd(vget_low_s16(r4), vget_low_s16(g4), kCR_G,
+                                 vget_low_s16(b4), kCR_B)),
+            vmovn_s32(rgb2cxSimd(vget_high_s16(r4), vget_high_s16(g4), kCR_G,
+                                 vget_high_s16(b4), kCR_B))));
+
+        uint8x8x2_t cbcr;
+        cbcr.val[0] = cbFirst ? cb : cr;
+        cbcr.val[1] = cbFirst ? cr : cb;
+        vst2_u8(cx, cbcr);
+    }
+
+    return col;
+}
+#elif defined(__SSE4_1__)
+// Unpacks four RGBA pixels into int32 R, G and B.
+void unpackRgbSimd(const uint32_t* rgba, __m128i& r, __m128i& g, __m128i& b) {
+    const __m128i mask = _mm_set1_epi32(0xFF);
+    const __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rgba));
+    r = _mm_and_si128(p, mask);
+    g = _mm_and_si128(_mm_srli_epi32(p, 8), mask);
+    b = _mm_and_si128(_mm_srli_epi32(p, 16), mask);
+}
+
+__m128i rgb2ySimd(const __m128i r, const __m128i g, const __m128i b) {
+    const __m128i y = _mm_add_epi32(
+        _mm_add_epi32(_mm_mullo_epi32(r, _mm_set1_epi32(kY_R)),
+                      _mm_mullo_epi32(g, _mm_set1_epi32(kY_G))),
+        _mm_mullo_epi32(b, _mm_set1_epi32(kY_B)));
+
+    // RGB2Y is always within [0, kY_Clamp), kY_Add is zero
+    return _mm_srli_epi32(y, kY_Shift);
+}
+
+__m128i rgb2cxSimd(const __m128i r4, const __m128i g4, const __m128i b4,
+                   const int32_t kR, const int32_t kG, const int32_t kB) {
+    __m128i cx = _mm_add_epi32(
+        _mm_add_epi32(_mm_mullo_epi32(r4, _mm_set1_epi32(kR)),
+                      _mm_mullo_epi32(g4, _mm_set1_epi32(kG))),
+        _mm_add_epi32(_mm_mullo_epi32(b4, _mm_set1_epi32(kB)),
+                      _mm_set1_epi32(kCx_Add)));
+    cx = _mm_max_epi32(_mm_min_epi32(cx, _mm_set1_epi32(kCx_Clamp)), _mm_setzero_si128());
+    return _mm_srai_epi32(cx, kCx_Shift);
+}
+
+size_t rgba2nvRowsSimd(const size_t width, const uint32_t* r0, const uint32_t* r1,
+                       uint8_t* y0, uint8_t* y1, uint8_t* cx, const bool cbFirst) {
+    size_t col = 0;
+    for (; (width - col) >= 8; col += 8, r0 += 8, r1 += 8, y0 += 8, y1 += 8, cx += 8) {
+        __m128i r00, g00, b00, r01, g01, b01, r10, g10, b10, r11, g11, b11;
+        unpackRgbSimd(r0, r00, g00, b00);
+        unpackRgbSimd(r0 + 4, r01, g01, b01);
+        unpackRgbSimd(r1, r10, g10, b10);
+        unpackRgbSimd(r1 + 4, r11, g11, b11);
+
+        // all values fit into uint8_t, packs/packus do not saturate
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(y0), _mm_packus_epi16(
+            _mm_packs_epi32(rgb2ySimd(r00, g00, b00), rgb2ySimd(r01, g01, b01)),
+            _mm_setzero_si128()));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(y1), _mm_packus_epi16(
+            _mm_packs_epi32(rgb2ySimd(r10, g10, b10), rgb2ySimd(r11, g11, b11)),
+            _mm_setzero_si128()));
+
+        // sums of horizontal pairs, 4 chroma samples
+        const __m128i r4 = _mm_add_epi32(_mm_hadd_epi32(r00, r01), _mm_hadd_epi32(r10, r11));
+        const __m128i g4 = _mm_add_epi32(_mm_hadd_epi32(g00, g01), _mm_hadd_epi32(g10, g11));
+        const __m128i b4 = _mm_add_epi32(_mm_hadd_epi32(b00, b01), _mm_hadd_epi32(b10, b11));
+
+        const __m128i cb = rgb2cxSimd(r4, g4, b4, kCB_R, kCB_G, kCB_B);
+        const __m128i cr = rgb2cxSimd(r4, g4, b4, kCR_R, kCR_G, kCR_B);
+        const __m128i c0 = cbFirst ? cb : cr;
+        const __m128i c1 = cbFirst ? cr : cb;
+
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(cx), _mm_packus_epi16(
+            _mm_packs_epi32(_mm_unpacklo_epi32(c0, c1), _mm_unpackhi_epi32(c0, c1)),
+            _mm_setzero_si128()));
+    }
+
+    return col;
+}
+#else
+size_t rgba2nvRowsSimd(size_t, const uint32_t*, const uint32_t*,
+                       uint8_t*, uint8_t*, uint8_t*, bool) {
+    return 0;
+}
+#endif
+
+}  // namespace
+
 bool rgba2yuv(const size_t width, size_t height,
               const uint32_t* rgba, const android_ycbcr& ycbcr) {
     if ((width & 1) || (height & 1)) {
@@ -75,75 +299,22 @@ bool rgba2yuv(const size_t width, size_t height,
     uint8_t* cb = static_cast<uint8_t*>(ycbcr.cb);
     uint8_t* cr = static_cast<uint8_t*>(ycbcr.cr);
 
-    // The loops below go through the RGBA image 2rows X 2columns at once.
-    // Each four RGBA pixels produce four Y values and one {Cb, Cr} pair.
-    // R, G and B components of those 4 pixels are averaged (this is why
-    // they are called R4, G4 and B4) before converting to the {Cb, Cr} pair.
-    // The code does not have a separate divizion by 4 to average the color
-    // components, instead `2` is added to the Cx shift.
+    // NV12 or NV21
+    const bool interleaved = (chromaStep == 2) && ((cr == (cb + 1)) || (cb == (cr + 1)));
+    const bool cbFirst = cr > cb;
+
     for (; height > 0; height -= 2, rgba += width2, y += ystride2,
                        cb += cstride, cr += cstride) {
         const uint32_t* r0 = rgba;
         const uint32_t* r1 = rgba + width;
         uint8_t* y0 = y;
         uint8_t* y1 = y + ystride;
-        uint8_t* cb0 = cb;
-        uint8_t* cr0 = cr;
-
-        for (size_t col = width; col > 0; col -= 2, r0 += 2, r1 += 2, y0 += 2, y1 += 2,
-                                          cb0 += chromaStep, cr0 += chromaStep) {
-            int32_t r4;
-            int32_t g4;
-            int32_t b4;
-            int32_t tmp0;
-            int32_t tmp1;
-
-            {
-                const uint32_t p00 = r0[0];
-                const uint32_t p01 = r0[1];
-                const int32_t r00 = p00 & 0xFF;
-                const int32_t r01 = p01 & 0xFF;
-                const int32_t g00 = (p00 >> 8) & 0xFF;
-                const int32_t g01 = (p01 >> 8) & 0xFF;
-                const int32_t b00 = (p00 >> 16) & 0xFF;
-                const int32_t b01 = (p01 >> 16) & 0xFF;
-                r4 = r00 + r01;
-                g4 = g00 + g01;
-                b4 = b00 + b01;
-                tmp0 = RGB2Y(r00, g00, b00);
-                tmp1 = RGB2Y(r01, g01, b01);
-                tmp0 = CLAMP_SHIFT(tmp0, 0, kY_Clamp, kY_Shift);
-                tmp1 = CLAMP_SHIFT(tmp1, 0, kY_Clamp, kY_Shift);
-                y0[0] = tmp0;
-                y1[0] = tmp1;
-            }
-            {
-                const uint32_t p10 = r1[0];
-                const uint32_t p11 = r1[1];
-                const int32_t r10 = p10 & 0xFF;
-                const int32_t r11 = p11 & 0xFF;
-                const int32_t g10 = (p10 >> 8) & 0xFF;
-                const int32_t g11 = (p11 >> 8) & 0xFF;
-                const int32_t b10 = (p10 >> 16) & 0xFF;
-                const int32_t b11 = (p11 >> 16) & 0xFF;
-                r4 += (r10 + r11);
-                g4 += (g10 + g11);
-                b4 += (b10 + b11);
-                tmp0 = RGB2Y(r10, g10, b10);
-                tmp1 = RGB2Y(r11, g11, b11);
-                tmp0 = CLAMP_SHIFT(tmp0, 0, kY_Clamp, kY_Shift);
-                tmp1 = CLAMP_SHIFT(tmp1, 0, kY_Clamp, kY_Shift);
-                y1[0] = tmp0;
-                y1[1] = tmp1;
-            }
-
-            tmp0 = RGB2CB(r4, g4, b4);
-            tmp1 = RGB2CR(r4, g4, b4);
-            tmp0 = CLAMP_SHIFT(tmp0, 0, kCx_Clamp, kCx_Shift);
-            tmp1 = CLAMP_SHIFT(tmp1, 0, kCx_Clamp, kCx_Shift);
-            *cb0 = tmp0;
-            *cr0 = tmp1;
-        }
+
+        const size_t done = interleaved ?
+            rgba2nvRowsSimd(width, r0, r1, y0, y1, std::min(cb, cr), cbFirst) : 0;
+
+        rgba2yuvRows(width - done, r0 + done, r1 + done, y0 + done, y1 + done,
+                     cb + done, cr + done, chromaStep);
     }
 
     return true;
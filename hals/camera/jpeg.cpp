@@ -19,6 +19,13 @@
 #include <inttypes.h>
 #include <setjmp.h>
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 extern "C" {
@@ -40,11 +47,91 @@ namespace implementation {
 namespace jpeg {
 namespace {
 constexpr int kJpegMCUSize = 16;  // we have to feed `jpeg_write_raw_data` in multiples of this
+constexpr unsigned kMaxStrips = 4;
+constexpr int kMinStripMCURows = 16;  // smaller images are not worth the threads
+
+// A few threads shared by all the images being compressed (one per delayed
+// capture thread), so a burst does not start threads per image. The caller
+// runs the first task and then takes back whatever no helper has started,
+// it waits only for the tasks a helper is running.
+struct Helpers {
+    static Helpers& get() {
+        // never destroyed, the threads run as long as the process
+        static Helpers* const helpers = new Helpers(std::clamp(
+            std::thread::hardware_concurrency(), 2U, kMaxStrips + 1) - 1);
+        return *helpers;
+    }
+
+    void run(const std::function<void()>* const tasks, const size_t nTasks) {
+        std::vector<Task> queued(nTasks - 1);
+        {
+            std::lock_guard lock(mMutex);
+            for (size_t i = 1; i < nTasks; ++i) {
+                queued[i - 1].fn = &tasks[i];
+                mQueue.push_back(&queued[i - 1]);
+            }
+        }
+        mAvailable.notify_all();
+
+        tasks[0]();
+
+        for (Task& task : queued) {
+            std::unique_lock lock(mMutex);
+            if (task.taken) {
+                mDone.wait(lock, [&task](){ return task.done; });
+            } else {
+                mQueue.erase(std::find(mQueue.begin(), mQueue.end(), &task));
+                lock.unlock();
+                (*task.fn)();
+            }
+        }
+    }
+
+private:
+    struct Task {
+        const std::function<void()>* fn = nullptr;
+        bool taken = false;  // requires mMutex
+        bool done = false;   // requires mMutex
+    };
+
+    explicit Helpers(const unsigned nThreads) {
+        for (unsigned i = 0; i < nThreads; ++i) {
+            std::thread(&Helpers::threadLoop, this).detach();
+        }
+    }
+
+    void threadLoop() {
+        std::unique_lock lock(mMutex);
+        while (true) {
+            mAvailable.wait(lock, [this](){ return !mQueue.empty(); });
+            Task* const task = mQueue.front();
+            mQueue.pop_front();
+            task->taken = true;
+
+            lock.unlock();
+            (*task->fn)();
+            lock.lock();
+
+            task->done = true;
+            mDone.notify_all();
+        }
+    }
+
+    std::deque<Task*> mQueue;
+    std::condition_variable mAvailable;
+    std::condition_variable mDone;
+    std::mutex mMutex;
+};
 
-// compressYUVImplPixelsFast handles the case where the image width is a multiple
-// of kJpegMCUSize. In this case no additional memcpy is required. See
-// compressYUVImplPixelsSlow below for the cases where the image width is not
-// a multiple of kJpegMCUSize.
+int alignUpToMCU(const int x) {
+    return (x + kJpegMCUSize - 1) / kJpegMCUSize * kJpegMCUSize;
+}
+
+// compressYUVImplPixelsFast handles the case where the image rows can be read
+// rounded up to a multiple of kJpegMCUSize (the width is a multiple of
+// kJpegMCUSize or the strides leave room for the padding, JPEG encodes
+// whatever is there and decoders crop it). In this case no additional memcpy
+// is required. See compressYUVImplPixelsSlow below for the other cases.
 bool compressYUVImplPixelsFast(const android_ycbcr& image, jpeg_compress_struct* cinfo) {
     const uint8_t* y[kJpegMCUSize];
     const uint8_t* cb[kJpegMCUSize / 2];
@@ -164,9 +251,10 @@ struct JpegErrorMgr : public jpeg_error_mgr {
     jmp_buf jumpBuffer;
 };
 
+// `restartInterval` is in MCUs, 0 - no restart markers.
 bool compressYUVImpl(const android_ycbcr& image, const Rect<uint16_t> imageSize,
                      unsigned char* const rawExif, const unsigned rawExifSize,
-                     const int quality,
+                     const int quality, const unsigned restartInterval,
                      jpeg_destination_mgr* sink) {
     if (image.chroma_step != 1) {
         return FAILURE(false);
@@ -188,6 +276,8 @@ bool compressYUVImpl(const android_ycbcr& image, const Rect<uint16_t> imageSize,
     jpeg_default_colorspace(&cinfo);
     cinfo.raw_data_in = TRUE;
     cinfo.dct_method = JDCT_IFAST;
+    cinfo.optimize_coding = FALSE;  // strips must share the Huffman tables
+    cinfo.restart_interval = restartInterval;
     cinfo.comp_info[0].h_samp_factor = 2;
     cinfo.comp_info[0].v_samp_factor = 2;
     cinfo.comp_info[1].h_samp_factor = 1;
@@ -207,13 +297,12 @@ bool compressYUVImpl(const android_ycbcr& image, const Rect<uint16_t> imageSize,
         jpeg_write_marker(&cinfo, JPEG_APP0 + 1, rawExif, rawExifSize);
     }
 
-    if (imageSize.width % kJpegMCUSize) {
-        const size_t alignedWidth =
-            ((imageSize.width + kJpegMCUSize) / kJpegMCUSize) * kJpegMCUSize;
+    const size_t alignedWidth = alignUpToMCU(imageSize.width);
+    if ((image.ystride >= alignedWidth) && ((image.cstride * 2) >= alignedWidth)) {
+        result = compressYUVImplPixelsFast(image, &cinfo);
+    } else {
         alignedMemory.resize(alignedWidth * kJpegMCUSize * 3 / 2);
         result = compressYUVImplPixelsSlow(image, &cinfo, alignedWidth, alignedMemory.data());
-    } else {
-        result = compressYUVImplPixelsFast(image, &cinfo);
     }
 
     jpeg_finish_compress(&cinfo);
@@ -222,10 +311,12 @@ bool compressYUVImpl(const android_ycbcr& image, const Rect<uint16_t> imageSize,
     return result;
 }
 
+// Box filters `srcYCbCr` down to `dstSize` into `dstData`, `dstData` is
+// reused across calls (only grows).
 android_ycbcr resizeYUV(const android_ycbcr& srcYCbCr,
                         const Rect<uint16_t> srcSize,
                         const Rect<uint16_t> dstSize,
-                        std::vector<uint8_t>* pDstData) {
+                        std::vector<uint8_t>* dstData) {
     if (srcYCbCr.chroma_step != 1) {
         return FAILURE(android_ycbcr());
     }
@@ -236,8 +327,11 @@ android_ycbcr resizeYUV(const android_ycbcr& srcYCbCr,
         return FAILURE(android_ycbcr());
     }
 
-    std::vector<uint8_t> dstData(yuv::NV21size(dstWidth, dstHeight));
-    const android_ycbcr dstYCbCr = yuv::NV21init(dstWidth, dstHeight, dstData.data());
+    const size_t dstDataSize = yuv::NV21size(dstWidth, dstHeight);
+    if (dstData->size() < dstDataSize) {
+        dstData->resize(dstDataSize);
+    }
+    const android_ycbcr dstYCbCr = yuv::NV21init(dstWidth, dstHeight, dstData->data());
 
     const int result = libyuv::I420Scale(
         static_cast<const uint8_t*>(srcYCbCr.y), srcYCbCr.ystride,
@@ -248,12 +342,11 @@ android_ycbcr resizeYUV(const android_ycbcr& srcYCbCr,
         static_cast<uint8_t*>(dstYCbCr.cb), dstYCbCr.cstride,
         static_cast<uint8_t*>(dstYCbCr.cr), dstYCbCr.cstride,
         dstWidth, dstHeight,
-        libyuv::kFilterBilinear);
+        libyuv::kFilterBox);
 
     if (result) {
         return FAILURE_V(android_ycbcr(), "libyuv::I420Scale failed with %d", result);
     } else {
-        *pDstData = std::move(dstData);
         return dstYCbCr;
     }
 }
@@ -272,6 +365,222 @@ struct StaticBufferSink : public jpeg_destination_mgr {
     static void termDestinationS(j_compress_ptr) {}
 };
 
+// Grows as needed, the memory is not initialized.
+struct GrowingBufferSink : public jpeg_destination_mgr {
+    explicit GrowingBufferSink(const size_t initialCapacity)
+            : data(new uint8_t[initialCapacity])
+            , capacity(initialCapacity) {
+        next_output_byte = data.get();
+        free_in_buffer = capacity;
+        init_destination = &initDestinationS;
+        empty_output_buffer = &emptyOutputBufferS;
+        term_destination = &termDestinationS;
+    }
+
+    size_t size() const { return capacity - free_in_buffer; }
+
+    static void initDestinationS(j_compress_ptr) {}
+    static boolean emptyOutputBufferS(j_compress_ptr cinfo) {
+        GrowingBufferSink* self = static_cast<GrowingBufferSink*>(cinfo->dest);
+        const size_t oldCapacity = self->capacity;
+        std::unique_ptr<uint8_t[]> newData(new uint8_t[oldCapacity * 2]);
+        memcpy(newData.get(), self->data.get(), oldCapacity);
+        self->data = std::move(newData);
+        self->capacity = oldCapacity * 2;
+        self->next_output_byte = self->data.get() + oldCapacity;
+        self->free_in_buffer = oldCapacity;
+        return TRUE;
+    }
+    static void termDestinationS(j_compress_ptr) {}
+
+    std::unique_ptr<uint8_t[]> data;
+    size_t capacity;
+};
+
+// Returns the offset of the entropy coded data (right after the SOS segment)
+// and patches the image height in the SOF segment if `height` is not 0.
+size_t findScanData(uint8_t* jpeg, const size_t size, const uint16_t height) {
+    size_t i = 2;  // SOI
+    while ((i + 4) <= size) {
+        if (jpeg[i] != 0xFF) {
+            return FAILURE(0);
+        }
+
+        const uint8_t marker = jpeg[i + 1];
+        const size_t len = (size_t(jpeg[i + 2]) << 8) | jpeg[i + 3];
+        if (marker == 0xDA) {  // SOS
+            return i + 2 + len;
+        } else if (height && (marker >= 0xC0) && (marker <= 0xC2) && ((i + 7) <= size)) {
+            jpeg[i + 5] = height >> 8;
+            jpeg[i + 6] = height & 0xFF;
+        }
+        i += 2 + len;
+    }
+
+    return FAILURE(0);
+}
+
+// Compresses horizontal strips of `restartInterval` MCUs (whole MCU rows)
+// on up to `nThreads` Helpers (the calling thread is one of them), each strip
+// by its own libjpeg instance with the same tables.
+// The strips are independent restart intervals, they are joined with RSTn
+// markers into one image using the headers from the first strip.
+size_t compressYUVStrips(const android_ycbcr& image, const Rect<uint16_t> imageSize,
+                         const int quality, const int stripMCURows, const int nStrips,
+                         const unsigned nThreads,
+                         void* const jpegData, const size_t jpegDataCapacity) {
+    const int stripHeight = stripMCURows * kJpegMCUSize;
+    const unsigned restartInterval =
+        stripMCURows * (alignUpToMCU(imageSize.width) / kJpegMCUSize);
+
+    // the sinks must not move, libjpeg points into them
+    std::vector<std::unique_ptr<GrowingBufferSink>> sinks(nStrips);
+    for (auto& sink : sinks) {
+        sink = std::make_unique<GrowingBufferSink>(jpegDataCapacity / nStrips + 4096);
+    }
+    std::vector<char> results(nStrips, 0);
+    std::atomic<int> nextStrip = 0;
+
+    const auto worker = [&]() {
+        for (int i = nextStrip++; i < nStrips; i = nextStrip++) {
+            const int row = i * stripHeight;
+            android_ycbcr strip = image;
+            strip.y = static_cast<uint8_t*>(image.y) + size_t(row) * image.ystride;
+            strip.cb = static_cast<uint8_t*>(image.cb) + size_t(row / 2) * image.cstride;
+            strip.cr = static_cast<uint8_t*>(image.cr) + size_t(row / 2) * image.cstride;
+            const Rect<uint16_t> stripSize = {
+                imageSize.width,
+                static_cast<uint16_t>(std::min(stripHeight, imageSize.height - row))
+            };
+
+            results[i] = compressYUVImpl(strip, stripSize, nullptr, 0,
+                                         quality, restartInterval, sinks[i].get());
+        }
+    };
+
+    const std::vector<std::function<void()>> workers(nThreads, worker);
+    Helpers::get().run(workers.data(), workers.size());
+
+    if (std::find(results.begin(), results.end(), 0) != results.end()) {
+        return FAILURE(0);
+    }
+
+    uint8_t* const dst = static_cast<uint8_t*>(jpegData);
+    size_t size = 0;
+    for (int i = 0; i < nStrips; ++i) {
+        GrowingBufferSink& sink = *sinks[i];
+        const size_t sinkSize = sink.size();
+        const size_t scanData = findScanData(sink.data.get(), sinkSize,
+                                             (i ? 0 : imageSize.height));
+        if (!scanData || ((scanData + 2) > sinkSize)) {
+            return FAILURE(0);
+        }
+
+        // everything from the first strip but EOI, only the scan data
+        // from the others
+        const size_t begin = i ? scanData : 0;
+        const size_t chunkSize = sinkSize - 2 - begin;
+        if ((size + chunkSize + 4) > jpegDataCapacity) {
+            return FAILURE(0);
+        }
+
+        if (i) {
+            dst[size++] = 0xFF;
+            dst[size++] = 0xD0 + ((i - 1) & 7);  // RSTn
+        }
+        memcpy(dst + size, sink.data.get() + begin, chunkSize);
+        size += chunkSize;
+    }
+
+    dst[size++] = 0xFF;
+    dst[size++] = 0xD9;  // EOI
+    return size;
+}
+
+size_t compressYUVParallel(const android_ycbcr& image, const Rect<uint16_t> imageSize,
+                           const int quality,
+                           void* const jpegData, const size_t jpegDataCapacity) {
+    const int mcuRows = alignUpToMCU(imageSize.height) / kJpegMCUSize;
+    const int mcusPerRow = alignUpToMCU(imageSize.width) / kJpegMCUSize;
+    const unsigned nThreads = std::min(
+        {kMaxStrips, std::max(std::thread::hardware_concurrency(), 1U),
+         unsigned(mcuRows / kMinStripMCURows)});
+
+    if (nThreads > 1) {
+        // the restart interval (one strip) is at most 65535 MCUs
+        const int stripMCURows = std::min((mcuRows + nThreads - 1) / nThreads,
+                                          0xFFFFU / mcusPerRow);
+        const int nStrips = (mcuRows + stripMCURows - 1) / stripMCURows;
+        return compressYUVStrips(image, imageSize, quality,
+                                 stripMCURows, nStrips, nThreads,
+                                 jpegData, jpegDataCapacity);
+    } else {
+        StaticBufferSink sink(jpegData, jpegDataCapacity);
+        return compressYUVImpl(image, imageSize, nullptr, 0,
+                               quality, 0, &sink) ? (jpegDataCapacity - sink.free_in_buffer) : 0;
+    }
+}
+
+// SOI, APP1 and the largest segment
+constexpr size_t kMaxExifHeaderSize = 2 + 2 + 0xFFFF;
+
+// Compresses the thumbnail into the EXIF data.
+bool compressThumbnail(const android_ycbcr& image, const Rect<uint16_t> imageSize,
+                       const Rect<uint16_t> thumbnailSize, const int thumbnailQuality,
+                       std::vector<uint8_t>* scratch, ExifData* exifData) {
+    const android_ycbcr thumbnail = resizeYUV(image, imageSize, thumbnailSize, scratch);
+    if (!thumbnail.y) {
+        return FAILURE(false);
+    }
+
+    GrowingBufferSink sink(size_t(thumbnailSize.width) * thumbnailSize.height / 2 + 4096);
+    if (!compressYUVImpl(thumbnail, thumbnailSize, nullptr, 0,
+                         thumbnailQuality, 0, &sink)) {
+        return FAILURE(false);
+    }
+
+    const size_t thumbnailJpegSize = sink.size();
+    void* exifThumbnailJpegDataPtr = exif::exifDataAllocThumbnail(
+        exifData, thumbnailJpegSize);
+    if (!exifThumbnailJpegDataPtr) {
+        return FAILURE(false);
+    }
+
+    memcpy(exifThumbnailJpegDataPtr, sink.data.get(), thumbnailJpegSize);
+    return true;
+}
+
+// Inserts the EXIF APP1 segment after SOI (and JFIF APP0 if present) of the
+// image at `jpeg + offset`, the result starts at `jpeg`. Returns the new size.
+size_t insertExif(uint8_t* const jpeg, const size_t offset, const size_t size,
+                  const unsigned char* rawExif, const unsigned rawExifSize) {
+    const uint8_t* const src = jpeg + offset;
+    const size_t segmentSize = 2 + 2 + rawExifSize;
+    if (((rawExifSize + 2) > 0xFFFF) || (size < 4) || (segmentSize > offset)) {
+        return FAILURE(0);
+    }
+
+    size_t head = 2;  // SOI
+    if ((size >= 6) && (src[2] == 0xFF) && (src[3] == 0xE0)) {
+        head += 2 + ((size_t(src[4]) << 8) | src[5]);
+        if (head > size) {
+            return FAILURE(0);
+        }
+    }
+
+    memmove(jpeg, src, head);
+    memmove(jpeg + head + segmentSize, src + head, size - head);
+
+    uint8_t* segment = jpeg + head;
+    segment[0] = 0xFF;
+    segment[1] = JPEG_APP0 + 1;
+    segment[2] = (rawExifSize + 2) >> 8;
+    segment[3] = (rawExifSize + 2) & 0xFF;
+    memcpy(segment + 4, rawExif, rawExifSize);
+
+    return size + segmentSize;
+}
+
 constexpr int kDefaultQuality = 85;
 
 int sanitizeJpegQuality(const int quality) {
@@ -305,20 +614,13 @@ size_t compressYUV(const android_ycbcr& image,
         reinterpret_cast<const camera_metadata_t*>(metadata.metadata.data());
     camera_metadata_ro_entry_t metadataEntry;
 
-    do {
-        Rect<uint16_t> thumbnailSize = {0, 0};
-        int thumbnailQuality = 0;
-
-        if (find_camera_metadata_ro_entry(rawMetadata, ANDROID_JPEG_THUMBNAIL_SIZE,
-                                          &metadataEntry)) {
-            break;
-        } else {
-            thumbnailSize.width = metadataEntry.data.i32[0];
-            thumbnailSize.height = metadataEntry.data.i32[1];
-            if ((thumbnailSize.width <= 0) || (thumbnailSize.height <= 0)) {
-                break;
-            }
-        }
+    Rect<uint16_t> thumbnailSize = {0, 0};
+    int thumbnailQuality = 0;
+    if (!find_camera_metadata_ro_entry(rawMetadata, ANDROID_JPEG_THUMBNAIL_SIZE,
+                                       &metadataEntry) &&
+            (metadataEntry.data.i32[0] > 0) && (metadataEntry.data.i32[1] > 0)) {
+        thumbnailSize.width = metadataEntry.data.i32[0];
+        thumbnailSize.height = metadataEntry.data.i32[1];
 
         if (find_camera_metadata_ro_entry(rawMetadata, ANDROID_JPEG_THUMBNAIL_QUALITY,
                                           &metadataEntry)) {
@@ -326,29 +628,7 @@ size_t compressYUV(const android_ycbcr& image,
         } else {
             thumbnailQuality = sanitizeJpegQuality(metadataEntry.data.i32[0]);
         }
-
-        std::vector<uint8_t> thumbnailData;
-        const android_ycbcr thumbmnail = resizeYUV(imageNV21, imageSize,
-                                                   thumbnailSize, &thumbnailData);
-        if (!thumbmnail.y) {
-            return FAILURE(0);
-        }
-
-        StaticBufferSink sink(jpegData, jpegDataCapacity);
-        if (!compressYUVImpl(thumbmnail, thumbnailSize, nullptr, 0,
-                             thumbnailQuality, &sink)) {
-            return FAILURE(0);
-        }
-
-        const size_t thumbnailJpegSize = jpegDataCapacity - sink.free_in_buffer;
-        void* exifThumbnailJpegDataPtr = exif::exifDataAllocThumbnail(
-            exifData.get(), thumbnailJpegSize);
-        if (!exifThumbnailJpegDataPtr) {
-            return FAILURE(0);
-        }
-
-        memcpy(exifThumbnailJpegDataPtr, jpegData, thumbnailJpegSize);
-    } while (false);
+    }
 
     int quality;
     if (find_camera_metadata_ro_entry(rawMetadata, ANDROID_JPEG_QUALITY,
@@ -358,6 +638,38 @@ size_t compressYUV(const android_ycbcr& image,
         quality = sanitizeJpegQuality(metadataEntry.data.i32[0]);
     }
 
+    if (jpegDataCapacity <= kMaxExifHeaderSize) {
+        return FAILURE(0);
+    }
+
+    // The thumbnail is compressed on a helper while the main image is on
+    // this thread, the main image leaves room for the EXIF data which is
+    // inserted once both are done. The scratch belongs to this (long lived)
+    // thread, Helpers::run returns after the thumbnail is done.
+    static thread_local std::vector<uint8_t> thumbnailScratch;
+    std::vector<uint8_t>* const scratch = &thumbnailScratch;
+    uint8_t* const jpegData8 = static_cast<uint8_t*>(jpegData);
+    size_t imageJpegSize = 0;
+    bool thumbnailOk = true;
+
+    const std::function<void()> tasks[] = {
+        [&]() {
+            imageJpegSize = compressYUVParallel(
+                imageNV21, imageSize, quality,
+                jpegData8 + kMaxExifHeaderSize, jpegDataCapacity - kMaxExifHeaderSize);
+        },
+        [&, scratch]() {
+            thumbnailOk = compressThumbnail(imageNV21, imageSize,
+                                            thumbnailSize, thumbnailQuality,
+                                            scratch, exifData.get());
+        },
+    };
+    Helpers::get().run(tasks, (thumbnailSize.width > 0) ? 2 : 1);
+
+    if (!imageJpegSize || !thumbnailOk) {
+        return FAILURE(0);
+    }
+
     unsigned char* rawExif = nullptr;
     unsigned rawExifSize = 0;
     exif_data_save_data(const_cast<ExifData*>(exifData.get()),
@@ -366,12 +678,11 @@ size_t compressYUV(const android_ycbcr& image,
         return FAILURE(0);
     }
 
-    StaticBufferSink sink(jpegData, jpegDataCapacity);
-    const bool success = compressYUVImpl(imageNV21, imageSize, rawExif, rawExifSize,
-                                         quality, &sink);
+    const size_t size = insertExif(jpegData8, kMaxExifHeaderSize, imageJpegSize,
+                                   rawExif, rawExifSize);
     free(rawExif);
 
-    return success ? (jpegDataCapacity - sink.free_in_buffer) : 0;
+    return size;
 }
 
 }  // namespace jpeg
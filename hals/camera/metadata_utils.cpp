@@ -16,8 +16,10 @@
 
 #include <inttypes.h>
 
+#include <algorithm>
 #include <memory>
 #include <numeric>
+#include <string.h>
 
 #include <system/camera_metadata.h>
 
@@ -39,6 +41,21 @@ struct CameraMetadataDeleter {
 
 using CameraMetadataPtr = std::unique_ptr<camera_metadata_t, CameraMetadataDeleter>;
 
+bool updateEntryInPlace(camera_metadata_t* raw, const uint32_t tag, const void* data,
+                        const size_t elementSize, const size_t count) {
+    camera_metadata_entry_t e;
+    if (find_camera_metadata_entry(raw, tag, &e) || (e.count != count) ||
+            (camera_metadata_type_size[e.type] != elementSize)) {
+        return false;
+    }
+
+    const size_t size = elementSize * count;
+    if (memcmp(e.data.u8, data, size)) {
+        memcpy(e.data.u8, data, size);
+    }
+    return true;
+}
+
 CameraMetadata metadataCompactRaw(const camera_metadata_t* raw) {
     const size_t size = get_camera_metadata_compact_size(raw);
     CameraMetadata r;
@@ -120,6 +137,55 @@ CameraMetadataMap parseCameraMetadataMap(const CameraMetadata& m) {
     return r;
 }
 
+void addCameraMetadataRefs(CameraMetadataMap* m, const CameraMetadataRef* refs,
+                           const size_t n) {
+    for (const CameraMetadataRef* end = refs + n; refs != end; ++refs) {
+        const uint8_t* data8 = static_cast<const uint8_t*>(refs->data);
+        CameraMetadataValue& v = (*m)[refs->tag];
+        v.data.assign(data8, data8 + refs->elementSize * refs->count);
+        v.count = refs->count;
+    }
+}
+
+bool metadataUpdateInPlace(CameraMetadata* m, const CameraMetadata& settings,
+                           const CameraMetadataRef* refs, const size_t n) {
+    if (m->metadata.empty() || settings.metadata.empty()) {
+        return false;
+    }
+
+    camera_metadata_t* const raw = reinterpret_cast<camera_metadata_t*>(m->metadata.data());
+    const camera_metadata_t* const src =
+        reinterpret_cast<const camera_metadata_t*>(settings.metadata.data());
+    const CameraMetadataRef* const refsEnd = refs + n;
+
+    const size_t nSettings = get_camera_metadata_entry_count(src);
+    size_t nOverridden = 0;
+    for (size_t i = 0; i < nSettings; ++i) {
+        camera_metadata_ro_entry_t e;
+        if (get_camera_metadata_ro_entry(src, i, &e)) {
+            return false;
+        }
+
+        if (std::find_if(refs, refsEnd, [tag = e.tag](const CameraMetadataRef& r) {
+                return r.tag == tag;
+            }) != refsEnd) {
+            ++nOverridden;
+        } else if (!updateEntryInPlace(raw, e.tag, e.data.u8,
+                                       camera_metadata_type_size[e.type], e.count)) {
+            return false;
+        }
+    }
+
+    for (const CameraMetadataRef* r = refs; r != refsEnd; ++r) {
+        if (!updateEntryInPlace(raw, r->tag, r->data, r->elementSize, r->count)) {
+            return false;
+        }
+    }
+
+    // all tags above are in `m`, no other tags are
+    return get_camera_metadata_entry_count(raw) == (nSettings + n - nOverridden);
+}
+
 void metadataSetShutterTimestamp(CameraMetadata* m, const int64_t shutterTimestampNs) {
     if (m->metadata.empty()) {
         return;
@@ -62,11 +62,34 @@ struct CameraMetadataValue {
 
 using CameraMetadataMap = std::unordered_map<uint32_t, CameraMetadataValue>;
 
+// A tag value which lives elsewhere, for updating metadata without copies.
+struct CameraMetadataRef {
+    template <class T> CameraMetadataRef(uint32_t t, const T& v)
+            : tag(t), data(&v), elementSize(sizeof(T)), count(1) {
+        static_assert(std::is_trivial<T>::value);
+    }
+    template <class T, size_t N> CameraMetadataRef(uint32_t t, const T (&a)[N])
+            : tag(t), data(&a[0]), elementSize(sizeof(T)), count(N) {
+        static_assert(std::is_trivial<T>::value);
+    }
+
+    uint32_t tag;
+    const void* data;
+    unsigned elementSize;
+    unsigned count;
+};
+
 CameraMetadata metadataCompact(const CameraMetadata&);
 
 std::optional<CameraMetadata> serializeCameraMetadataMap(const CameraMetadataMap& m);
 
 CameraMetadataMap parseCameraMetadataMap(const CameraMetadata& m);
+void addCameraMetadataRefs(CameraMetadataMap* m, const CameraMetadataRef* refs, size_t n);
+// Makes `m` the same as `settings` with `refs` on top without reallocating
+// it, only the values which differ are written. Fails (`m` is partially
+// updated) if `m` does not have exactly these tags with the same counts.
+bool metadataUpdateInPlace(CameraMetadata* m, const CameraMetadata& settings,
+                           const CameraMetadataRef* refs, size_t n);
 
 void metadataSetShutterTimestamp(CameraMetadata* metadata, int64_t shutterTimestampNs);
 
@@ -80,7 +80,8 @@ int qemuRunQuery(const int fd,
         return FAILURE(e);
     }
 
-    std::vector<uint8_t> reply;
+    // most replies are a bare "ok", don't allocate for each query
+    static thread_local std::vector<uint8_t> reply;
     e = qemuReceiveMessage(fd, &reply);
     if (e < 0) {
         return e;
@@ -111,8 +112,7 @@ int qemuRunQuery(const int fd,
                     return FAILURE_V(-EBADE, "failed to exec '%s' query", query);
                 }
             } else if (result) {
-                reply.erase(reply.begin(), reply.begin() + 3);
-                *result = std::move(reply);
+                result->assign(reply.begin() + 3, reply.end());
                 return result->size();
             } else {
                 return reply.size() - 3;
@@ -0,0 +1,290 @@
+/*
+ * Copyright (C) 2025 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define FAILURE_DEBUG_PREFIX "soft3d"
+
+#include <algorithm>
+#include <math.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "debug.h"
+#include "soft3d.h"
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace provider {
+namespace implementation {
+namespace soft3d {
+namespace {
+
+constexpr int kSpanChunk = 64;
+
+// A texture coordinate is {dX * x + X0} / {dQ * x + Q0} along a row.
+struct RowCoefs {
+    float dS, s0;
+    float dT, t0;
+    float dQ, q0;
+};
+
+// Narrows [*lo, *hi] to the part where `a * x + b >= 0`.
+void clipHalfLine(const double a, const double b, double* lo, double* hi) {
+    if (a > 0) {
+        *lo = std::max(*lo, -b / a);
+    } else if (a < 0) {
+        *hi = std::min(*hi, -b / a);
+    } else if (b < 0) {
+        *hi = *lo - 1;
+    }
+}
+
+// Texel space coordinates of `n` pixels starting at `x`.
+void projectSpan(const RowCoefs& k, int x, int n, float* s, float* t) {
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t steps = {0, 1, 2, 3};
+    for (; n >= 4; n -= 4, x += 4, s += 4, t += 4) {
+        const float32x4_t xf = vaddq_f32(vdupq_n_f32(x), steps);
+        const float32x4_t q = vmlaq_n_f32(vdupq_n_f32(k.q0), xf, k.dQ);
+        vst1q_f32(s, vdivq_f32(vmlaq_n_f32(vdupq_n_f32(k.s0), xf, k.dS), q));
+        vst1q_f32(t, vdivq_f32(vmlaq_n_f32(vdupq_n_f32(k.t0), xf, k.dT), q));
+    }
+#elif defined(__SSE2__)
+    const __m128 steps = _mm_set_ps(3, 2, 1, 0);
+    const __m128 dS = _mm_set1_ps(k.dS);
+    const __m128 s0 = _mm_set1_ps(k.s0);
+    const __m128 dT = _mm_set1_ps(k.dT);
+    const __m128 t0 = _mm_set1_ps(k.t0);
+    const __m128 dQ = _mm_set1_ps(k.dQ);
+    const __m128 q0 = _mm_set1_ps(k.q0);
+    for (; n >= 4; n -= 4, x += 4, s += 4, t += 4) {
+        const __m128 xf = _mm_add_ps(_mm_set1_ps(x), steps);
+        const __m128 q = _mm_add_ps(_mm_mul_ps(xf, dQ), q0);
+        _mm_storeu_ps(s, _mm_div_ps(_mm_add_ps(_mm_mul_ps(xf, dS), s0), q));
+        _mm_storeu_ps(t, _mm_div_ps(_mm_add_ps(_mm_mul_ps(xf, dT), t0), q));
+    }
+#endif
+
+    for (; n > 0; --n, ++x, ++s, ++t) {
+        const float q = k.dQ * x + k.q0;
+        *s = (k.dS * x + k.s0) / q;
+        *t = (k.dT * x + k.t0) / q;
+    }
+}
+
+// Blends four texels, `ws` and `wt` are in [0, 256).
+uint32_t bilinear(const uint32_t* row0, const uint32_t* row1,
+                  const int c0, const int c1, const uint32_t ws, const uint32_t wt) {
+#if defined(__ARM_NEON)
+    const uint16x8_t left = vmovl_u8(vcreate_u8(row0[c0] | (uint64_t(row1[c0]) << 32)));
+    const uint16x8_t right = vmovl_u8(vcreate_u8(row0[c1] | (uint64_t(row1[c1]) << 32)));
+    const uint16x8_t h = vshrq_n_u16(vmlaq_n_u16(vmulq_n_u16(left, 256 - ws), right, ws), 8);
+    const uint16x4_t v = vshr_n_u16(vmla_n_u16(vmul_n_u16(vget_low_u16(h), 256 - wt),
+                                               vget_high_u16(h), wt), 8);
+    return vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(v, v))), 0);
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i left = _mm_unpacklo_epi8(
+        _mm_unpacklo_epi32(_mm_cvtsi32_si128(row0[c0]), _mm_cvtsi32_si128(row1[c0])), zero);
+    const __m128i right = _mm_unpacklo_epi8(
+        _mm_unpacklo_epi32(_mm_cvtsi32_si128(row0[c1]), _mm_cvtsi32_si128(row1[c1])), zero);
+    const __m128i h = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(left, _mm_set1_epi16(256 - ws)),
+                                                   _mm_mullo_epi16(right, _mm_set1_epi16(ws))), 8);
+    const __m128i m = _mm_mullo_epi16(h, _mm_set_epi16(wt, wt, wt, wt,
+                                                       256 - wt, 256 - wt, 256 - wt, 256 - wt));
+    const __m128i v = _mm_srli_epi16(_mm_add_epi16(m, _mm_srli_si128(m, 8)), 8);
+    return _mm_cvtsi128_si32(_mm_packus_epi16(v, zero));
+#else
+    // RB and GA are blended as two 16bit lanes each
+    const auto lerp = [](const uint32_t a, const uint32_t b, const uint32_t w) -> uint32_t {
+        const uint32_t rb = ((((a & 0x00FF00FF) * (256 - w)) +
+                              ((b & 0x00FF00FF) * w)) >> 8) & 0x00FF00FF;
+        const uint32_t ga = ((((a >> 8) & 0x00FF00FF) * (256 - w)) +
+                             (((b >> 8) & 0x00FF00FF) * w)) & 0xFF00FF00;
+        return rb | ga;
+    };
+
+    return lerp(lerp(row0[c0], row0[c1], ws), lerp(row1[c0], row1[c1], ws), wt);
+#endif
+}
+
+void sampleNearest(const Texture& texture, const float* s, const float* t,
+                   const int n, uint32_t* dst) {
+    const int maxS = texture.width - 1;
+    const int maxT = texture.height - 1;
+    const uint32_t* texels = texture.texels.data();
+
+    for (int i = 0; i < n; ++i) {
+        const int si = std::clamp(int(s[i]), 0, maxS);
+        const int ti = std::clamp(int(t[i]), 0, maxT);
+        dst[i] = texels[ti * texture.width + si];
+    }
+}
+
+// Texels at the edges are clamped (GL_REPEAT would blend in the opposite edge).
+void sampleLinear(const Texture& texture, const float* s, const float* t,
+                  const int n, uint32_t* dst) {
+    const int maxS = texture.width - 1;
+    const int maxT = texture.height - 1;
+    const uint32_t* texels = texture.texels.data();
+
+    for (int i = 0; i < n; ++i) {
+        // coordinates are >= -.5 here, +1 makes the truncation a floor
+        const int fs = int((s[i] + 1.0f) * 256.0f);
+        const int ft = int((t[i] + 1.0f) * 256.0f);
+        const int s0 = (fs >> 8) - 1;
+        const int t0 = (ft >> 8) - 1;
+        const uint32_t* row0 = texels + std::clamp(t0, 0, maxT) * texture.width;
+        const uint32_t* row1 = texels + std::clamp(t0 + 1, 0, maxT) * texture.width;
+        dst[i] = bilinear(row0, row1, std::clamp(s0, 0, maxS), std::clamp(s0 + 1, 0, maxS),
+                          fs & 0xFF, ft & 0xFF);
+    }
+}
+
+void drawSpan(const Texture& texture, const RowCoefs& k, int x, int n, uint32_t* dst) {
+    float s[kSpanChunk];
+    float t[kSpanChunk];
+
+    while (n > 0) {
+        const int chunk = std::min(n, kSpanChunk);
+        projectSpan(k, x, chunk, s, t);
+        if (texture.linear) {
+            sampleLinear(texture, s, t, chunk, dst);
+        } else {
+            sampleNearest(texture, s, t, chunk, dst);
+        }
+
+        x += chunk;
+        dst += chunk;
+        n -= chunk;
+    }
+}
+
+}  // namespace
+
+bool drawTexturedQuad(uint32_t* rgba, const size_t width, const size_t height,
+                      const size_t stride, const uint32_t clearColor,
+                      const float pvMatrix44[], const float origin3[],
+                      const float sAxis3[], const float tAxis3[],
+                      const Texture& texture) {
+    if (!texture.ok() || !width || !height || (stride < width)) {
+        return FAILURE(false);
+    }
+
+    // The quad plane to clip space: (s, t, 1) -> (x, y, w), z is not used.
+    double h[3][3];
+    {
+        static constexpr int kRows[3] = {0, 1, 3};
+        for (int i = 0; i < 3; ++i) {
+            const float* m = &pvMatrix44[kRows[i] * 4];
+            h[i][0] = double(m[0]) * sAxis3[0] + double(m[1]) * sAxis3[1] + double(m[2]) * sAxis3[2];
+            h[i][1] = double(m[0]) * tAxis3[0] + double(m[1]) * tAxis3[1] + double(m[2]) * tAxis3[2];
+            h[i][2] = double(m[0]) * origin3[0] + double(m[1]) * origin3[1] + double(m[2]) * origin3[2] + m[3];
+        }
+    }
+
+    // inv * (ndcX, ndcY, 1) = (s, t, 1) / w
+    double inv[3][3];
+    const double det = h[0][0] * (h[1][1] * h[2][2] - h[1][2] * h[2][1]) -
+                       h[0][1] * (h[1][0] * h[2][2] - h[1][2] * h[2][0]) +
+                       h[0][2] * (h[1][0] * h[2][1] - h[1][1] * h[2][0]);
+    const bool visible = fabs(det) > 1e-12;  // the quad is seen edge-on otherwise
+    if (visible) {
+        const double invDet = 1.0 / det;
+        inv[0][0] = (h[1][1] * h[2][2] - h[1][2] * h[2][1]) * invDet;
+        inv[0][1] = (h[0][2] * h[2][1] - h[0][1] * h[2][2]) * invDet;
+        inv[0][2] = (h[0][1] * h[1][2] - h[0][2] * h[1][1]) * invDet;
+        inv[1][0] = (h[1][2] * h[2][0] - h[1][0] * h[2][2]) * invDet;
+        inv[1][1] = (h[0][0] * h[2][2] - h[0][2] * h[2][0]) * invDet;
+        inv[1][2] = (h[0][2] * h[1][0] - h[0][0] * h[1][2]) * invDet;
+        inv[2][0] = (h[1][0] * h[2][1] - h[1][1] * h[2][0]) * invDet;
+        inv[2][1] = (h[0][1] * h[2][0] - h[0][0] * h[2][1]) * invDet;
+        inv[2][2] = (h[0][0] * h[1][1] - h[0][1] * h[1][0]) * invDet;
+    }
+
+    // pixel centers to NDC: ndc = x * a + b
+    const double ax = 2.0 / width;
+    const double bx = 1.0 / width - 1.0;
+    const double ay = 2.0 / height;
+    const double by = 1.0 / height - 1.0;
+
+    // texel space, GL_LINEAR samples around texel centers
+    const double bias = texture.linear ? .5 : 0;
+    const double sScale = texture.width;
+    const double tScale = texture.height;
+
+    for (size_t y = 0; y < height; ++y, rgba += stride) {
+        if (!visible) {
+            std::fill_n(rgba, width, clearColor);
+            continue;
+        }
+
+        const double ndcY = y * ay + by;
+        double dk[3];
+        double k0[3];
+        for (int i = 0; i < 3; ++i) {
+            dk[i] = inv[i][0] * ax;
+            k0[i] = inv[i][0] * bx + inv[i][1] * ndcY + inv[i][2];
+        }
+
+        // the quad is where 0 <= s <= 1, 0 <= t <= 1 and w > 0
+        double lo = 0;
+        double hi = width - 1;
+        constexpr double kMinQ = 1e-12;
+        clipHalfLine(dk[2], k0[2] - kMinQ, &lo, &hi);
+        clipHalfLine(dk[0], k0[0], &lo, &hi);
+        clipHalfLine(dk[2] - dk[0], k0[2] - k0[0], &lo, &hi);
+        clipHalfLine(dk[1], k0[1], &lo, &hi);
+        clipHalfLine(dk[2] - dk[1], k0[2] - k0[1], &lo, &hi);
+
+        size_t x0 = width;
+        size_t x1 = width;
+        if (lo <= hi) {
+            x0 = size_t(ceil(lo));
+            x1 = std::min(width, size_t(floor(hi)) + 1);
+            if (x0 > x1) {
+                x0 = x1;
+            }
+        }
+
+        std::fill_n(rgba, x0, clearColor);
+        if (x0 < x1) {
+            const RowCoefs k = {
+                .dS = float(dk[0] * sScale - dk[2] * bias),
+                .s0 = float(k0[0] * sScale - k0[2] * bias),
+                .dT = float(dk[1] * tScale - dk[2] * bias),
+                .t0 = float(k0[1] * tScale - k0[2] * bias),
+                .dQ = float(dk[2]),
+                .q0 = float(k0[2]),
+            };
+
+            drawSpan(texture, k, x0, x1 - x0, rgba + x0);
+        }
+        std::fill(rgba + x1, rgba + width, clearColor);
+    }
+
+    return true;
+}
+
+}  // namespace soft3d
+}  // namespace implementation
+}  // namespace provider
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
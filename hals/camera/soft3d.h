@@ -0,0 +1,55 @@
+/*
+ * Copyright (C) 2025 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace android {
+namespace hardware {
+namespace camera {
+namespace provider {
+namespace implementation {
+namespace soft3d {
+
+// RGBA8888 texels (R is in the low byte), the first row is at t=0.
+struct Texture {
+    std::vector<uint32_t> texels;
+    uint16_t width = 0;
+    uint16_t height = 0;
+    bool linear = false;  // GL_LINEAR if true, GL_NEAREST otherwise
+
+    bool ok() const { return !texels.empty(); }
+};
+
+// Fills `width`x`height` RGBA8888 pixels (rows are `stride` pixels apart) with
+// `clearColor` and draws the quad `origin3 + s * sAxis3 + t * tAxis3`,
+// s and t are in [0, 1] and used as texture coordinates. `pvMatrix44` is
+// row-major (as with glUniformMatrix4fv(transpose=true)), the first row of
+// `rgba` is at the bottom of the viewport. There is no near/far clipping.
+bool drawTexturedQuad(uint32_t* rgba, size_t width, size_t height, size_t stride,
+                      uint32_t clearColor, const float pvMatrix44[],
+                      const float origin3[], const float sAxis3[], const float tAxis3[],
+                      const Texture& texture);
+
+}  // namespace soft3d
+}  // namespace implementation
+}  // namespace provider
+}  // namespace camera
+}  // namespace hardware
+}  // namespace android
@@ -14,7 +14,14 @@
  * limitations under the License.
  */
 
+#define FAILURE_DEBUG_PREFIX "yuv"
+
+#include <algorithm>
+#include <libyuv/convert_argb.h>
+#include <libyuv/planar_functions.h>
+#include <libyuv/scale.h>
 #include <log/log.h>
+#include "debug.h"
 #include "yuv.h"
 
 namespace android {
@@ -26,9 +33,10 @@ namespace yuv {
 namespace {
 
 void copyCbCrPlane(uint8_t* dst, const size_t width, size_t height,
-                   const void* src, const size_t srcStride, const size_t srcStep) {
+                   const void* src, const size_t srcStride, const size_t dstPadding,
+                   const size_t srcStep) {
     const uint8_t* src8 = static_cast<const uint8_t*>(src);
-    for (; height > 0; --height, src8 += srcStride) {
+    for (; height > 0; --height, src8 += srcStride, dst += dstPadding) {
         const uint8_t* p = src8;
         for (size_t rem = width & 15; rem; --rem, ++dst, p += srcStep) {
             *dst = *p;
@@ -55,6 +63,36 @@ void copyCbCrPlane(uint8_t* dst, const size_t width, size_t height,
     }
 }
 
+// Returns the largest centered part of `src` with the dst aspect ratio, the
+// offsets and sizes are even to keep chroma aligned.
+android_ycbcr cropCenter(const size_t srcWidth, const size_t srcHeight,
+                         const android_ycbcr& src,
+                         const size_t dstWidth, const size_t dstHeight,
+                         size_t* cropWidth, size_t* cropHeight) {
+    size_t w = srcWidth;
+    size_t h = srcHeight;
+    if ((srcWidth * dstHeight) > (dstWidth * srcHeight)) {
+        w = std::min(srcWidth, ((srcHeight * dstWidth / dstHeight) + 1) & ~size_t(1));
+    } else {
+        h = std::min(srcHeight, ((srcWidth * dstHeight / dstWidth) + 1) & ~size_t(1));
+    }
+
+    const size_t x = ((srcWidth - w) / 2) & ~size_t(1);
+    const size_t y = ((srcHeight - h) / 2) & ~size_t(1);
+
+    android_ycbcr crop = src;
+    crop.y = static_cast<uint8_t*>(src.y) + y * src.ystride + x;
+    crop.cb = static_cast<uint8_t*>(src.cb) + (y / 2) * src.cstride + (x / 2);
+    crop.cr = static_cast<uint8_t*>(src.cr) + (y / 2) * src.cstride + (x / 2);
+
+    *cropWidth = w;
+    *cropHeight = h;
+    return crop;
+}
+
+// Planar Cb and Cr for NV12/NV21 outputs, see cropScale.
+thread_local std::vector<uint8_t> gCbCrScratch;
+
 }  // namespace
 
 size_t NV21size(const size_t width, const size_t height) {
@@ -86,25 +124,109 @@ android_ycbcr toNV21Shallow(const size_t width, const size_t height,
         return ycbcr;
     }
 
-    const size_t area = width * height;
-    data->resize(area / 2);  // only for CbCr
+    // JPEG reads chroma in blocks of 8, padded rows let it read in place
+    const size_t cstride = (width / 2 + 7) & ~size_t(7);
+    const size_t planeSize = cstride * height / 2;
+    data->resize(planeSize * 2);  // only for CbCr
 
     android_ycbcr nv21;
     nv21.y = ycbcr.y;  // don't copy Y
     nv21.ystride = ycbcr.ystride;
-    nv21.cb = &data[0];
-    nv21.cr = &data[area / 4];
-    nv21.cstride = width / 2;
+    nv21.cb = data->data();
+    nv21.cr = data->data() + planeSize;
+    nv21.cstride = cstride;
     nv21.chroma_step = 1;
 
-    copyCbCrPlane(&((*data)[0]), width / 2, height / 2,
-                  ycbcr.cb, ycbcr.cstride, ycbcr.chroma_step);
-    copyCbCrPlane(&((*data)[area / 4]), width / 2, height / 2,
-                  ycbcr.cr, ycbcr.cstride, ycbcr.chroma_step);
+    copyCbCrPlane(static_cast<uint8_t*>(nv21.cb), width / 2, height / 2,
+                  ycbcr.cb, ycbcr.cstride, cstride - width / 2, ycbcr.chroma_step);
+    copyCbCrPlane(static_cast<uint8_t*>(nv21.cr), width / 2, height / 2,
+                  ycbcr.cr, ycbcr.cstride, cstride - width / 2, ycbcr.chroma_step);
 
     return nv21;
 }
 
+bool cropScale(const size_t srcWidth, const size_t srcHeight, const android_ycbcr& src,
+               const size_t dstWidth, const size_t dstHeight, const android_ycbcr& dst) {
+    if ((src.chroma_step != 1) || (dstWidth & 1) || (dstHeight & 1)) {
+        return FAILURE(false);
+    }
+
+    size_t w;
+    size_t h;
+    const android_ycbcr crop = cropCenter(srcWidth, srcHeight, src,
+                                          dstWidth, dstHeight, &w, &h);
+    const auto filter = libyuv::kFilterBox;
+
+    if (dst.chroma_step == 1) {
+        return (libyuv::I420Scale(
+            static_cast<const uint8_t*>(crop.y), crop.ystride,
+            static_cast<const uint8_t*>(crop.cb), crop.cstride,
+            static_cast<const uint8_t*>(crop.cr), crop.cstride,
+            w, h,
+            static_cast<uint8_t*>(dst.y), dst.ystride,
+            static_cast<uint8_t*>(dst.cb), dst.cstride,
+            static_cast<uint8_t*>(dst.cr), dst.cstride,
+            dstWidth, dstHeight, filter) == 0) ? true : FAILURE(false);
+    }
+
+    uint8_t* const dstCb = static_cast<uint8_t*>(dst.cb);
+    uint8_t* const dstCr = static_cast<uint8_t*>(dst.cr);
+    const bool cbFirst = (dstCr == (dstCb + 1));
+    if ((dst.chroma_step != 2) || (!cbFirst && (dstCb != (dstCr + 1)))) {
+        return FAILURE(false);
+    }
+
+    libyuv::ScalePlane(static_cast<const uint8_t*>(crop.y), crop.ystride, w, h,
+                       static_cast<uint8_t*>(dst.y), dst.ystride,
+                       dstWidth, dstHeight, filter);
+
+    const size_t cw = dstWidth / 2;
+    const size_t ch = dstHeight / 2;
+    std::vector<uint8_t>& scratch = gCbCrScratch;
+    scratch.resize(cw * ch * 2);
+    uint8_t* const cb = scratch.data();
+    uint8_t* const cr = cb + cw * ch;
+
+    libyuv::ScalePlane(static_cast<const uint8_t*>(crop.cb), crop.cstride, w / 2, h / 2,
+                       cb, cw, cw, ch, filter);
+    libyuv::ScalePlane(static_cast<const uint8_t*>(crop.cr), crop.cstride, w / 2, h / 2,
+                       cr, cw, cw, ch, filter);
+    libyuv::MergeUVPlane(cbFirst ? cb : cr, cw, cbFirst ? cr : cb, cw,
+                         std::min(dstCb, dstCr), dst.cstride, cw, ch);
+    return true;
+}
+
+bool cropScaleToRGBA(const size_t srcWidth, const size_t srcHeight, const android_ycbcr& src,
+                     const size_t dstWidth, const size_t dstHeight,
+                     void* rgba, const size_t rgbaStride) {
+    if ((src.chroma_step != 1) || (dstWidth & 1) || (dstHeight & 1)) {
+        return FAILURE(false);
+    }
+
+    size_t w;
+    size_t h;
+    android_ycbcr crop = cropCenter(srcWidth, srcHeight, src,
+                                    dstWidth, dstHeight, &w, &h);
+
+    std::vector<uint8_t> scaled;
+    if ((w != dstWidth) || (h != dstHeight)) {
+        scaled.resize(NV21size(dstWidth, dstHeight));
+        const android_ycbcr scaledYCbCr = NV21init(dstWidth, dstHeight, scaled.data());
+        if (!cropScale(srcWidth, srcHeight, src, dstWidth, dstHeight, scaledYCbCr)) {
+            return FAILURE(false);
+        }
+        crop = scaledYCbCr;
+    }
+
+    // libyuv's ABGR is R, G, B, A in memory
+    return (libyuv::J420ToABGR(
+        static_cast<const uint8_t*>(crop.y), crop.ystride,
+        static_cast<const uint8_t*>(crop.cb), crop.cstride,
+        static_cast<const uint8_t*>(crop.cr), crop.cstride,
+        static_cast<uint8_t*>(rgba), rgbaStride,
+        dstWidth, dstHeight) == 0) ? true : FAILURE(false);
+}
+
 }  // namespace yuv
 }  // namespace implementation
 }  // namespace provider
@@ -34,6 +34,15 @@ android_ycbcr NV21init(size_t width, size_t height, void* data);
 android_ycbcr toNV21Shallow(size_t width, size_t height, const android_ycbcr& ycbcr,
                             std::vector<uint8_t>* data);
 
+// Crops the center of `src` (chroma_step is 1) to the aspect ratio of `dst`
+// and scales it into `dst` (any chroma_step, 2 is NV12 or NV21).
+bool cropScale(size_t srcWidth, size_t srcHeight, const android_ycbcr& src,
+               size_t dstWidth, size_t dstHeight, const android_ycbcr& dst);
+
+// Same as cropScale, the result is converted into RGBA (full range as JFIF).
+bool cropScaleToRGBA(size_t srcWidth, size_t srcHeight, const android_ycbcr& src,
+                     size_t dstWidth, size_t dstHeight, void* rgba, size_t rgbaStride);
+
 }  // namespace yuv
 }  // namespace implementation
 }  // namespace provider
@@ -0,0 +1,212 @@
+/*
+* Copyright 2024 The Android Open Source Project
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*/
+
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdint>
+#include <string>
+
+#include <android-base/stringprintf.h>
+#include <aidl/android/hardware/graphics/common/BufferUsage.h>
+
+// All counters below are relaxed atomics, they could be updated from any
+// thread without locking and are only read to be printed.
+
+enum class UsageClass : uint8_t {
+    CAMERA = 0,
+    VIDEO = 1,
+    COMPOSER = 2,
+    GPU = 3,
+    CPU = 4,
+    OTHER = 5,
+    COUNT = 6,
+};
+
+inline UsageClass getUsageClass(const uint64_t usage) {
+    using ::aidl::android::hardware::graphics::common::BufferUsage;
+    const auto has = [usage](const BufferUsage mask) {
+        return (usage & static_cast<uint64_t>(mask)) != 0;
+    };
+
+    if (has(BufferUsage::CAMERA_INPUT) || has(BufferUsage::CAMERA_OUTPUT)) {
+        return UsageClass::CAMERA;
+    } else if (has(BufferUsage::VIDEO_ENCODER) || has(BufferUsage::VIDEO_DECODER)) {
+        return UsageClass::VIDEO;
+    } else if (has(BufferUsage::COMPOSER_OVERLAY) ||
+               has(BufferUsage::COMPOSER_CLIENT_TARGET)) {
+        return UsageClass::COMPOSER;
+    } else if (has(BufferUsage::GPU_TEXTURE) || has(BufferUsage::GPU_RENDER_TARGET) ||
+               has(BufferUsage::GPU_DATA_BUFFER)) {
+        return UsageClass::GPU;
+    } else if (has(BufferUsage::CPU_READ_MASK) || has(BufferUsage::CPU_WRITE_MASK)) {
+        return UsageClass::CPU;
+    } else {
+        return UsageClass::OTHER;
+    }
+}
+
+inline const char* getUsageClassName(const UsageClass usageClass) {
+    switch (usageClass) {
+    case UsageClass::CAMERA:    return "camera";
+    case UsageClass::VIDEO:     return "video";
+    case UsageClass::COMPOSER:  return "composer";
+    case UsageClass::GPU:       return "gpu";
+    case UsageClass::CPU:       return "cpu";
+    default:                    return "other";
+    }
+}
+
+struct Counter {
+    void add(const uint64_t delta) {
+        value.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    void sub(const uint64_t delta) {
+        value.fetch_sub(delta, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> value = 0;
+};
+
+// Bytes and number of events, per usage class.
+struct UsageCounters {
+    void add(const uint64_t usage, const uint64_t bytes) {
+        const size_t i = static_cast<size_t>(getUsageClass(usage));
+        count[i].add(1);
+        size[i].add(bytes);
+    }
+
+    void appendTo(std::string& out, const char* const name) const {
+        for (size_t i = 0; i < static_cast<size_t>(UsageClass::COUNT); ++i) {
+            const uint64_t n = count[i].get();
+            if (n) {
+                ::android::base::StringAppendF(
+                    &out, "  %s[%s]: count=%" PRIu64 " bytes=%" PRIu64 "\n", name,
+                    getUsageClassName(static_cast<UsageClass>(i)), n, size[i].get());
+            }
+        }
+    }
+
+    Counter count[static_cast<size_t>(UsageClass::COUNT)];
+    Counter size[static_cast<size_t>(UsageClass::COUNT)];
+};
+
+// Buffers and bytes alive right now, per usage class.
+struct LiveCounters {
+    void add(const uint64_t usage, const uint64_t bytes) {
+        const size_t i = static_cast<size_t>(getUsageClass(usage));
+        count[i].add(1);
+        size[i].add(bytes);
+    }
+
+    void remove(const uint64_t usage, const uint64_t bytes) {
+        const size_t i = static_cast<size_t>(getUsageClass(usage));
+        count[i].sub(1);
+        size[i].sub(bytes);
+    }
+
+    void appendTo(std::string& out, const char* const name) const {
+        uint64_t totalCount = 0;
+        uint64_t totalSize = 0;
+        for (size_t i = 0; i < static_cast<size_t>(UsageClass::COUNT); ++i) {
+            const uint64_t n = count[i].get();
+            if (n) {
+                const uint64_t bytes = size[i].get();
+                ::android::base::StringAppendF(
+                    &out, "  %s[%s]: buffers=%" PRIu64 " bytes=%" PRIu64 "\n", name,
+                    getUsageClassName(static_cast<UsageClass>(i)), n, bytes);
+                totalCount += n;
+                totalSize += bytes;
+            }
+        }
+        ::android::base::StringAppendF(
+            &out, "  %s: buffers=%" PRIu64 " bytes=%" PRIu64 "\n", name,
+            totalCount, totalSize);
+    }
+
+    Counter count[static_cast<size_t>(UsageClass::COUNT)];
+    Counter size[static_cast<size_t>(UsageClass::COUNT)];
+};
+
+// Bucket `i` counts durations in [2^(i-1), 2^i) microseconds, the last
+// bucket also counts everything longer.
+struct LatencyHistogram {
+    static constexpr size_t kBuckets = 20;
+
+    void add(const std::chrono::nanoseconds duration) {
+        const uint64_t us =
+            std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+        size_t i = 0;
+        for (uint64_t v = us; v && (i < (kBuckets - 1)); v >>= 1) {
+            ++i;
+        }
+
+        buckets[i].add(1);
+        count.add(1);
+        totalUs.add(us);
+
+        uint64_t max = maxUs.load(std::memory_order_relaxed);
+        while ((us > max) && !maxUs.compare_exchange_weak(max, us,
+                                                          std::memory_order_relaxed)) {}
+    }
+
+    void appendTo(std::string& out, const char* const name) const {
+        const uint64_t n = count.get();
+        if (!n) {
+            return;
+        }
+
+        ::android::base::StringAppendF(
+            &out, "  %s: count=%" PRIu64 " avg=%" PRIu64 "us max=%" PRIu64 "us [",
+            name, n, totalUs.get() / n, maxUs.load(std::memory_order_relaxed));
+        for (size_t i = 0; i < kBuckets; ++i) {
+            const uint64_t b = buckets[i].get();
+            if (b) {
+                ::android::base::StringAppendF(&out, " <%" PRIu64 "us:%" PRIu64,
+                                               uint64_t(1) << i, b);
+            }
+        }
+        out += " ]\n";
+    }
+
+    Counter buckets[kBuckets];
+    Counter count;
+    Counter totalUs;
+    std::atomic<uint64_t> maxUs = 0;
+};
+
+struct ScopedLatency {
+    explicit ScopedLatency(LatencyHistogram& histogram)
+        : mHistogram(histogram)
+        , mStart(std::chrono::steady_clock::now()) {}
+
+    ~ScopedLatency() {
+        mHistogram.add(std::chrono::steady_clock::now() - mStart);
+    }
+
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+private:
+    LatencyHistogram& mHistogram;
+    const std::chrono::steady_clock::time_point mStart;
+};
@@ -19,6 +19,7 @@
 
 #include <sched.h>
 
+#include <android-base/file.h>
 #include <android-base/unique_fd.h>
 #include <android/binder_manager.h>
 #include <android/binder_process.h>
@@ -42,6 +43,7 @@
 #include "CbExternalMetadata.h"
 #include "DebugLevel.h"
 #include "HostConnectionSession.h"
+#include "Stats.h"
 
 using ::aidl::android::hardware::graphics::allocator::AllocationError;
 using ::aidl::android::hardware::graphics::allocator::AllocationResult;
@@ -149,6 +151,8 @@ struct GoldfishAllocator : public BnAllocator {
     ndk::ScopedAStatus allocate2(const BufferDescriptorInfo& desc,
                                  const int32_t count,
                                  AllocationResult* const outResult) override {
+        const ScopedLatency latency(mStats.allocateLatency);
+
         if (count <= 0) {
             return toBinderStatus(FAILURE_V(AllocationError::BAD_DESCRIPTOR,
                                             "%s: count=%d", "BAD_DESCRIPTOR",
@@ -498,9 +502,10 @@ struct GoldfishAllocator : public BnAllocator {
                 if (cb) {
                     cbs[i] = std::move(cb);
                 } else {
-                    for (--i; i > 0; --i) {
+                    for (--i; i >= 0; --i) {
                         unallocate(std::move(cbs[i]));
                     }
+                    mStats.failures.add(1);
                     return toBinderStatus(FAILURE(AllocationError::NO_RESOURCES));
                 }
             }
@@ -510,6 +515,7 @@ struct GoldfishAllocator : public BnAllocator {
         outResult->buffers.reserve(count);
         for (auto& cb : cbs) {
             outResult->buffers.push_back(android::dupToAidl(cb.get()));
+            countAllocated(*cb);
             unallocate(std::move(cb));
         }
 
@@ -536,7 +542,33 @@ struct GoldfishAllocator : public BnAllocator {
         return toBinderStatus(FAILURE(AllocationError::UNSUPPORTED));
     }
 
+    binder_status_t dump(const int fd, const char** /*args*/,
+                         const uint32_t /*numArgs*/) override {
+        std::string output("GoldfishAllocator:\n");
+        mStats.appendTo(output);
+        return ::android::base::WriteStringToFd(output, fd) ?
+            STATUS_OK : STATUS_UNKNOWN_ERROR;
+    }
+
 private:
+    struct Stats {
+        void appendTo(std::string& out) const {
+            ::android::base::StringAppendF(&out, "  failures: %" PRIu64 "\n",
+                                           failures.get());
+            allocated.appendTo(out, "allocated");
+            hostColorBuffers.appendTo(out, "hostColorBuffers");
+            allocateLatency.appendTo(out, "allocate2");
+        }
+
+        // Cumulative, the buffers are owned by the clients after allocate2
+        // and the allocator does not see them freed. The mapper counts
+        // the live ones (importBuffer/freeBuffer) per process.
+        UsageCounters allocated;        // guest visible (mapped) bytes
+        UsageCounters hostColorBuffers; // guest+host bytes of buffers with host color buffers
+        Counter failures;
+        LatencyHistogram allocateLatency;
+    };
+
     struct AllocationRequest {
         std::string_view name;
         PlaneLayout plane[3];
@@ -569,6 +601,9 @@ private:
                 req.imageSizeInBytes + sizeof(CbExternalMetadata) + req.reservedRegionSize +
                 (req.needImageAllocation ? imageSizeInBytesAligned : 0);
         // The actual allocation size. This is visible to the guest.
+        // It is not rounded up to huge pages: the address space device
+        // mapping is a PFN mapping at an address the driver picks (not
+        // 2 MiB aligned), so MADV_HUGEPAGE could not take effect on it.
         const size_t mappedImageSize = req.needImageAllocation ? imageSizeInBytesAligned : 0;
         const size_t totalMappedAllocationSize =
                 mappedImageSize + sizeof(CbExternalMetadata) + req.reservedRegionSize;
@@ -675,6 +710,18 @@ private:
         return cb;
     }
 
+    // Only buffers handed out to the client are counted, not the ones
+    // released when a later buffer of the same allocate2 call fails.
+    void countAllocated(const cb_handle_t& cb) const {
+        mStats.allocated.add(cb.usage, cb.mmapedSize);
+        if (cb.hostHandle) {
+            const CbExternalMetadata& metadata =
+                *reinterpret_cast<const CbExternalMetadata*>(
+                    cb.getBufferPtr() + cb.externalMetadataOffset);
+            mStats.hostColorBuffers.add(cb.usage, metadata.totalAllocationSize);
+        }
+    }
+
     static void unallocate(const std::unique_ptr<cb_handle_t> cb) {
         if (cb->hostHandleRefcountFd >= 0) {
             ::close(cb->hostHandleRefcountFd);
@@ -736,6 +783,7 @@ private:
 
     const std::unique_ptr<HostConnection> mHostConn;
     uint64_t mBufferIdGenerator = 0;
+    mutable Stats mStats;
     const DebugLevel mDebugLevel;
 };
 }  // namespace
@@ -16,8 +16,9 @@
 
 #include <array>
 #include <mutex>
+#include <shared_mutex>
 #include <string_view>
-#include <unordered_set>
+#include <unordered_map>
 #include <vector>
 
 #include <cutils/native_handle.h>
@@ -42,6 +43,7 @@
 #include "CbExternalMetadata.h"
 #include "DebugLevel.h"
 #include "HostConnectionSession.h"
+#include "Stats.h"
 
 #ifndef DRM_FORMAT_MOD_LINEAR
 #define DRM_FORMAT_MOD_LINEAR 0
@@ -59,6 +61,8 @@ using ::android::hardware::graphics::mapper::MetadataWriter;
 
 namespace {
 constexpr size_t kMetadataBufferInitialSize = 1024;
+constexpr size_t kEncodedMetadataCacheSize =
+    static_cast<size_t>(StandardMetadataType::STRIDE) + 1;
 constexpr uint32_t kCPU_READ_MASK = static_cast<uint32_t>(BufferUsage::CPU_READ_MASK);
 constexpr uint32_t kCPU_WRITE_MASK = static_cast<uint32_t>(BufferUsage::CPU_WRITE_MASK);
 
@@ -105,6 +109,27 @@ uint64_t getID(const cb_handle_t& cb) {
     return getExternalMetadata(cb).bufferID;
 }
 
+bool isEmptyRegion(const ARect& region) {
+    return (region.right == 0) || (region.bottom == 0);
+}
+
+// An empty `accessRegion` means the whole buffer.
+bool isWholeBufferRegion(const ARect& region, const CbExternalMetadata& metadata) {
+    return isEmptyRegion(region) ||
+           ((region.left == 0) && (region.top == 0) &&
+            (region.right == metadata.width) && (region.bottom == metadata.height));
+}
+
+// Rows of a single plane buffer could be transferred as one contiguous
+// range only if there is no padding at the end of each row.
+bool hasTightlyPackedRows(const CbExternalMetadata& metadata) {
+    if (metadata.planeLayoutSize != 1) {
+        return false;
+    }
+    const PlaneLayout& plane = metadata.planeLayout[0];
+    return plane.strideInBytes == (metadata.width * plane.sampleIncrementInBytes);
+}
+
 int waitFenceFd(const int fd, const char* logname) {
     const int warningTimeout = 5000;
     if (sync_wait(fd, warningTimeout) < 0) {
@@ -294,6 +319,18 @@ const AIMapper_MetadataTypeDescription kMetadataTypeDescriptionList[] = {
     },
 };
 
+// Values which can't change after allocation are encoded once at import time,
+// reading them is a memcpy from `encoded`.
+struct EncodedMetadataCache {
+    struct Range {
+        uint32_t offset = 0;
+        uint32_t size = 0;  // 0 - not cached
+    };
+
+    std::vector<uint8_t> encoded;
+    std::array<Range, kEncodedMetadataCacheSize> ranges;
+};
+
 struct GoldfishMapper {
     GoldfishMapper()
             : mHostConn(HostConnection::createUnique(kCapsetNone))
@@ -390,6 +427,8 @@ struct GoldfishMapper {
 private:
     AIMapper_Error importBuffer(const native_handle_t* const handle,
                                 buffer_handle_t* const outBufferHandle) {
+        const ScopedLatency latency(mStats.importLatency);
+
         if (!handle) {
             return FAILURE(AIMAPPER_ERROR_BAD_BUFFER);
         }
@@ -425,8 +464,13 @@ private:
             ALOGD("%s:%d: id=%" PRIu64, __func__, __LINE__, getID(*cb));
         }
 
-        std::lock_guard<std::mutex> lock(mImportedBuffersMtx);
-        LOG_ALWAYS_FATAL_IF(!mImportedBuffers.insert(cb).second);
+        EncodedMetadataCache metadataCache = encodeImmutableMetadata(*cb);
+
+        std::lock_guard<std::shared_mutex> lock(mImportedBuffersMtx);
+        LOG_ALWAYS_FATAL_IF(!mImportedBuffers.try_emplace(
+            cb, std::move(metadataCache)).second);
+        mStats.imported.add(1);
+        mStats.live.add(cb->usage, cb->mmapedSize);
         *outBufferHandle = cb;
         return AIMAPPER_ERROR_NONE;
     }
@@ -435,11 +479,13 @@ private:
         cb_handle_t* const cb = const_cast<cb_handle_t*>(static_cast<const cb_handle_t*>(buffer));
 
         {
-            std::lock_guard<std::mutex> lock(mImportedBuffersMtx);
+            std::lock_guard<std::shared_mutex> lock(mImportedBuffersMtx);
             if (mImportedBuffers.erase(cb) == 0) {
                 return FAILURE(AIMAPPER_ERROR_BAD_BUFFER);
             }
         }
+        mStats.freed.add(1);
+        mStats.live.remove(cb->usage, cb->mmapedSize);
 
         if (mDebugLevel >= DebugLevel::IMPORT) {
             ALOGD("%s:%d: id=%" PRIu64, __func__, __LINE__, getID(*cb));
@@ -471,6 +517,8 @@ private:
     AIMapper_Error lock(const buffer_handle_t buffer, const uint64_t uncheckedUsage,
                         const ARect& accessRegion, const int acquireFence,
                         void** const outData) const {
+        const ScopedLatency latency(mStats.lockLatency);
+
         cb_handle_t* const cb = validateCb(buffer);
         if (!cb) {
             return FAILURE(AIMAPPER_ERROR_BAD_BUFFER);
@@ -505,6 +553,11 @@ private:
             return FAILURE_V(AIMAPPER_ERROR_BAD_VALUE, "%s: id=%" PRIu64,
                              "BAD_VALUE(uncheckedUsage)", metadata.bufferID);
         }
+        /*
+         * AIMapper has no asynchronous lock: the data must be valid when
+         * `lock` returns, so waiting for the fence and reading from the host
+         * can't be deferred past this call.
+         */
         if ((acquireFence >= 0) && waitFenceFd(acquireFence, __func__)) {
             return FAILURE_V(AIMAPPER_ERROR_NO_RESOURCES, "%s: id=%" PRIu64,
                              "NO_RESOURCES(acquireFence)", metadata.bufferID);
@@ -517,11 +570,25 @@ private:
                   accessRegion.top, accessRegion.right, accessRegion.bottom);
         }
 
-        if (cb->hostHandle) {
-            const AIMapper_Error e = readFromHost(*cb);
+        /*
+         * If the CPU is going to overwrite the whole buffer without reading
+         * it, the host contents are not needed. unlock and flushLockedBuffer
+         * send the whole buffer to the host, so a write lock of a part of it
+         * must read all of it. Read-only locks read only the rows covered by
+         * `accessRegion` if the layout allows it.
+         */
+        if (cb->hostHandle && ((cpuUsage & kCPU_READ_MASK) ||
+                               !isWholeBufferRegion(accessRegion, metadata))) {
+            const bool wholeBuffer = isEmptyRegion(accessRegion) ||
+                                     (cpuUsage & kCPU_WRITE_MASK);
+            const AIMapper_Error e = wholeBuffer ?
+                readFromHost(*cb, 0, metadata.height) :
+                readFromHost(*cb, accessRegion.top, accessRegion.bottom);
             if (e != AIMAPPER_ERROR_NONE) {
                 return e;
             }
+        } else if (cb->hostHandle) {
+            mStats.readbacksSkipped.add(1);
         }
 
         cb->lockedUsage = cpuUsage;
@@ -530,6 +597,8 @@ private:
     }
 
     AIMapper_Error unlock(const buffer_handle_t buffer, int* const releaseFence) const {
+        const ScopedLatency latency(mStats.unlockLatency);
+
         cb_handle_t* const cb = validateCb(buffer);
         if (!cb) {
             return FAILURE(AIMAPPER_ERROR_BAD_BUFFER);
@@ -584,13 +653,16 @@ private:
         }
 
         if (cb->hostHandle) {
-            return readFromHost(*cb);
+            return readFromHost(*cb, 0, getExternalMetadata(*cb).height);
         } else {
             return AIMAPPER_ERROR_NONE;
         }
     }
 
-    AIMapper_Error readFromHost(const cb_handle_t& cb) const {
+    // Reads at least rows [top, bottom) from the host.
+    AIMapper_Error readFromHost(const cb_handle_t& cb,
+                                const uint32_t top, const uint32_t bottom) const {
+        const ScopedLatency latency(mStats.readbackLatency);
         const CbExternalMetadata& metadata = getExternalMetadata(cb);
         const HostConnectionSession conn = getHostConnectionSession();
         ExtendedRCEncoderContext *const rcEnc = conn.getRcEncoder();
@@ -603,24 +675,45 @@ private:
         }
 
         if (isYuvFormat(getPixelFormat(cb))) {
+            /*
+             * The host converts the whole frame into the guest YUV layout,
+             * a subregion or a single plane can't be requested.
+             */
             LOG_ALWAYS_FATAL_IF(!rcEnc->hasYUVCache());
             rcEnc->rcReadColorBufferYUV(rcEnc, cb.hostHandle,
                                         0, 0, metadata.width, metadata.height,
                                         cb.getBufferPtr(), cb.bufferSize);
+            mStats.bytesFromHost.add(cb.usage, cb.bufferSize);
         } else {
             LOG_ALWAYS_FATAL_IF(!rcEnc->featureInfo()->hasReadColorBufferDma);
-            rcEnc->bindDmaDirectly(cb.getBufferPtr(),
-                                   getMmapedPhysAddr(cb.getMmapedOffset()));
-            rcEnc->rcReadColorBufferDMA(rcEnc, cb.hostHandle,
-                                        0, 0, metadata.width, metadata.height,
-                                        metadata.glFormat, metadata.glType,
-                                        cb.getBufferPtr(), cb.bufferSize);
+            if (hasTightlyPackedRows(metadata)) {
+                const size_t stride = metadata.planeLayout[0].strideInBytes;
+                const size_t offset = top * stride;
+                char* const ptr = cb.getBufferPtr() + offset;
+
+                rcEnc->bindDmaDirectly(ptr,
+                                       getMmapedPhysAddr(cb.getMmapedOffset()) + offset);
+                rcEnc->rcReadColorBufferDMA(rcEnc, cb.hostHandle,
+                                            0, top, metadata.width, bottom - top,
+                                            metadata.glFormat, metadata.glType,
+                                            ptr, (bottom - top) * stride);
+                mStats.bytesFromHost.add(cb.usage, (bottom - top) * stride);
+            } else {
+                rcEnc->bindDmaDirectly(cb.getBufferPtr(),
+                                       getMmapedPhysAddr(cb.getMmapedOffset()));
+                rcEnc->rcReadColorBufferDMA(rcEnc, cb.hostHandle,
+                                            0, 0, metadata.width, metadata.height,
+                                            metadata.glFormat, metadata.glType,
+                                            cb.getBufferPtr(), cb.bufferSize);
+                mStats.bytesFromHost.add(cb.usage, cb.bufferSize);
+            }
         }
 
         return AIMAPPER_ERROR_NONE;
     }
 
     void flushToHost(const cb_handle_t& cb) const {
+        const ScopedLatency latency(mStats.flushLatency);
         const CbExternalMetadata& metadata = getExternalMetadata(cb);
         const HostConnectionSession conn = getHostConnectionSession();
         ExtendedRCEncoderContext *const rcEnc = conn.getRcEncoder();
@@ -631,6 +724,7 @@ private:
                                       0, 0, metadata.width, metadata.height,
                                       metadata.glFormat, metadata.glType,
                                       cb.getBufferPtr(), cb.bufferSize);
+        mStats.bytesToHost.add(cb.usage, cb.bufferSize);
     }
 
     int32_t getMetadata(const buffer_handle_t buffer,
@@ -649,10 +743,12 @@ private:
                                 const int64_t standardMetadataType,
                                 void* const destBuffer,
                                 const size_t destBufferSize) const {
-        const cb_handle_t* const cb = validateCb(buffer);
-        if (!cb) {
+        std::shared_lock<std::shared_mutex> lock(mImportedBuffersMtx);
+        const auto i = mImportedBuffers.find(static_cast<const cb_handle_t*>(buffer));
+        if (i == mImportedBuffers.end()) {
             return -FAILURE(AIMAPPER_ERROR_BAD_BUFFER);
         }
+        const cb_handle_t* const cb = i->first;
 
         // don't log dry runs
         if (destBufferSize && (mDebugLevel >= DebugLevel::METADATA)) {
@@ -660,6 +756,19 @@ private:
                   __func__, __LINE__, getID(*cb), standardMetadataType);
         }
 
+        if ((standardMetadataType > 0) &&
+                (standardMetadataType < static_cast<int64_t>(kEncodedMetadataCacheSize))) {
+            const EncodedMetadataCache& cache = i->second;
+            const EncodedMetadataCache::Range range = cache.ranges[standardMetadataType];
+            if (range.size) {
+                if (destBufferSize >= range.size) {
+                    memcpy(destBuffer, &cache.encoded[range.offset], range.size);
+                }
+                return range.size;
+            }
+        }
+        lock.unlock();
+
         return getStandardMetadataImpl(*cb, MetadataWriter(destBuffer, destBufferSize),
                                        static_cast<StandardMetadataType>(standardMetadataType));
     }
@@ -889,6 +998,42 @@ private:
         return writer.desiredSize();
     }
 
+    EncodedMetadataCache encodeImmutableMetadata(const cb_handle_t& cb) const {
+        EncodedMetadataCache cache;
+
+        for (const auto& m : kMetadataTypeDescriptionList) {
+            // settable values are shared with other processes and could
+            // change any time, they are always encoded on request.
+            if (!m.isGettable || m.isSettable) {
+                continue;
+            }
+
+            LOG_ALWAYS_FATAL_IF((m.metadataType.value <= 0) ||
+                                (m.metadataType.value >=
+                                 static_cast<int64_t>(kEncodedMetadataCacheSize)));
+            const StandardMetadataType standardMetadataType =
+                static_cast<StandardMetadataType>(m.metadataType.value);
+
+            const int32_t size = getStandardMetadataImpl(
+                cb, MetadataWriter(nullptr, 0), standardMetadataType);
+            if (size <= 0) {
+                continue;  // e.g. PLANE_LAYOUTS without the CPU buffer
+            }
+
+            const size_t offset = cache.encoded.size();
+            cache.encoded.resize(offset + size);
+            getStandardMetadataImpl(cb, MetadataWriter(&cache.encoded[offset], size),
+                                    standardMetadataType);
+
+            cache.ranges[m.metadataType.value] = {
+                .offset = static_cast<uint32_t>(offset),
+                .size = static_cast<uint32_t>(size),
+            };
+        }
+
+        return cache;
+    }
+
     AIMapper_Error setStandardMetadataImpl(const cb_handle_t& cb, MetadataReader reader,
                                            const StandardMetadataType standardMetadataType) const {
         const auto checkMetadataHeader = [](MetadataReader& reader,
@@ -1041,10 +1186,16 @@ retryWithLargerBuffer:
     AIMapper_Error dumpAllBuffers(const AIMapper_BeginDumpBufferCallback beginDumpCallback,
                                   const AIMapper_DumpBufferCallback dumpBufferCallback,
                                   void* const context) const {
+        {
+            std::string stats;
+            mStats.appendTo(stats);
+            ALOGI("%s:%d: GoldfishMapper:\n%s", __func__, __LINE__, stats.c_str());
+        }
+
         std::vector<uint8_t> metadataBuffer(kMetadataBufferInitialSize);
 
-        std::lock_guard<std::mutex> lock(mImportedBuffersMtx);
-        for (const cb_handle_t* const cb : mImportedBuffers) {
+        std::shared_lock<std::shared_mutex> lock(mImportedBuffersMtx);
+        for (const auto& [cb, unused] : mImportedBuffers) {
             (*beginDumpCallback)(context);
             dumpBufferImpl(*cb, dumpBufferCallback, context, metadataBuffer);
         }
@@ -1073,7 +1224,7 @@ retryWithLargerBuffer:
 
     cb_handle_t* validateCb(const buffer_handle_t buffer) const {
         cb_handle_t* cb = const_cast<cb_handle_t*>(static_cast<const cb_handle_t*>(buffer));
-        std::lock_guard<std::mutex> lock(mImportedBuffersMtx);
+        std::shared_lock<std::shared_mutex> lock(mImportedBuffersMtx);
         return mImportedBuffers.count(cb) ? cb : nullptr;
     }
 
@@ -1085,11 +1236,41 @@ retryWithLargerBuffer:
         return mPhysAddrToOffset + offset;
     }
 
+    struct Stats {
+        void appendTo(std::string& out) const {
+            ::android::base::StringAppendF(
+                &out, "  imported: %" PRIu64 " freed: %" PRIu64
+                      " readbacksSkipped: %" PRIu64 "\n",
+                imported.get(), freed.get(), readbacksSkipped.get());
+            live.appendTo(out, "live");
+            bytesFromHost.appendTo(out, "bytesFromHost");
+            bytesToHost.appendTo(out, "bytesToHost");
+            importLatency.appendTo(out, "import");
+            lockLatency.appendTo(out, "lock");
+            unlockLatency.appendTo(out, "unlock");
+            readbackLatency.appendTo(out, "readback");
+            flushLatency.appendTo(out, "flush");
+        }
+
+        Counter imported;
+        Counter freed;
+        Counter readbacksSkipped;   // write-only locks which did not need the host contents
+        LiveCounters live;          // imported and not freed yet, mapped bytes
+        UsageCounters bytesFromHost;
+        UsageCounters bytesToHost;
+        LatencyHistogram importLatency;
+        LatencyHistogram lockLatency;
+        LatencyHistogram unlockLatency;
+        LatencyHistogram readbackLatency;
+        LatencyHistogram flushLatency;
+    };
+
     AIMapper mMapper;
     const std::unique_ptr<HostConnection> mHostConn;
-    std::unordered_set<const cb_handle_t*> mImportedBuffers;
+    std::unordered_map<const cb_handle_t*, EncodedMetadataCache> mImportedBuffers;
     uint64_t mPhysAddrToOffset;
-    mutable std::mutex mImportedBuffersMtx;
+    mutable std::shared_mutex mImportedBuffersMtx;
+    mutable Stats mStats;
     const DebugLevel mDebugLevel;
 };
 }  // namespace
@@ -231,6 +231,15 @@ PRODUCT_PACKAGES += \
 
 DEVICE_MANIFEST_FILE += device/generic/goldfish/hals/audio/android.hardware.audio.effects@7.0.xml
 
+# AAudio MMAP (the mmap_no_irq mix ports) is opt-in, the stream timing is
+# derived from the guest clock and is not as steady as the normal path.
+ifeq ($(EMULATOR_AUDIO_MMAP),true)
+PRODUCT_VENDOR_PROPERTIES += \
+    aaudio.mmap_exclusive_policy=2 \
+    aaudio.mmap_policy=2 \
+
+endif
+
 PRODUCT_COPY_FILES += \
     device/generic/goldfish/hals/audio/policy/audio_policy_configuration.xml:$(TARGET_COPY_OUT_VENDOR)/etc/audio_policy_configuration.xml \
     device/generic/goldfish/hals/audio/policy/primary_audio_policy_configuration.xml:$(TARGET_COPY_OUT_VENDOR)/etc/primary_audio_policy_configuration.xml \